@@ -207,6 +207,26 @@ static int LuaGfb_setalpha(lua_State *L) {
 	return LuaGfb_pusherror(L, gfb_setalpha(psurface, lua_tonumber(L, 2)));
 }
 
+/**
+Set the alpha drawing primitives are blended with.
+The surface flag GFB_DRAWBLEND is set for alpha below 255.
+@param alpha The new draw alpha value.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_setdrawalpha(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1)
+		|| !lua_isnumber(L, 2)
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	gfb_surface_t *psurface = lua_touserdata(L, 1);
+
+	return LuaGfb_pusherror(L, gfb_setdrawalpha(psurface, lua_tonumber(L, 2)));
+}
+
 /**
 Set color key value of a surface.
 The surface flag GFB_SRCCOLORKEY is set automatically.
@@ -348,6 +368,24 @@ static int LuaGfb_clear(lua_State *L) {
 	return LuaGfb_pusherror(L, gfb_clear((gfb_surface_t *)lua_touserdata(L, 1)));
 }
 
+/**
+Clear the clip rectangle of the surface to a color.
+@param psurface Pointer to the surface to draw on.
+@param color Encoded pixel value.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_clearcolor(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1) //Destination surface
+		|| !lua_isnumber  (L, 2) //Color
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	return LuaGfb_pusherror(L, gfb_clear_color((gfb_surface_t *)lua_touserdata(L, 1), (gfb_color_t)lua_tonumber(L, 2)));
+}
+
 /** Draw a line.
 @param psurface Pointer to the surface to draw on.
 @param x1 Left pixel position of start point of line.
@@ -497,6 +535,132 @@ static int LuaGfb_filledcircle(lua_State *L) {
 	return LuaGfb_pusherror(L, gfb_filledcircle((gfb_surface_t *)lua_touserdata(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3), lua_tonumber(L, 4), (gfb_color_t)lua_tonumber(L, 5), (gfb_color_t)lua_tonumber(L, 6)));
 }
 
+/**
+Draw an ellipse.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of ellipse center.
+@param y Top pixel position of ellipse center.
+@param rx Horizontal radius.
+@param ry Vertical radius.
+@param color Encoded pixel value.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_ellipse(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1) //Destination surface.
+		|| !lua_isnumber  (L, 2) //Dest x
+		|| !lua_isnumber  (L, 3) //Dest y
+		|| !lua_isnumber  (L, 4) //Horizontal radius
+		|| !lua_isnumber  (L, 5) //Vertical radius
+		|| !lua_isnumber  (L, 6) //Color
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	return LuaGfb_pusherror(L, gfb_ellipse((gfb_surface_t *)lua_touserdata(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3), lua_tonumber(L, 4), lua_tonumber(L, 5), (gfb_color_t)lua_tonumber(L, 6)));
+}
+
+/**
+Draw a filled ellipse.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of ellipse center.
+@param y Top pixel position of ellipse center.
+@param rx Horizontal radius.
+@param ry Vertical radius.
+@param colorf Encoded pixel value of the outline color.
+@param colorb Encoded pixel value of the fill color.
+*/
+static int LuaGfb_filledellipse(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1) //Destination surface
+		|| !lua_isnumber  (L, 2) //Dest x
+		|| !lua_isnumber  (L, 3) //Dest y
+		|| !lua_isnumber  (L, 4) //Horizontal radius
+		|| !lua_isnumber  (L, 5) //Vertical radius
+		|| !lua_isnumber  (L, 6) //Outline color
+		|| !lua_isnumber  (L, 7) //Fill color
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	return LuaGfb_pusherror(L, gfb_filledellipse((gfb_surface_t *)lua_touserdata(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3), lua_tonumber(L, 4), lua_tonumber(L, 5), (gfb_color_t)lua_tonumber(L, 6), (gfb_color_t)lua_tonumber(L, 7)));
+}
+
+/**
+Draw an anti-aliased line.
+@param psurface Pointer to the surface to draw on.
+@param x1 Left pixel position of start point of line.
+@param y1 Top pixel position of start point of line.
+@param x2 Left pixel position of end point of line.
+@param y2 Top pixel position of end point of line.
+@param color Encoded pixel value.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_lineaa(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1) //Destination surface.
+		|| !lua_isnumber  (L, 2) //Source x
+		|| !lua_isnumber  (L, 3) //Source y
+		|| !lua_isnumber  (L, 4) //Dest x
+		|| !lua_isnumber  (L, 5) //Dest y
+		|| !lua_isnumber  (L, 6) //Color
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	return LuaGfb_pusherror(L, gfb_line_aa((gfb_surface_t *)lua_touserdata(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3), lua_tonumber(L, 4), lua_tonumber(L, 5), (gfb_color_t)lua_tonumber(L, 6)));
+}
+
+/**
+Draw an anti-aliased circle.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of circle center.
+@param y Top pixel position of circle center.
+@param radius Circle radius.
+@param color Encoded pixel value.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_circleaa(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1) //Destination surface.
+		|| !lua_isnumber  (L, 2) //Dest x
+		|| !lua_isnumber  (L, 3) //Dest y
+		|| !lua_isnumber  (L, 4) //Radius
+		|| !lua_isnumber  (L, 5) //Color
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	return LuaGfb_pusherror(L, gfb_circle_aa((gfb_surface_t *)lua_touserdata(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3), lua_tonumber(L, 4), (gfb_color_t)lua_tonumber(L, 5)));
+}
+
+/**
+Draw an anti-aliased filled circle.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of circle center.
+@param y Top pixel position of circle center.
+@param radius Circle radius.
+@param color Encoded pixel value.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_filledcircleaa(lua_State *L) {
+	if (
+		   !lua_isuserdata(L, 1) //Destination surface.
+		|| !lua_isnumber  (L, 2) //Dest x
+		|| !lua_isnumber  (L, 3) //Dest y
+		|| !lua_isnumber  (L, 4) //Radius
+		|| !lua_isnumber  (L, 5) //Color
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	return LuaGfb_pusherror(L, gfb_filledcircle_aa((gfb_surface_t *)lua_touserdata(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3), lua_tonumber(L, 4), (gfb_color_t)lua_tonumber(L, 5)));
+}
+
 #if 0
 /**
 Draw lines between the given polygon points.
@@ -522,19 +686,65 @@ int gfb_floodfill(gfb_surface_t *psurface, int x, int y, gfb_color_t color);
 #endif
 
 /**
-Load true-type file from memory.
-@param pttf Pointer to the true-type file in memory.
-@param ttfsize Number of bytes in pttf[].
+Load true-type file from disk, the file is mapped and not read into memory.
+@param path Path to the font file.
 @return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
-@return On failure, returns a negative error code (GFB_Exxx).
+@return On failure, returns nil and an error string.
 */
 static int LuaGfb_loadfont(lua_State *L) {
-	uint8_t *pttf;
-	size_t ttfsize;
+	if (
+		   !lua_isstring  (L, 1) //Path
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	gfb_font_id fontid = gfb_ttf_load_file(lua_tostring(L, 1));
+	if (fontid < 0) {
+		return LuaGfb_pusherror(L, fontid);
+	}
+
+	lua_pushinteger(L, fontid);
+
+	return 1;
+}
 
-	//int gfb_font_id gfb_ttf_load_memory(uint8_t *pttf, size_t ttfsize);
+/**
+Load a PSF1, PSF2 or BDF bitmap font from disk.
+@param path Path to the font file.
+@return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
+@return On failure, returns nil and an error string.
+*/
+static int LuaGfb_loadbitmapfont(lua_State *L) {
+	if (
+		   !lua_isstring  (L, 1) //Path
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
+
+	gfb_font_id fontid = gfb_bmf_load_file(lua_tostring(L, 1));
+	if (fontid < 0) {
+		return LuaGfb_pusherror(L, fontid);
+	}
+
+	lua_pushinteger(L, fontid);
+
+	return 1;
+}
+
+/**
+Unload a font loaded with loadFont or loadBitmapFont.
+@param fontid Id of the font to unload.
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+static int LuaGfb_unloadfont(lua_State *L) {
+	if (
+		   !lua_isnumber  (L, 1) //Font Id
+	) {
+		return LuaGfb_pusherror(L, GFB_EARGUMENT);
+	}
 
-	return ;
+	return LuaGfb_pusherror(L, gfb_ttf_unload((gfb_font_id)lua_tonumber(L, 1)));
 }
 
 #if 0
@@ -640,18 +850,27 @@ luaL_Reg libGfb[] = {
 	{ .name = "mapRGBA",            .func = LuaGfb_maprgba },
 	{ .name = "setCliprect",        .func = LuaGfb_setcliprect },
 	{ .name = "setAlpha",           .func = LuaGfb_setalpha },
+	{ .name = "setDrawAlpha",       .func = LuaGfb_setdrawalpha },
 	{ .name = "setColorkey",        .func = LuaGfb_setcolorkey },
 	{ .name = "putPixel",           .func = LuaGfb_putpixel },
 	{ .name = "getPixel",           .func = LuaGfb_getpixel },
 	{ .name = "blit",               .func = LuaGfb_blit },
 	{ .name = "clear",              .func = LuaGfb_clear },
+	{ .name = "clearColor",         .func = LuaGfb_clearcolor },
 	{ .name = "line",               .func = LuaGfb_line },
 	{ .name = "rectangle",          .func = LuaGfb_rectangle },
 	{ .name = "circle",             .func = LuaGfb_circle },
 	{ .name = "filledRectangle",    .func = LuaGfb_filledrectangle },
 	{ .name = "flip",               .func = LuaGfb_flip },
 	{ .name = "filledCircle",       .func = LuaGfb_filledcircle },
+	{ .name = "ellipse",            .func = LuaGfb_ellipse },
+	{ .name = "filledEllipse",      .func = LuaGfb_filledellipse },
+	{ .name = "lineAA",             .func = LuaGfb_lineaa },
+	{ .name = "circleAA",           .func = LuaGfb_circleaa },
+	{ .name = "filledCircleAA",     .func = LuaGfb_filledcircleaa },
 	{ .name = "loadFont",           .func = LuaGfb_loadfont },
+	{ .name = "loadBitmapFont",     .func = LuaGfb_loadbitmapfont },
+	{ .name = "unloadFont",         .func = LuaGfb_unloadfont },
 	{ .name = "text",               .func = LuaGfb_text },
 	//--
 	{ .name = NULL, .func = NULL }
@@ -24,14 +24,37 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdbool.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <math.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/** Non-zero to guard the glyph cache with a mutex, 0 for single threaded builds without pthreads. */
+#ifndef GFB_THREADSAFE
+#define GFB_THREADSAFE	1
+#endif
+
+#if GFB_THREADSAFE
+#include <pthread.h>
+#endif
+
 #include "libgfb.h"
 
+#if GFB_WITH_FREETYPE
+#include FT_SIZES_H
+#endif
+
 /** Configuration of each pixel format. */
 gfb_pixelformat_t gfb_pixelformats[MAX_GFB_PIXELFORMAT] = {
 //               Identifier,  bpp, Bpp, ashift, rshift, gshift, bshift,       amask,      rmask,      gmask,      gmask
@@ -45,11 +68,91 @@ gfb_pixelformat_t gfb_pixelformats[MAX_GFB_PIXELFORMAT] = {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+#if GFB_WITH_FREETYPE
 /** Handle to freetype2. */
 static FT_Library libft2 = NULL;
+#endif
+
+/** Fonts per block of the font store. */
+#define GFB_FONT_BLOCK	16
+
+/** Loaded font, either a FreeType face and the size objects created for it or a bitmap font. */
+typedef struct gfb_fontentry {
+#if GFB_WITH_FREETYPE
+	FT_Face face;					/**< Face object, NULL for a bitmap font or a free entry. */
+#endif
+	const gfb_bmf_t *pbmf;			/**< Bitmap font, NULL for a face or a free entry. */
+	void *pbmfdata;					/**< Bitmap font allocated by gfb_bmf_load_memory(), NULL for one compiled into the program. */
+	int loaded;						/**< Non-zero until gfb_ttf_unload(), only loaded fonts can be drawn with by id. */
+	int refs;						/**< One for the load plus one per fixed font rendering from the face, 0 if the entry is free. */
+	void *pmapping;					/**< Font file mapped by gfb_ttf_load_file(), NULL if the caller owns the data. */
+	size_t mapsize;					/**< Number of bytes mapped at pmapping. */
+#if GFB_WITH_FREETYPE
+	uint8_t active;					/**< Point size of the active size object, 0 for the one the face was loaded with. */
+	FT_Size sizes[UINT8_MAX + 1];	/**< Size object of each point size, created on first use. The face owns and frees them. */
+#endif
+} gfb_fontentry_t;
+
+/** The font store, allocated a block at a time as fonts are loaded. Blocks never move once allocated. */
+static gfb_fontentry_t *gfb_fontblocks[(MAX_GFB_FONT + GFB_FONT_BLOCK - 1) / GFB_FONT_BLOCK];
+
+/** Store entry of a font id, NULL if the id is out of range or its block is not allocated. */
+static inline gfb_fontentry_t *gfb_font_entry(gfb_font_id fontid) {
+	if (fontid < 0 || fontid >= MAX_GFB_FONT) return NULL;
 
-/**< Handles to face objects. */
-static FT_Face gfb_fontstore[MAX_GFB_FONT] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, };
+	gfb_fontentry_t *pblock = gfb_fontblocks[fontid / GFB_FONT_BLOCK];
+	return pblock != NULL ? &pblock[fontid % GFB_FONT_BLOCK] : NULL;
+}
+
+/** Store entry of a loaded font, NULL if fontid is not a loaded font. */
+static inline gfb_fontentry_t *gfb_font_loaded(gfb_font_id fontid) {
+	gfb_fontentry_t *pentry = gfb_font_entry(fontid);
+	return pentry != NULL && pentry->loaded ? pentry : NULL;
+}
+
+#if GFB_WITH_FREETYPE
+/** Face of a loaded font, NULL if fontid is not a loaded true-type font. */
+static inline FT_Face gfb_font_face(gfb_font_id fontid) {
+	gfb_fontentry_t *pentry = gfb_font_loaded(fontid);
+	return pentry != NULL ? pentry->face : NULL;
+}
+#endif
+
+/** Bytes per row of a bitmap font glyph. */
+static inline int gfb_bmf_pitch(int width) {
+	return (width + 7) / 8;
+}
+
+/**
+Glyph of a code point in a bitmap font, a blank cell if the font does not have it.
+@param pbmf Pointer to the bitmap font.
+@param code Unicode code point.
+@param pcell Storage for glyphs that are not in a glyph table.
+@return Returns a pointer to the glyph.
+*/
+static const gfb_bmf_glyph_t *gfb_bmf_glyph(const gfb_bmf_t *pbmf, uint32_t code, gfb_bmf_glyph_t *pcell) {
+	memset(pcell, 0x00, sizeof(gfb_bmf_glyph_t));
+	pcell->code = code;
+	pcell->xadvance = (uint8_t)pbmf->width;
+
+	if (pbmf->pglyphs == NULL) {
+		if (code < pbmf->first || code - pbmf->first >= pbmf->count) return pcell;
+
+		pcell->offset = (code - pbmf->first) * gfb_bmf_pitch(pbmf->width) * pbmf->height;
+		pcell->width = (uint8_t)pbmf->width;
+		pcell->height = (uint8_t)pbmf->height;
+		pcell->ybearing = (int8_t)pbmf->ascent;
+		return pcell;
+	}
+
+	size_t lo = 0, hi = pbmf->count;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (pbmf->pglyphs[mid].code < code) lo = mid + 1; else hi = mid;
+	}
+
+	return lo < pbmf->count && pbmf->pglyphs[lo].code == code ? &pbmf->pglyphs[lo] : pcell;
+}
 
 #define gfb_gcindex(x) (x % MAX_GFB_GLYPH)
 
@@ -81,6 +184,823 @@ static inline gfb_rect_t gfb_cliprect(gfb_rect_t *prect1, gfb_rect_t *prect2) {
 	return r;
 }
 
+/**
+Clip a line segment against a rectangle (Liang-Barsky).
+The end points are moved along the line towards each other so the slope of the line is preserved.
+@param prect Pointer to the clip rectangle. The right and bottom edges are exclusive.
+@param px1 Pointer to the left pixel position of the start point.
+@param py1 Pointer to the top pixel position of the start point.
+@param px2 Pointer to the left pixel position of the end point.
+@param py2 Pointer to the top pixel position of the end point.
+@return Returns 1 if some part of the line is inside the rectangle, the end points are then updated.
+@return Returns 0 if the line is entirely outside the rectangle, the end points are then left untouched.
+*/
+static inline int gfb_clipline(const gfb_rect_t *prect, int *px1, int *py1, int *px2, int *py2) {
+	int xmin = prect->x;
+	int ymin = prect->y;
+	int xmax = prect->x + prect->w - 1;
+	int ymax = prect->y + prect->h - 1;
+
+	if (prect->w <= 0 || prect->h <= 0) return 0;
+
+	//Trivial accept, both points inside.
+	if (
+		   gfb_inside(*px1, xmin, xmax) && gfb_inside(*py1, ymin, ymax)
+		&& gfb_inside(*px2, xmin, xmax) && gfb_inside(*py2, ymin, ymax)
+	) {
+		return 1;
+	}
+
+	//Trivial reject, both points on the outside of the same edge.
+	if (
+		   (*px1 < xmin && *px2 < xmin) || (*px1 > xmax && *px2 > xmax)
+		|| (*py1 < ymin && *py2 < ymin) || (*py1 > ymax && *py2 > ymax)
+	) {
+		return 0;
+	}
+
+	//Coordinates may be far outside the surface so do the math in double precision.
+	double x1 = *px1;
+	double y1 = *py1;
+	double dx = (double)*px2 - x1;
+	double dy = (double)*py2 - y1;
+
+	double p[4] = { -dx, dx, -dy, dy };
+	double q[4] = { x1 - xmin, xmax - x1, y1 - ymin, ymax - y1 };
+	double t0 = 0.0;	//Parameter where the line enters the rectangle.
+	double t1 = 1.0;	//Parameter where the line leaves the rectangle.
+
+	for (int i = 0; i < 4; i++) {
+		if (p[i] == 0.0) {
+			//Parallel to this edge, reject if on the outside of it.
+			if (q[i] < 0.0) return 0;
+			continue;
+		}
+
+		double t = q[i] / p[i];
+		if (p[i] < 0.0) {
+			if (t > t0) t0 = t;
+		} else {
+			if (t < t1) t1 = t;
+		}
+
+		if (t0 > t1) return 0;
+	}
+
+	//Round to nearest pixel and keep inside the rectangle despite rounding.
+	int x2 = *px2;
+	int y2 = *py2;
+	if (t0 > 0.0) {
+		*px1 = gfb_clampi((int)floor(x1 + t0 * dx + 0.5), xmin, xmax);
+		*py1 = gfb_clampi((int)floor(y1 + t0 * dy + 0.5), ymin, ymax);
+	}
+	if (t1 < 1.0) {
+		x2 = gfb_clampi((int)floor(x1 + t1 * dx + 0.5), xmin, xmax);
+		y2 = gfb_clampi((int)floor(y1 + t1 * dy + 0.5), ymin, ymax);
+	}
+	*px2 = x2;
+	*py2 = y2;
+
+	return 1;
+}
+
+/**
+Store an encoded pixel value at the given address in a pixel buffer.
+@param p Pointer to the first byte of the pixel.
+@param color Encoded pixel value.
+@param bpp Number of bytes per pixel.
+*/
+static inline void gfb_pokepixel(uint8_t *p, gfb_color_t color, unsigned int bpp) {
+	//Constant sizes let the compiler turn each memcpy() into a single store.
+	switch (bpp) {
+		case 4: memcpy(p, &color, 4); break;
+		case 3: memcpy(p, &color, 3); break;
+		case 2: memcpy(p, &color, 2); break;
+		default: memcpy(p, &color, bpp); break;
+	}
+}
+
+/** Read an encoded pixel value from the given address in a pixel buffer. */
+static inline gfb_color_t gfb_peekpixel(const uint8_t *p, unsigned int bpp) {
+	gfb_color_t color = 0;
+	switch (bpp) {
+		case 4: memcpy(&color, p, 4); break;
+		case 3: memcpy(&color, p, 3); break;
+		case 2: memcpy(&color, p, 2); break;
+		default: memcpy(&color, p, bpp); break;
+	}
+	return color;
+}
+
+/**
+Blend an encoded pixel value over another by an 8-bit coverage.
+@param src Encoded pixel value drawn.
+@param dst Encoded pixel value already in the buffer.
+@param coverage Weight of src, 0 keeps dst and 255 gives src.
+@param pformat Pixel format of both values.
+@param bpp Number of bytes per pixel, a constant lets the compiler drop the other format.
+@return Blended encoded pixel value.
+*/
+static inline gfb_color_t gfb_blendcolor(gfb_color_t src, gfb_color_t dst, uint8_t coverage, const gfb_pixelformat_t *pformat, unsigned int bpp) {
+	uint32_t a = coverage + (coverage >> 7);	//0-256.
+	uint32_t na = 256 - a;
+
+	if (bpp >= 3) {
+		//8-bit channels, blend two channels per multiply with 16-bit lanes.
+		uint32_t rb = ((src & 0x00ff00ffu) * a + (dst & 0x00ff00ffu) * na) >> 8;
+		uint32_t ag = ((src >> 8) & 0x00ff00ffu) * a + ((dst >> 8) & 0x00ff00ffu) * na;
+		return (rb & 0x00ff00ffu) | (ag & 0xff00ff00u);
+	}
+
+	//Narrow channels fit their multiply in place.
+	gfb_color_t color = 0;
+	const uint32_t masks[4] = { pformat->amask, pformat->rmask, pformat->gmask, pformat->bmask };
+	for (int i = 0; i < 4; i++) {
+		color |= (((src & masks[i]) * a + (dst & masks[i]) * na) >> 8) & masks[i];
+	}
+	return color;
+}
+
+/** Blend an encoded pixel value into the pixel at the given address by an 8-bit coverage. */
+static inline void gfb_blendpoke(uint8_t *p, gfb_color_t color, uint8_t coverage, const gfb_pixelformat_t *pformat, unsigned int bpp) {
+	if (coverage == 0) return;
+	if (coverage != 255) color = gfb_blendcolor(color, gfb_peekpixel(p, bpp), coverage, pformat, bpp);
+	gfb_pokepixel(p, color, bpp);
+}
+
+/** Scale an 8-bit coverage by an 8-bit alpha, 255 leaves the coverage unchanged. */
+static inline uint8_t gfb_scalecoverage(uint8_t coverage, uint8_t alpha) {
+	return (uint8_t)((coverage * (uint32_t)(alpha + (alpha >> 7))) >> 8);
+}
+
+/** Alpha the primitives of a surface are blended with, 255 (opaque) unless GFB_DRAWBLEND is set. */
+static inline uint8_t gfb_drawalpha(const gfb_surface_t *psurface) {
+	return (psurface->flags & GFB_DRAWBLEND) ? psurface->drawalpha : 255;
+}
+
+/**
+Encoded pixel value repeated for the fill engine, see gfb_fillbytes().
+A row of pixels starting at byte offset k continues with the bytes from offset k % bpp.
+*/
+typedef struct gfb_pattern {
+	uint8_t bytes[64];	/**< Pixel bytes repeated, 48 is a multiple of every pixel size and of the vector size. */
+	unsigned int bpp;	/**< Number of bytes per pixel. */
+} gfb_pattern_t;
+
+/** Broadcast an encoded pixel value into a fill pattern. */
+static inline void gfb_pattern_init(gfb_pattern_t *ppattern, gfb_color_t color, unsigned int bpp) {
+	uint8_t pixel[sizeof(gfb_color_t)];
+	unsigned int i;
+
+	memcpy(pixel, &color, sizeof(pixel));
+	for (i = 0; i < sizeof(ppattern->bytes); i++) ppattern->bytes[i] = pixel[i % bpp];
+	ppattern->bpp = bpp;
+}
+
+/**
+Fill a run of bytes with whole pixels from a pattern.
+With SSE2 the run is written with aligned 16 byte stores, three vectors cover the
+48 byte period of any pixel size. Streaming stores bypass the cache, the caller
+must issue a store fence after the last streaming fill.
+@param p Pointer to the first byte of the first pixel.
+@param nbytes Number of bytes to fill, a multiple of the pixel size.
+@param ppattern Pointer to the fill pattern.
+@param stream Non-zero to use non-temporal stores.
+*/
+static inline void gfb_fillbytes(uint8_t *p, size_t nbytes, const gfb_pattern_t *ppattern, int stream) {
+	const uint8_t *pbytes = ppattern->bytes;
+	unsigned int bpp = ppattern->bpp;
+
+#if defined(__SSE2__)
+	if (nbytes >= 64) {
+		size_t head = (size_t)(-(uintptr_t)p & 15);
+		size_t tail = (nbytes - head) & 15;
+		size_t nvec = (nbytes - head) >> 4;
+
+		//Scalar head up to the first aligned address.
+		memcpy(p, pbytes, head);
+		p += head;
+
+		//Phase of the pattern at each of the three vectors in a period.
+		__m128i v0 = _mm_loadu_si128((const __m128i *)&pbytes[head % bpp]);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)&pbytes[(head + 16) % bpp]);
+		__m128i v2 = _mm_loadu_si128((const __m128i *)&pbytes[(head + 32) % bpp]);
+
+		if (stream) {
+			for (; nvec >= 3; nvec -= 3, p += 48) {
+				_mm_stream_si128((__m128i *)p, v0);
+				_mm_stream_si128((__m128i *)(p + 16), v1);
+				_mm_stream_si128((__m128i *)(p + 32), v2);
+			}
+		} else {
+			for (; nvec >= 3; nvec -= 3, p += 48) {
+				_mm_store_si128((__m128i *)p, v0);
+				_mm_store_si128((__m128i *)(p + 16), v1);
+				_mm_store_si128((__m128i *)(p + 32), v2);
+			}
+		}
+		if (nvec > 0) {
+			_mm_store_si128((__m128i *)p, v0);
+			p += 16;
+			if (nvec > 1) {
+				_mm_store_si128((__m128i *)p, v1);
+				p += 16;
+			}
+		}
+
+		//Scalar tail.
+		memcpy(p, &pbytes[(nbytes - tail) % bpp], tail);
+		return;
+	}
+#else
+	(void)stream;
+#endif
+
+	//Write one period then keep doubling the filled part.
+	size_t done = nbytes < 48 ? nbytes : 48;
+	memcpy(p, pbytes, done);
+	while (done < nbytes) {
+		size_t chunk = (done < nbytes - done) ? done : nbytes - done;
+		memcpy(p + done, p, chunk);
+		done += chunk;
+	}
+}
+
+/**
+Fill a run of pixels with an encoded pixel value.
+@param p Pointer to the first byte of the first pixel.
+@param n Number of pixels to fill.
+@param color Encoded pixel value.
+@param bpp Number of bytes per pixel.
+*/
+static inline void gfb_fillrow(uint8_t *p, int n, gfb_color_t color, unsigned int bpp) {
+	int i;
+
+	if (n <= 0) return;
+
+	//Short runs are cheaper pixel by pixel than broadcasting the color.
+	if (n < 16) {
+		switch (bpp) {
+			case 4: for (i = 0; i < n; i++, p += 4) memcpy(p, &color, 4); break;
+			case 3: for (i = 0; i < n; i++, p += 3) memcpy(p, &color, 3); break;
+			case 2: for (i = 0; i < n; i++, p += 2) memcpy(p, &color, 2); break;
+			default: for (i = 0; i < n; i++, p += bpp) memcpy(p, &color, bpp); break;
+		}
+		return;
+	}
+
+	gfb_pattern_t pattern;
+	gfb_pattern_init(&pattern, color, bpp);
+	gfb_fillbytes(p, (size_t)n * bpp, &pattern, 0);
+}
+
+/**
+Blend whole pixels from a pattern over a run of bytes, source over with a constant alpha.
+Every byte is an independent 8-bit channel so pixels of 3 and 4 bytes share the kernel.
+With SSE2 sixteen channels are blended per iteration in 16-bit lanes.
+@param p Pointer to the first byte of the first pixel.
+@param nbytes Number of bytes to blend, a multiple of the pixel size.
+@param ppattern Pointer to the pattern of the source color.
+@param alpha Weight of the source, 0-256.
+*/
+static inline void gfb_blendbytes(uint8_t *p, size_t nbytes, const gfb_pattern_t *ppattern, uint32_t alpha) {
+	const uint8_t *pbytes = ppattern->bytes;
+	unsigned int bpp = ppattern->bpp;
+	uint32_t na = 256 - alpha;
+	size_t i = 0;
+	unsigned int j = 0;
+
+#if defined(__SSE2__)
+	if (nbytes >= 64) {
+		size_t head = (size_t)(-(uintptr_t)p & 15);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i vna = _mm_set1_epi16((short)na);
+		const __m128i va = _mm_set1_epi16((short)alpha);
+		__m128i slo[3], shi[3];
+		int k;
+
+		//Scalar head up to the first aligned address, the pattern is at phase i there.
+		for (; i < head; i++) p[i] = (uint8_t)((pbytes[i] * alpha + p[i] * na) >> 8);
+
+		//Premultiplied source of the three vectors in a 48 byte period.
+		for (k = 0; k < 3; k++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&pbytes[(head + 16 * k) % bpp]);
+			slo[k] = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), va);
+			shi[k] = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), va);
+		}
+
+		for (k = 0; i + 16 <= nbytes; i += 16) {
+			__m128i d = _mm_load_si128((const __m128i *)(p + i));
+			__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), vna), slo[k]), 8);
+			__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), vna), shi[k]), 8);
+			_mm_store_si128((__m128i *)(p + i), _mm_packus_epi16(lo, hi));
+			if (++k == 3) k = 0;
+		}
+	}
+#endif
+
+	//Scalar tail, or the whole run when it is short.
+	for (j = (unsigned int)(i % bpp); i < nbytes; i++) {
+		p[i] = (uint8_t)((pbytes[j] * alpha + p[i] * na) >> 8);
+		if (++j == bpp) j = 0;
+	}
+}
+
+/**
+Blend a run of pixels with an encoded pixel value, source over with a constant alpha.
+@param p Pointer to the first byte of the first pixel.
+@param n Number of pixels to blend.
+@param color Encoded pixel value.
+@param alpha Opacity of color, 0-255.
+@param pformat Pixel format of the run.
+*/
+static inline void gfb_blendrow(uint8_t *p, int n, gfb_color_t color, uint8_t alpha, const gfb_pixelformat_t *pformat) {
+	unsigned int bpp = pformat->bytesperpixel;
+	int i;
+
+	if (n <= 0 || alpha == 0) return;
+
+	if (bpp >= 3) {
+		gfb_pattern_t pattern;
+		gfb_pattern_init(&pattern, color, bpp);
+		gfb_blendbytes(p, (size_t)n * bpp, &pattern, alpha + (alpha >> 7));
+		return;
+	}
+
+	//Narrow channels are blended per pixel.
+	for (i = 0; i < n; i++, p += bpp) gfb_blendpoke(p, color, alpha, pformat, bpp);
+}
+
+/**
+Blend a color over a run of pixels through an 8-bit coverage mask, source over.
+With SSE2 four 32-bit pixels are blended per iteration in 16-bit lanes, giving the same result as
+gfb_blendcolor(). Groups of four clear mask bytes are skipped and four solid ones are stored.
+@param p Pointer to the first byte of the first pixel.
+@param pmask Pointer to the coverage of each pixel, 0 keeps the pixel and 255 replaces it.
+@param n Number of pixels to blend.
+@param color Encoded pixel value.
+@param pformat Pixel format of the run.
+*/
+static inline void gfb_maskrow(uint8_t *p, const uint8_t *pmask, int n, gfb_color_t color, const gfb_pixelformat_t *pformat) {
+	unsigned int bpp = pformat->bytesperpixel;
+	int i = 0;
+
+#if defined(__SSE2__)
+	if (bpp == 4 && n >= 4) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i v256 = _mm_set1_epi16(256);
+		const __m128i vsolid = _mm_set1_epi32((int)color);
+		const __m128i vcolor = _mm_unpacklo_epi8(vsolid, zero);
+
+		for (; i + 4 <= n; i += 4, p += 16) {
+			uint32_t m;
+			memcpy(&m, &pmask[i], sizeof(m));
+			if (m == 0) continue;
+			if (m == UINT32_MAX) {
+				_mm_storeu_si128((__m128i *)p, vsolid);
+				continue;
+			}
+
+			//Coverage of each pixel in the four 16-bit lanes of its channels, scaled to 0-256.
+			__m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)m), zero);
+			c = _mm_unpacklo_epi16(c, c);
+			__m128i alo = _mm_unpacklo_epi32(c, c);
+			__m128i ahi = _mm_unpackhi_epi32(c, c);
+			alo = _mm_add_epi16(alo, _mm_srli_epi16(alo, 7));
+			ahi = _mm_add_epi16(ahi, _mm_srli_epi16(ahi, 7));
+
+			__m128i d = _mm_loadu_si128((const __m128i *)p);
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(vcolor, alo), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(v256, alo)));
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(vcolor, ahi), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(v256, ahi)));
+			_mm_storeu_si128((__m128i *)p, _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+		}
+	}
+#endif
+
+	for (; i < n; i++, p += bpp) gfb_blendpoke(p, color, pmask[i], pformat, bpp);
+}
+
+/** Ordered dither thresholds, 0-15 over a 4x4 pixel tile. */
+static const uint8_t gfb_bayer4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/** Gradient prepared for the pixel format of one surface, see gfb_paint_init(). */
+typedef struct gfb_paint {
+	const gfb_gradient_t *pgradient;	/**< Gradient being filled. */
+	gfb_color_t colors[256];			/**< Color table of the gradient encoded in the surface pixel format. */
+	int opaque;							/**< Non-zero if every color in the table is opaque. */
+	int dither;							/**< Non-zero to dither, a channel of the surface has less than 8 bits. */
+	uint8_t loss[4];					/**< Bits dropped from alpha, red, green and blue when encoding. */
+	double tx;							/**< Linear: table index per pixel to the right. */
+	double ty;							/**< Linear: table index per pixel down. */
+	float rscale;						/**< Radial: table index per pixel of distance from the center. */
+} gfb_paint_t;
+
+/** Number of bits dropped from an 8-bit component to fit a channel mask. */
+static inline uint8_t gfb_paint_loss(uint32_t mask, uint8_t shift) {
+	int bits = __builtin_popcount(mask >> shift);
+	return bits >= 8 ? 0 : (uint8_t)(8 - bits);
+}
+
+/** Prepare a gradient for filling a surface. */
+static void gfb_paint_init(gfb_paint_t *ppaint, gfb_surface_t *psurface, const gfb_gradient_t *pgradient) {
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	int i;
+
+	ppaint->pgradient = pgradient;
+	ppaint->loss[0] = gfb_paint_loss(pformat->amask, pformat->ashift);
+	ppaint->loss[1] = gfb_paint_loss(pformat->rmask, pformat->rshift);
+	ppaint->loss[2] = gfb_paint_loss(pformat->gmask, pformat->gshift);
+	ppaint->loss[3] = gfb_paint_loss(pformat->bmask, pformat->bshift);
+	ppaint->dither = pgradient->dither && ((ppaint->loss[1] | ppaint->loss[2] | ppaint->loss[3]) & 7) != 0;
+
+	ppaint->opaque = 1;
+	for (i = 0; i < 256; i++) {
+		uint32_t argb = pgradient->lut[i];
+		uint8_t a = (uint8_t)(argb >> 24);
+		ppaint->colors[i] = gfb_maprgba(psurface, (uint8_t)(argb >> 16) >> ppaint->loss[1], (uint8_t)(argb >> 8) >> ppaint->loss[2], (uint8_t)argb >> ppaint->loss[3], a);
+		if (a != 255) ppaint->opaque = 0;
+	}
+
+	ppaint->tx = ppaint->ty = 0.0;
+	ppaint->rscale = 0.0f;
+	if (pgradient->type == GFB_GRADIENT_LINEAR) {
+		double dx = (double)pgradient->x1 - pgradient->x0;
+		double dy = (double)pgradient->y1 - pgradient->y0;
+		double len2 = dx * dx + dy * dy;
+		if (len2 > 0.0) {
+			ppaint->tx = dx * 255.0 / len2;
+			ppaint->ty = dy * 255.0 / len2;
+		}
+	} else {
+		ppaint->rscale = 255.0f / pgradient->radius;
+	}
+}
+
+/** Encode a color table entry with an ordered dither threshold (0-15) added to each channel. */
+static inline gfb_color_t gfb_paint_dither(const gfb_paint_t *ppaint, const gfb_pixelformat_t *pformat, uint32_t argb, unsigned int threshold) {
+	gfb_color_t color = 0;
+	unsigned int c;
+
+	c = (argb >> 16) & 0xff;
+	c = gfb_mini(255, c + ((threshold << ppaint->loss[1]) >> 4));
+	color |= ((c >> ppaint->loss[1]) << pformat->rshift) & pformat->rmask;
+	c = (argb >> 8) & 0xff;
+	c = gfb_mini(255, c + ((threshold << ppaint->loss[2]) >> 4));
+	color |= ((c >> ppaint->loss[2]) << pformat->gshift) & pformat->gmask;
+	c = argb & 0xff;
+	c = gfb_mini(255, c + ((threshold << ppaint->loss[3]) >> 4));
+	color |= ((c >> ppaint->loss[3]) << pformat->bshift) & pformat->bmask;
+	color |= (((argb >> 24) >> ppaint->loss[0]) << pformat->ashift) & pformat->amask;
+
+	return color;
+}
+
+/**
+Fill pixels x1 to x2 (inclusive, already clipped) on row y from a gradient.
+Table indices of a linear gradient step by a constant 16.16 fixed point increment along the span,
+a radial gradient takes the distance of each pixel center.
+@param psurface Pointer to the surface to draw on.
+@param ppaint Pointer to the gradient prepared for the surface.
+@param x1 Left pixel position.
+@param x2 Right pixel position (inclusive).
+@param y Top pixel position.
+@param coverage Coverage of the pixels, 255 for full.
+*/
+static void gfb_paint_span(gfb_surface_t *psurface, const gfb_paint_t *ppaint, int x1, int x2, int y, uint8_t coverage) {
+	const gfb_gradient_t *pgradient = ppaint->pgradient;
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	unsigned int bpp = pformat->bytesperpixel;
+	uint8_t alpha = gfb_scalecoverage(coverage, gfb_drawalpha(psurface));
+	uint8_t *p = &psurface->pbuffer[ psurface->prowoffsets[y] + psurface->pcoloffsets[x1] ];
+	uint8_t index[256];
+	int64_t t = 0, dt = 0;
+
+	if (pgradient->type == GFB_GRADIENT_LINEAR) {
+		double t0 = ((x1 + 0.5 - pgradient->x0) * ppaint->tx + (y + 0.5 - pgradient->y0) * ppaint->ty) * 65536.0;
+		//Clamp far away spans before the conversion, stepping can not come back into range before x2.
+		t0 = fmin(fmax(t0, -65536.0 * 65536.0), 65536.0 * 65536.0);
+		t = (int64_t)t0 + 32768;
+		dt = (int64_t)(ppaint->tx * 65536.0);
+
+		//Vertical gradients are one color per row.
+		if (dt == 0 && !ppaint->dither) {
+			int i = (int)(t < 0 ? 0 : (t >> 16) > 255 ? 255 : t >> 16);
+			gfb_color_t color = ppaint->colors[i];
+			if (ppaint->opaque && alpha == 255) {
+				gfb_fillrow(p, x2 - x1 + 1, color, bpp);
+			} else {
+				gfb_blendrow(p, x2 - x1 + 1, color, gfb_scalecoverage(pgradient->lut[i] >> 24, alpha), pformat);
+			}
+			return;
+		}
+	}
+
+	//Table indices are computed a chunk at a time, then the pixels are written.
+	for (int x = x1; x <= x2; ) {
+		int n = gfb_mini(x2 - x + 1, 256);
+		int i;
+
+		if (pgradient->type == GFB_GRADIENT_LINEAR) {
+			for (i = 0; i < n; i++, t += dt) {
+				index[i] = (uint8_t)(t < 0 ? 0 : (t >> 16) > 255 ? 255 : t >> 16);
+			}
+		} else {
+			float dy = ((float)y + 0.5f - pgradient->y0) * ppaint->rscale;
+			float dx = ((float)x + 0.5f - pgradient->x0) * ppaint->rscale;
+			dy *= dy;
+			for (i = 0; i < n; i++, dx += ppaint->rscale) {
+				float d = sqrtf(dx * dx + dy) + 0.5f;
+				index[i] = d >= 255.0f ? 255 : (uint8_t)d;
+			}
+		}
+
+		if (ppaint->dither) {
+			const uint8_t *pthreshold = gfb_bayer4[y & 3];
+			for (i = 0; i < n; i++, p += bpp) {
+				uint32_t argb = pgradient->lut[index[i]];
+				gfb_color_t color = gfb_paint_dither(ppaint, pformat, argb, pthreshold[(x + i) & 3]);
+				gfb_blendpoke(p, color, gfb_scalecoverage(argb >> 24, alpha), pformat, bpp);
+			}
+		} else if (ppaint->opaque && alpha == 255) {
+			for (i = 0; i < n; i++, p += bpp) gfb_pokepixel(p, ppaint->colors[index[i]], bpp);
+		} else {
+			for (i = 0; i < n; i++, p += bpp) {
+				gfb_blendpoke(p, ppaint->colors[index[i]], gfb_scalecoverage(pgradient->lut[index[i]] >> 24, alpha), pformat, bpp);
+			}
+		}
+		x += n;
+	}
+}
+
+/**
+Fill one horizontal span of pixels, clipped to the surface cliprect.
+@param psurface Pointer to the surface to draw on.
+@param x1 Left pixel position of the span.
+@param x2 Right pixel position of the span (inclusive).
+@param y Top pixel position of the span.
+@param color Encoded pixel value.
+*/
+static inline void gfb_fillspan(gfb_surface_t *psurface, int x1, int x2, int y, gfb_color_t color) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+
+	if (y < pclip->y || y >= pclip->y + pclip->h) return;
+	if (x1 < pclip->x) x1 = pclip->x;
+	if (x2 > pclip->x + pclip->w - 1) x2 = pclip->x + pclip->w - 1;
+	if (x1 > x2) return;
+
+	uint8_t *p = &psurface->pbuffer[ psurface->prowoffsets[y] + psurface->pcoloffsets[x1] ];
+	uint8_t alpha = gfb_drawalpha(psurface);
+
+	if (alpha == 255) {
+		gfb_fillrow(p, x2 - x1 + 1, color, psurface->pformat->bytesperpixel);
+	} else {
+		gfb_blendrow(p, x2 - x1 + 1, color, alpha, psurface->pformat);
+	}
+}
+
+/**
+Fill one horizontal span of pixels from a gradient, or with a color when there is none.
+@param psurface Pointer to the surface to draw on.
+@param ppaint Pointer to the gradient prepared for the surface, NULL to fill with color.
+@param x1 Left pixel position of the span.
+@param x2 Right pixel position of the span (inclusive).
+@param y Top pixel position of the span.
+@param color Encoded pixel value, used without a gradient.
+*/
+static inline void gfb_fillspan_paint(gfb_surface_t *psurface, const gfb_paint_t *ppaint, int x1, int x2, int y, gfb_color_t color) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+
+	if (ppaint == NULL) {
+		gfb_fillspan(psurface, x1, x2, y, color);
+		return;
+	}
+	if (y < pclip->y || y >= pclip->y + pclip->h) return;
+	if (x1 < pclip->x) x1 = pclip->x;
+	if (x2 > pclip->x + pclip->w - 1) x2 = pclip->x + pclip->w - 1;
+	if (x1 > x2) return;
+	gfb_paint_span(psurface, ppaint, x1, x2, y, 255);
+}
+
+/**
+Fill a box of pixels, clipped to the surface cliprect.
+@param psurface Pointer to the surface to draw on.
+@param x1 Left pixel position.
+@param y1 Top pixel position.
+@param x2 Right pixel position (inclusive).
+@param y2 Bottom pixel position (inclusive).
+@param color Encoded pixel value.
+@param alpha Opacity of color, 255 writes color as is.
+*/
+static inline void gfb_fillbox(gfb_surface_t *psurface, int x1, int y1, int x2, int y2, gfb_color_t color, uint8_t alpha) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	unsigned int bpp = psurface->pformat->bytesperpixel;
+
+	if (x1 < pclip->x) x1 = pclip->x;
+	if (y1 < pclip->y) y1 = pclip->y;
+	if (x2 > pclip->x + pclip->w - 1) x2 = pclip->x + pclip->w - 1;
+	if (y2 > pclip->y + pclip->h - 1) y2 = pclip->y + pclip->h - 1;
+	if (x1 > x2 || y1 > y2) return;
+
+	uint8_t *p = &psurface->pbuffer[ psurface->prowoffsets[y1] + psurface->pcoloffsets[x1] ];
+	size_t nbytes = (size_t)(x2 - x1 + 1) * bpp;
+	gfb_pattern_t pattern;
+	int y;
+
+	if (alpha != 255) {
+		for (y = y1; y <= y2; y++, p += psurface->pitch) gfb_blendrow(p, x2 - x1 + 1, color, alpha, psurface->pformat);
+		return;
+	}
+
+	//Boxes larger than the cache would only evict useful lines, write around it.
+	int stream = nbytes * (size_t)(y2 - y1 + 1) >= GFB_STREAM_BYTES;
+
+	gfb_pattern_init(&pattern, color, bpp);
+	for (y = y1; y <= y2; y++, p += psurface->pitch) {
+		gfb_fillbytes(p, nbytes, &pattern, stream);
+	}
+
+#if defined(__SSE2__)
+	if (stream) _mm_sfence();
+#endif
+}
+
+/**
+Fill one vertical run of pixels, clipped to the surface cliprect.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of the run.
+@param y1 Top pixel position of the run.
+@param y2 Bottom pixel position of the run (inclusive).
+@param color Encoded pixel value.
+*/
+static inline void gfb_fillcolumn(gfb_surface_t *psurface, int x, int y1, int y2, gfb_color_t color) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	unsigned int bpp = psurface->pformat->bytesperpixel;
+
+	if (x < pclip->x || x >= pclip->x + pclip->w) return;
+	if (y1 < pclip->y) y1 = pclip->y;
+	if (y2 > pclip->y + pclip->h - 1) y2 = pclip->y + pclip->h - 1;
+	if (y1 > y2) return;
+
+	uint8_t *p = &psurface->pbuffer[ psurface->prowoffsets[y1] + psurface->pcoloffsets[x] ];
+	uint8_t alpha = gfb_drawalpha(psurface);
+	for (; y1 <= y2; y1++, p += psurface->pitch) gfb_blendpoke(p, color, alpha, psurface->pformat, bpp);
+}
+
+/**
+Fill one horizontal span given in 64 bits, such as the center of a shape plus a large radius.
+The span is cut to the surface cliprect before it is narrowed to int for gfb_fillspan().
+*/
+static inline void gfb_fillspan64(gfb_surface_t *psurface, int64_t x1, int64_t x2, int64_t y, gfb_color_t color) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+
+	if (y < pclip->y || y >= (int64_t)pclip->y + pclip->h) return;
+	if (x1 < pclip->x) x1 = pclip->x;
+	if (x2 > (int64_t)pclip->x + pclip->w - 1) x2 = (int64_t)pclip->x + pclip->w - 1;
+	if (x1 > x2) return;
+	gfb_fillspan(psurface, (int)x1, (int)x2, (int)y, color);
+}
+
+/**
+Half width of an ellipse row, the largest x where (2x)^2 * b^2 <= a^2 * (b^2 - (2dy)^2).
+Taken in double so any int radius fits, the products are exact while a * b stays below 2^26.
+@param a Width of the ellipse, 2 * rx + 1.
+@param b Height of the ellipse, 2 * ry + 1.
+@param dy Row from the center, 0 to ry.
+@return Half width of the row.
+*/
+static inline int gfb_ellipsehalfwidth(double a, double b, int dy) {
+	double limit = a * a * ((b - 2.0 * dy) * (b + 2.0 * dy));
+	int x = (int)(sqrt(limit) / (2.0 * b));
+
+	//The root is only an estimate, settle on the exact edge.
+	while (x > 0 && (2.0 * x * b) * (2.0 * x * b) > limit) x--;
+	while ((2.0 * (x + 1.0) * b) * (2.0 * (x + 1.0) * b) <= limit) x++;
+	return x;
+}
+
+/**
+Rasterize an ellipse as scanline spans, emitting each row exactly once.
+
+Row dy (0 to ry) reaches out to the half width hw(dy), the largest x where
+(x / (rx + 1/2))^2 + (dy / (ry + 1/2))^2 <= 1. The outline of the row is the pixels
+in (hw(dy + 1), hw(dy)] on each side so it stays connected, the rest is interior.
+Only the rows crossing the surface cliprect are computed.
+
+@param psurface Pointer to the surface to draw on.
+@param cx Left pixel position of the center.
+@param cy Top pixel position of the center.
+@param rx Horizontal radius.
+@param ry Vertical radius.
+@param colorf Encoded pixel value of the outline color.
+@param colorb Encoded pixel value of the fill color.
+@param fill Non-zero to fill the interior with colorb, zero to only draw the outline.
+*/
+static void gfb_ellipsespans(gfb_surface_t *psurface, int cx, int cy, int rx, int ry, gfb_color_t colorf, gfb_color_t colorb, int fill) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	//Scaled by 2 to stay on pixel centers: (2x)^2 * b^2 + (2y)^2 * a^2 <= a^2 * b^2.
+	double a = 2.0 * rx + 1.0;
+	double b = 2.0 * ry + 1.0;
+	int64_t top = (int64_t)cy - pclip->y;
+	int64_t bottom = (int64_t)pclip->y + pclip->h - 1 - cy;
+
+	if (rx < 0 || ry < 0) return;
+
+	//Rows dy with cy - dy or cy + dy inside the cliprect.
+	int64_t first = top < 0 ? -top : (bottom < 0 ? -bottom : 0);
+	int64_t last = top > bottom ? top : bottom;
+	if (last > ry) last = ry;
+	if (first > last) return;
+
+	int64_t hw = gfb_ellipsehalfwidth(a, b, (int)first);	//Half width of the current row.
+	int64_t dy = first;
+
+	for (;; dy++) {
+		//Half width of the next row out, -1 past the last row.
+		int64_t next = dy < ry ? gfb_ellipsehalfwidth(a, b, (int)dy + 1) : -1;
+
+		//Pixels with |x| < inner are interior.
+		int64_t inner = next + 1 < hw ? next + 1 : hw;
+		int64_t y1 = cy - dy;
+		int64_t y2 = cy + dy;
+
+		if (fill && colorf == colorb) {
+			//Outline and fill are the same color, one span per row.
+			gfb_fillspan64(psurface, cx - hw, cx + hw, y1, colorb);
+			if (dy != 0) gfb_fillspan64(psurface, cx - hw, cx + hw, y2, colorb);
+		} else if (inner == 0) {
+			//Whole row is outline.
+			gfb_fillspan64(psurface, cx - hw, cx + hw, y1, colorf);
+			if (dy != 0) gfb_fillspan64(psurface, cx - hw, cx + hw, y2, colorf);
+		} else {
+			gfb_fillspan64(psurface, cx - hw, cx - inner, y1, colorf);
+			if (fill) gfb_fillspan64(psurface, cx - inner + 1, cx + inner - 1, y1, colorb);
+			gfb_fillspan64(psurface, cx + inner, cx + hw, y1, colorf);
+			if (dy != 0) {
+				gfb_fillspan64(psurface, cx - hw, cx - inner, y2, colorf);
+				if (fill) gfb_fillspan64(psurface, cx - inner + 1, cx + inner - 1, y2, colorb);
+				gfb_fillspan64(psurface, cx + inner, cx + hw, y2, colorf);
+			}
+		}
+
+		if (dy == last) break;
+		hw = next;
+	}
+}
+
+/**
+Blend an encoded pixel value into a surface by an 8-bit coverage, clipped to the surface cliprect.
+The coverage is scaled by the draw alpha of the surface.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position, 64 bits so a center plus a large radius stays in range.
+@param y Top pixel position.
+@param color Encoded pixel value.
+@param coverage Coverage of the pixel, 0-255.
+*/
+static inline void gfb_blendpixel(gfb_surface_t *psurface, int64_t x, int64_t y, gfb_color_t color, uint8_t coverage) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+
+	if (x < pclip->x || x >= (int64_t)pclip->x + pclip->w || y < pclip->y || y >= (int64_t)pclip->y + pclip->h) return;
+
+	coverage = gfb_scalecoverage(coverage, gfb_drawalpha(psurface));
+	gfb_blendpoke(&psurface->pbuffer[ psurface->prowoffsets[y] + psurface->pcoloffsets[x] ], color, coverage, psurface->pformat, psurface->pformat->bytesperpixel);
+}
+
+/**
+Integer square root, floor(sqrt(n)), by Newton's method from above.
+@param n Value to take the root of.
+@param hint Start value not below the root, such as the root of a larger neighbour, or 0 if unknown.
+@return Largest integer whose square is not above n.
+*/
+static inline uint32_t gfb_isqrt(uint64_t n, uint64_t hint) {
+	uint64_t x, y;
+
+	if (n < 2) return (uint32_t)n;
+
+	//2^ceil(bits / 2) is always above the root.
+	x = (hint != 0) ? hint : (uint64_t)1 << ((64 - __builtin_clzll(n) + 1) / 2);
+	y = (x + n / x) >> 1;
+	while (y < x) {
+		x = y;
+		y = (x + n / x) >> 1;
+	}
+	return (uint32_t)x;
+}
+
+/** Blend the four pixels mirrored around (cx, cy) by (dx, dy), drawing shared pixels on the axes once. */
+static inline void gfb_blendpixel4(gfb_surface_t *psurface, int cx, int cy, int dx, int dy, gfb_color_t color, uint8_t coverage) {
+	gfb_blendpixel(psurface, (int64_t)cx + dx, (int64_t)cy + dy, color, coverage);
+	if (dx != 0) gfb_blendpixel(psurface, (int64_t)cx - dx, (int64_t)cy + dy, color, coverage);
+	if (dy != 0) {
+		gfb_blendpixel(psurface, (int64_t)cx + dx, (int64_t)cy - dy, color, coverage);
+		if (dx != 0) gfb_blendpixel(psurface, (int64_t)cx - dx, (int64_t)cy - dy, color, coverage);
+	}
+}
+
 /* blit using per-pixel alpha, ignoring any colour key */
 static inline void gfb_alphablit(gfb_surface_t *pdest, gfb_rect_t *pdestrect, gfb_surface_t *psource, gfb_rect_t *psourcerect) {
 	int ncols = gfb_mini(pdestrect->w, psourcerect->w);
@@ -324,53 +1244,505 @@ static inline void dumprect(gfb_rect_t *prect) {
 	fprintf(stderr, "xy(%d, %d) : wh(%d, %d)\n", prect->x, prect->y, prect->w, prect->h);
 }
 
-/*
-blit using per-pixel alpha, ignoring any colour key
+/** Marks the end of a glyph cache list. */
+#define GFB_GLYPH_NONE UINT32_MAX
+
+/** Glyph held by the glyph cache, its coverage is packed into the atlas as rows of w bytes. */
+typedef struct gfb_glyphslot {
+	uint32_t code;			/**< Unicode code point. */
+	gfb_font_id fontid;		/**< Font the glyph was rendered from. */
+	uint8_t ptsize;			/**< Point size the glyph was rendered at. */
+	int16_t left;			/**< Pixels from the pen position to the left edge of the bitmap. */
+	int16_t top;			/**< Pixels from the baseline up to the top edge of the bitmap. */
+	uint16_t w;				/**< Width of the bitmap in pixels. */
+	uint16_t h;				/**< Height of the bitmap in pixels. */
+	int32_t advance;		/**< Pen advance in 1/64th of pixels. */
+	uint32_t index;			/**< Glyph index in the font, for kerning. */
+	int rendered;			/**< Non-zero if the coverage is in the atlas, zero if only the metrics were loaded. */
+	size_t offset;			/**< Position of the coverage in the atlas. */
+	uint32_t hnext;			/**< Next slot in the same hash bucket. */
+	uint32_t prev;			/**< More recently used slot. */
+	uint32_t next;			/**< Less recently used slot, also links the free list. */
+} gfb_glyphslot_t;
+
+/** Rendered glyphs of every font and size, bounded by a memory budget. */
+typedef struct gfb_glyphcache {
+	size_t budget;				/**< Bytes for the atlas, slots and hash buckets together. */
+	uint8_t *patlas;			/**< Coverage of every cached glyph, packed back to back. */
+	size_t atlassize;			/**< Number of bytes in patlas[]. */
+	size_t used;				/**< Bytes of patlas[] handed out, including holes left by evictions. */
+	size_t live;				/**< Bytes of patlas[] held by cached glyphs. */
+	gfb_glyphslot_t *pslots;	/**< Glyph slots. */
+	uint32_t nslots;			/**< Number of items in pslots[]. */
+	uint32_t count;				/**< Number of cached glyphs. */
+	uint32_t freelist;			/**< First unused slot. */
+	uint32_t *pbuckets;			/**< First slot of each hash bucket. */
+	uint32_t nbuckets;			/**< Number of hash buckets, a power of two. */
+	uint32_t head;				/**< Most recently used slot. */
+	uint32_t tail;				/**< Least recently used slot, evicted first. */
+	uint64_t hits;				/**< Lookups served from the cache. */
+	uint64_t misses;			/**< Lookups that had to render the glyph. */
+	uint64_t evictions;			/**< Glyphs dropped to make room. */
+	uint8_t *pscratch;			/**< Coverage of the last 1-bit glyph too big to cache. */
+	size_t scratchsize;			/**< Number of bytes in pscratch[]. */
+} gfb_glyphcache_t;
+
+/** The glyph cache, allocated on first use. */
+static gfb_glyphcache_t gfb_glyphcache = { .budget = GFB_GLYPHCACHE_BYTES, .freelist = GFB_GLYPH_NONE, .head = GFB_GLYPH_NONE, .tail = GFB_GLYPH_NONE };
+
+#if GFB_THREADSAFE
+/** Serializes the glyph cache and the FreeType faces between threads. */
+static pthread_mutex_t gfb_glyphmutex = PTHREAD_MUTEX_INITIALIZER;
+#define gfb_glyphcache_lock()	pthread_mutex_lock(&gfb_glyphmutex)
+#define gfb_glyphcache_unlock()	pthread_mutex_unlock(&gfb_glyphmutex)
+#else
+#define gfb_glyphcache_lock()
+#define gfb_glyphcache_unlock()
+#endif
+
+/** Coverage bitmap and metrics of a glyph ready to draw, see gfb_glyph_get(). */
+typedef struct gfb_glyphinfo {
+	const uint8_t *pcoverage;	/**< Coverage, 0 is background and 255 is foreground. */
+	int pitch;					/**< Bytes per row of pcoverage[]. */
+	int left;					/**< Pixels from the pen position to the left edge of the bitmap. */
+	int top;					/**< Pixels from the baseline up to the top edge of the bitmap. */
+	int w;						/**< Width of the bitmap in pixels. */
+	int h;						/**< Height of the bitmap in pixels. */
+	int32_t advance;			/**< Pen advance in 1/64th of pixels. */
+	uint32_t index;				/**< Glyph index in the font, for kerning. */
+} gfb_glyphinfo_t;
+
+#if GFB_WITH_FREETYPE
+/**
+Set the size glyphs of a font face are rendered at, skipped if it already is.
+Every point size keeps its own FT_Size so switching between sizes does not scale the face again.
 */
-static inline void gfb_ftbitmapblit( gfb_surface_t *pdest, gfb_rect_t *pdestrect, FT_Bitmap *psource, gfb_rect_t *psourcerect, gfb_color_t colorf, gfb_color_t colorb) {
-	int ncols = gfb_mini(pdestrect->w, psourcerect->w);
-	int nlines = gfb_mini(pdestrect->h, psourcerect->h);
+static int gfb_font_setsize(gfb_font_id fontid, uint8_t ptsize) {
+	gfb_fontentry_t *pentry = gfb_font_entry(fontid);
+	if (pentry == NULL || pentry->face == NULL) return GFB_EARGUMENT;
+	if (pentry->active == ptsize) return GFB_OK;
+
+	FT_Size *psize = &pentry->sizes[ptsize];
+	if (*psize == NULL) {
+		if (FT_New_Size(pentry->face, psize) != 0) {
+			*psize = NULL;
+			return GFB_ERROR;
+		}
 
-	uint8_t *psourcerow = &psource->buffer[((psourcerect->y) * psource->pitch) + psourcerect->x];
-	uint8_t *pdestrow = &pdest->ppixels[(pdestrect->y) * pdest->pitch + (pdestrect->x * pdest->pformat->bytesperpixel)];
+		/* FIXME using 75dpi */
+		if (FT_Activate_Size(*psize) != 0 || FT_Set_Char_Size( pentry->face, ptsize * 64, 0, 100, 0 ) != 0) {
+			FT_Done_Size(*psize);
+			*psize = NULL;
+			pentry->active = 0;
+			FT_Activate_Size(pentry->sizes[0]);
+			return GFB_ERROR;
+		}
+	} else if (FT_Activate_Size(*psize) != 0) {
+		return GFB_ERROR;
+	}
+	pentry->active = ptsize;
 
-	uint8_t sr = (uint8_t)((colorf & pdest->pformat->rmask) >> pdest->pformat->rshift);
-	uint8_t sg = (uint8_t)((colorf & pdest->pformat->gmask) >> pdest->pformat->gshift);
-	uint8_t sb = (uint8_t)((colorf & pdest->pformat->bmask) >> pdest->pformat->bshift);
+	return GFB_OK;
+}
+#endif
 
-	for (; nlines >= 0; nlines--) {
-		int i;
+/** Free the glyph cache memory, the next lookup allocates it again. */
+static void gfb_glyphcache_release(void) {
+	free(gfb_glyphcache.patlas);
+	free(gfb_glyphcache.pslots);
+	free(gfb_glyphcache.pbuckets);
+	free(gfb_glyphcache.pscratch);
+	gfb_glyphcache.patlas = NULL;
+	gfb_glyphcache.pslots = NULL;
+	gfb_glyphcache.pbuckets = NULL;
+	gfb_glyphcache.pscratch = NULL;
+	gfb_glyphcache.scratchsize = 0;
+	gfb_glyphcache.atlassize = gfb_glyphcache.used = gfb_glyphcache.live = 0;
+	gfb_glyphcache.nslots = gfb_glyphcache.count = gfb_glyphcache.nbuckets = 0;
+	gfb_glyphcache.freelist = gfb_glyphcache.head = gfb_glyphcache.tail = GFB_GLYPH_NONE;
+}
 
-		uint8_t *srcpix = psourcerow;
-		uint8_t *dstpix = pdestrow;
+/**
+Allocate the glyph cache within its budget.
+One slot is planned per 128 bytes of coverage, about a 10x12 glyph, and a hash bucket per slot.
+*/
+static int gfb_glyphcache_alloc(void) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	size_t perslot = 128 + sizeof(gfb_glyphslot_t) + sizeof(uint32_t);
+	uint32_t nslots = (uint32_t)gfb_mini((int)(pcache->budget / perslot), 1 << 20);
+	uint32_t nbuckets = 1;
+	uint32_t i;
+
+	if (nslots < 16) return GFB_ENOMEM;
+	while (nbuckets < nslots) nbuckets <<= 1;
+
+	pcache->pslots = calloc(nslots, sizeof(gfb_glyphslot_t));
+	pcache->pbuckets = malloc(nbuckets * sizeof(uint32_t));
+	pcache->atlassize = pcache->budget - nslots * sizeof(gfb_glyphslot_t) - nbuckets * sizeof(uint32_t);
+	pcache->patlas = malloc(pcache->atlassize);
+	if (pcache->pslots == NULL || pcache->pbuckets == NULL || pcache->patlas == NULL) {
+		gfb_glyphcache_release();
+		return GFB_ENOMEM;
+	}
 
-		for (i = 0; i < ncols; i++) {
-			uint8_t sa = *srcpix;
+	pcache->nslots = nslots;
+	pcache->nbuckets = nbuckets;
+	pcache->count = 0;
+	pcache->used = pcache->live = 0;
+	pcache->head = pcache->tail = GFB_GLYPH_NONE;
+	for (i = 0; i < nbuckets; i++) pcache->pbuckets[i] = GFB_GLYPH_NONE;
+	for (i = 0; i < nslots; i++) pcache->pslots[i].next = i + 1 < nslots ? i + 1 : GFB_GLYPH_NONE;
+	pcache->freelist = 0;
 
-			//Fetch and decode destination pixel.
-			uint8_t da = (uint8_t)((colorb & pdest->pformat->amask) >> pdest->pformat->ashift);
-			uint8_t dr = (uint8_t)((colorb & pdest->pformat->rmask) >> pdest->pformat->rshift);
-			uint8_t dg = (uint8_t)((colorb & pdest->pformat->gmask) >> pdest->pformat->gshift);
-			uint8_t db = (uint8_t)((colorb & pdest->pformat->bmask) >> pdest->pformat->bshift);
+	return GFB_OK;
+}
 
-			float a = (float)sa / 255.0f;
+/** Hash bucket of a glyph. */
+static inline uint32_t gfb_glyph_bucket(gfb_font_id fontid, uint8_t ptsize, uint32_t code) {
+	uint32_t h = (code * 0x9e3779b1u) ^ ((uint32_t)fontid << 24) ^ ((uint32_t)ptsize << 16);
+	h ^= h >> 15;
+	return (h * 0x85ebca6bu) & (gfb_glyphcache.nbuckets - 1);
+}
 
-			//Encode and write to destination.
-			gfb_color_t destcolor = gfb_maprgba(
-				pdest,
-				(uint8_t)(a * sr + (1 - a) * dr),
-				(uint8_t)(a * sg + (1 - a) * dg),
-				(uint8_t)(a * sb + (1 - a) * db),
-				da
-			);
-			memcpy(dstpix, &destcolor, pdest->pformat->bytesperpixel);
+/** Take a slot out of the LRU list. */
+static inline void gfb_glyph_unlink(uint32_t i) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	gfb_glyphslot_t *pslot = &pcache->pslots[i];
 
-			//Advance pixel positions.
-			srcpix += 1;
-			dstpix += pdest->pformat->bytesperpixel;
+	if (pslot->prev != GFB_GLYPH_NONE) pcache->pslots[pslot->prev].next = pslot->next; else pcache->head = pslot->next;
+	if (pslot->next != GFB_GLYPH_NONE) pcache->pslots[pslot->next].prev = pslot->prev; else pcache->tail = pslot->prev;
+}
+
+/** Put a slot first in the LRU list. */
+static inline void gfb_glyph_pushfront(uint32_t i) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	gfb_glyphslot_t *pslot = &pcache->pslots[i];
+
+	pslot->prev = GFB_GLYPH_NONE;
+	pslot->next = pcache->head;
+	if (pcache->head != GFB_GLYPH_NONE) pcache->pslots[pcache->head].prev = i; else pcache->tail = i;
+	pcache->head = i;
+}
+
+/** Number of atlas bytes held by a glyph. */
+static inline size_t gfb_glyph_size(const gfb_glyphslot_t *pslot) {
+	return pslot->rendered ? (size_t)pslot->w * pslot->h : 0;
+}
+
+/** Drop a glyph from the cache. */
+static void gfb_glyph_evict(uint32_t i) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	gfb_glyphslot_t *pslot = &pcache->pslots[i];
+	uint32_t *plink = &pcache->pbuckets[gfb_glyph_bucket(pslot->fontid, pslot->ptsize, pslot->code)];
+
+	while (*plink != i) plink = &pcache->pslots[*plink].hnext;
+	*plink = pslot->hnext;
+
+	gfb_glyph_unlink(i);
+	pcache->live -= gfb_glyph_size(pslot);
+	pcache->count--;
+	pslot->next = pcache->freelist;
+	pcache->freelist = i;
+}
+
+/** Order slot indices by atlas offset, for qsort(). */
+static int gfb_glyph_cmpoffset(const void *pa, const void *pb) {
+	const gfb_glyphslot_t *a = &gfb_glyphcache.pslots[*(const uint32_t *)pa];
+	const gfb_glyphslot_t *b = &gfb_glyphcache.pslots[*(const uint32_t *)pb];
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+/** Close the holes evicted glyphs left in the atlas by sliding the rest down. */
+static int gfb_glyphcache_compact(void) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	uint32_t *porder = malloc((pcache->count + 1) * sizeof(uint32_t));
+	uint32_t n = 0;
+	size_t offset = 0;
+
+	if (porder == NULL) return GFB_ENOMEM;
+
+	for (uint32_t i = pcache->head; i != GFB_GLYPH_NONE; i = pcache->pslots[i].next) porder[n++] = i;
+	qsort(porder, n, sizeof(uint32_t), gfb_glyph_cmpoffset);
+
+	for (uint32_t i = 0; i < n; i++) {
+		gfb_glyphslot_t *pslot = &pcache->pslots[porder[i]];
+		size_t size = gfb_glyph_size(pslot);
+		if (pslot->offset != offset) memmove(&pcache->patlas[offset], &pcache->patlas[pslot->offset], size);
+		pslot->offset = offset;
+		offset += size;
+	}
+	pcache->used = offset;
+	free(porder);
+
+	return GFB_OK;
+}
+
+/**
+Find room for a glyph of size bytes, evicting the least recently used glyphs if needed.
+Evictions free a quarter of the atlas at a time so the compaction that follows is rare.
+@return On success, returns the atlas offset.
+@return On failure, returns SIZE_MAX.
+*/
+static size_t gfb_glyphcache_reserve(size_t size) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+
+	if (pcache->freelist != GFB_GLYPH_NONE && pcache->used + size <= pcache->atlassize) {
+		size_t offset = pcache->used;
+		pcache->used += size;
+		return offset;
+	}
+
+	size_t target = pcache->atlassize - pcache->atlassize / 4;
+	uint32_t slots = pcache->nslots - pcache->nslots / 4;
+	while (pcache->tail != GFB_GLYPH_NONE && (pcache->live + size > target || pcache->count >= slots)) {
+		gfb_glyph_evict(pcache->tail);
+		pcache->evictions++;
+	}
+	if (gfb_glyphcache_compact() != GFB_OK) return SIZE_MAX;
+
+	size_t offset = pcache->used;
+	pcache->used += size;
+	return offset;
+}
+
+/** Add a glyph to the cache, the atlas space of a rendered glyph is already reserved at offset. */
+static int gfb_glyph_insert(gfb_font_id fontid, uint8_t ptsize, uint32_t code, const gfb_glyphinfo_t *pinfo, int rendered, size_t offset) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+
+	//Metrics take no atlas space but still need a slot.
+	if (pcache->freelist == GFB_GLYPH_NONE && gfb_glyphcache_reserve(0) == SIZE_MAX) return GFB_ENOMEM;
+
+	uint32_t i = pcache->freelist;
+	gfb_glyphslot_t *pslot = &pcache->pslots[i];
+	pcache->freelist = pslot->next;
+	pslot->code = code;
+	pslot->fontid = fontid;
+	pslot->ptsize = ptsize;
+	pslot->left = (int16_t)pinfo->left;
+	pslot->top = (int16_t)pinfo->top;
+	pslot->w = (uint16_t)pinfo->w;
+	pslot->h = (uint16_t)pinfo->h;
+	pslot->advance = pinfo->advance;
+	pslot->index = pinfo->index;
+	pslot->rendered = rendered;
+	pslot->offset = offset;
+	uint32_t bucket = gfb_glyph_bucket(fontid, ptsize, code);
+	pslot->hnext = pcache->pbuckets[bucket];
+	pcache->pbuckets[bucket] = i;
+	gfb_glyph_pushfront(i);
+	pcache->live += gfb_glyph_size(pslot);
+	pcache->count++;
+
+	return GFB_OK;
+}
+
+/**
+Pack the rows of a glyph bitmap as rows of w bytes, expanding 1-bit bitmaps to full coverage.
+@param pdst Pointer to w * h bytes of coverage.
+@param psrc Pointer to the first row of the bitmap.
+@param pitch Bytes per row of psrc[].
+@param w Width of the bitmap in pixels.
+@param h Height of the bitmap in pixels.
+@param mono Non-zero if psrc[] holds 1 bit per pixel, most significant bit first.
+*/
+static void gfb_glyph_pack(uint8_t *pdst, const uint8_t *psrc, int pitch, int w, int h, int mono) {
+	for (int y = 0; y < h; y++, pdst += w, psrc += pitch) {
+		if (mono) {
+			for (int x = 0; x < w; x++) pdst[x] = (psrc[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+		} else {
+			memcpy(pdst, psrc, w);
+		}
+	}
+}
+
+/**
+Look up the coverage and metrics of a glyph, rendering it with FreeType on a miss.
+Glyphs larger than a quarter of the atlas are not cached, their coverage stays valid until the next
+glyph is rendered. Without render only the metrics are loaded and cached, the
+bitmap box is then derived from the outline metrics and pcoverage is NULL.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+static int gfb_glyph_get(gfb_font_id fontid, uint8_t ptsize, uint32_t code, int render, gfb_glyphinfo_t *pinfo) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	uint32_t i;
+	int rc;
+
+	if (pcache->pslots == NULL && (rc = gfb_glyphcache_alloc()) != GFB_OK) return rc;
+
+	for (i = pcache->pbuckets[gfb_glyph_bucket(fontid, ptsize, code)]; i != GFB_GLYPH_NONE; i = pcache->pslots[i].hnext) {
+		gfb_glyphslot_t *pslot = &pcache->pslots[i];
+		if (pslot->code == code && pslot->fontid == fontid && pslot->ptsize == ptsize) break;
+	}
+
+	if (i != GFB_GLYPH_NONE && render && !pcache->pslots[i].rendered) {
+		//Measured before, load it again with the bitmap.
+		gfb_glyph_evict(i);
+		i = GFB_GLYPH_NONE;
+	}
+
+	if (i != GFB_GLYPH_NONE) {
+		gfb_glyphslot_t *pslot = &pcache->pslots[i];
+		if (pcache->head != i) {
+			gfb_glyph_unlink(i);
+			gfb_glyph_pushfront(i);
+		}
+		pcache->hits++;
+		pinfo->pcoverage = pslot->rendered ? &pcache->patlas[pslot->offset] : NULL;
+		pinfo->pitch = pslot->w;
+		pinfo->left = pslot->left;
+		pinfo->top = pslot->top;
+		pinfo->w = pslot->w;
+		pinfo->h = pslot->h;
+		pinfo->advance = pslot->advance;
+		pinfo->index = pslot->index;
+		return GFB_OK;
+	}
+
+	pcache->misses++;
+
+	const gfb_bmf_t *pbmf = gfb_font_entry(fontid)->pbmf;
+	const uint8_t *pbuffer;
+	int pitch, mono;
+
+	if (pbmf != NULL) {
+		//Bitmap fonts have one size, every point size asked for gets the same glyph.
+		gfb_bmf_glyph_t cell;
+		const gfb_bmf_glyph_t *pglyph = gfb_bmf_glyph(pbmf, code, &cell);
+
+		pbuffer = &pbmf->pbits[pglyph->offset];
+		pitch = gfb_bmf_pitch(pglyph->width);
+		mono = 1;
+		pinfo->index = 0;
+		pinfo->left = pglyph->xbearing;
+		pinfo->top = pglyph->ybearing;
+		pinfo->w = pglyph->width;
+		pinfo->h = pglyph->height;
+		pinfo->advance = (int32_t)pglyph->xadvance * 64;
+		if (!render) {
+			pinfo->pcoverage = NULL;
+			pinfo->pitch = 0;
+			return gfb_glyph_insert(fontid, ptsize, code, pinfo, 0, 0);
+		}
+	} else {
+#if GFB_WITH_FREETYPE
+		if ((rc = gfb_font_setsize(fontid, ptsize)) != GFB_OK) return rc;
+
+		FT_Face face = gfb_font_entry(fontid)->face;
+		FT_GlyphSlot ftslot = face->glyph;
+		FT_Set_Transform(face, NULL, NULL);
+		FT_UInt index = FT_Get_Char_Index(face, code);
+		if (FT_Load_Glyph(face, index, render ? FT_LOAD_RENDER : FT_LOAD_DEFAULT)) return GFB_ERROR;
+
+		pinfo->index = index;
+		if (!render) {
+			//Box of the pixels the outline would cover once rendered.
+			FT_Glyph_Metrics *pm = &ftslot->metrics;
+			FT_Pos x1 = pm->horiBearingX & ~63, x2 = (pm->horiBearingX + pm->width + 63) & ~63;
+			FT_Pos y1 = (pm->horiBearingY + 63) & ~63, y2 = (pm->horiBearingY - pm->height) & ~63;
+			pinfo->pcoverage = NULL;
+			pinfo->pitch = 0;
+			pinfo->left = (int)(x1 >> 6);
+			pinfo->top = (int)(y1 >> 6);
+			pinfo->w = (int)((x2 - x1) >> 6);
+			pinfo->h = (int)((y1 - y2) >> 6);
+			pinfo->advance = (int32_t)ftslot->advance.x;
+			if (pinfo->w > UINT16_MAX || pinfo->h > UINT16_MAX) return GFB_OK;
+			return gfb_glyph_insert(fontid, ptsize, code, pinfo, 0, 0);
+		}
+
+		FT_Bitmap *pbitmap = &ftslot->bitmap;
+		mono = pbitmap->pixel_mode == FT_PIXEL_MODE_MONO;
+		pbuffer = pbitmap->buffer;
+		pitch = pbitmap->pitch;
+
+		pinfo->left = ftslot->bitmap_left;
+		pinfo->top = ftslot->bitmap_top;
+		pinfo->w = pbitmap->width;
+		pinfo->h = pbitmap->rows;
+		pinfo->advance = (int32_t)ftslot->advance.x;
+
+		if (pbitmap->pixel_mode != FT_PIXEL_MODE_GRAY && !mono) return GFB_ENOTSUPPORTED;
+#else
+		return GFB_ENOTSUPPORTED;
+#endif
+	}
+
+	size_t size = (size_t)pinfo->w * pinfo->h;
+
+	pinfo->pitch = pitch;
+	pinfo->pcoverage = pbuffer;
+	if (size > pcache->atlassize / 4 || pinfo->w > UINT16_MAX || pinfo->h > UINT16_MAX) {
+		//Too big to cache, 1-bit glyphs are expanded into the scratch buffer instead.
+		if (!mono) return GFB_OK;
+		if (size > pcache->scratchsize) {
+			uint8_t *pscratch = realloc(pcache->pscratch, size);
+			if (pscratch == NULL) return GFB_ENOMEM;
+			pcache->pscratch = pscratch;
+			pcache->scratchsize = size;
+		}
+		gfb_glyph_pack(pcache->pscratch, pbuffer, pitch, pinfo->w, pinfo->h, mono);
+		pinfo->pcoverage = pcache->pscratch;
+		pinfo->pitch = pinfo->w;
+		return GFB_OK;
+	}
+
+	size_t offset = gfb_glyphcache_reserve(size);
+	if (offset == SIZE_MAX) return GFB_ENOMEM;
+
+	gfb_glyph_pack(&pcache->patlas[offset], pbuffer, pitch, pinfo->w, pinfo->h, mono);
+	pinfo->pcoverage = &pcache->patlas[offset];
+	pinfo->pitch = pinfo->w;
+
+	return gfb_glyph_insert(fontid, ptsize, code, pinfo, 1, offset);
+}
+
+/** Kerning between two glyphs of a font in 1/64th of pixels, 0 if the font has none. */
+static inline int32_t gfb_glyph_kerning(gfb_font_id fontid, uint8_t ptsize, uint32_t left, uint32_t right) {
+#if GFB_WITH_FREETYPE
+	FT_Face face = gfb_font_face(fontid);
+	FT_Vector delta;
+
+	if (left == 0 || right == 0 || face == NULL || !FT_HAS_KERNING(face)) return 0;
+	if (gfb_font_setsize(fontid, ptsize) != GFB_OK) return 0;
+	if (FT_Get_Kerning(face, left, right, FT_KERNING_DEFAULT, &delta)) return 0;
+
+	return (int32_t)delta.x;
+#else
+	return 0;	//Bitmap fonts have no kerning.
+#endif
+}
+
+/**
+Draw a glyph coverage bitmap, clipped to the surface cliprect.
+@param pdest Pointer to the surface to draw on.
+@param x Left pixel position of the bitmap.
+@param y Top pixel position of the bitmap.
+@param pinfo Pointer to the glyph.
+@param pramp Encoded pixel value for every coverage, from the background to the text color.
+With GFB_TRANSPARENTTEXT set on the surface the text color is blended over the pixels instead.
+*/
+static inline void gfb_glyphblit(gfb_surface_t *pdest, int x, int y, const gfb_glyphinfo_t *pinfo, const gfb_color_t *pramp) {
+	const gfb_rect_t *pclip = &pdest->cliprect;
+	unsigned int bpp = pdest->pformat->bytesperpixel;
+	int x1 = gfb_maxi(x, pclip->x);
+	int y1 = gfb_maxi(y, pclip->y);
+	int x2 = gfb_mini(x + pinfo->w, pclip->x + pclip->w);
+	int y2 = gfb_mini(y + pinfo->h, pclip->y + pclip->h);
+
+	if (x1 >= x2) return;
+	for (int row = y1; row < y2; row++) {
+		const uint8_t *psrc = &pinfo->pcoverage[(row - y) * pinfo->pitch + (x1 - x)];
+		uint8_t *pdst = &pdest->pbuffer[ pdest->prowoffsets[row] + pdest->pcoloffsets[x1] ];
+
+		if (pdest->flags & GFB_TRANSPARENTTEXT) {
+			//The text color is the end of the ramp.
+			gfb_maskrow(pdst, psrc, x2 - x1, pramp[255], pdest->pformat);
+			continue;
+		}
+		for (int col = x1; col < x2; col++, pdst += bpp) {
+			gfb_pokepixel(pdst, pramp[*psrc++], bpp);
 		}
-		pdestrow += pdest->pitch;
-		psourcerow += psource->pitch;
 	}
 }
 
@@ -433,70 +1805,82 @@ GFB_FLIP(gfb_soft_flip) {
 }
 
 GFB_CLEAR(gfb_soft_clear) {
-	int rc = GFB_OK;
+	unsigned int bpp = psurface->pformat->bytesperpixel;
+	uint8_t bytes[sizeof(gfb_color_t)];
+
+	memcpy(bytes, &color, sizeof(bytes));
 
+	//Whole surface in a color of repeating bytes, like black, is one memset().
 	if (
 		   psurface->cliprect.x == 0
 		&& psurface->cliprect.y == 0
 		&& psurface->cliprect.w == psurface->w
 		&& psurface->cliprect.h == psurface->h
+		&& memcmp(bytes, bytes + 1, bpp - 1) == 0
 	) {
-		memset(psurface->pbuffer , 0x00, (psurface->pitch * psurface->h));
-	} else {
-		rc = gfb_filledrectangle(psurface, NULL, 0x000000);
+		memset(psurface->pbuffer, bytes[0], (psurface->pitch * psurface->h));
+		return GFB_OK;
 	}
-	return rc;
+
+	//A clear replaces the pixels, it is never blended.
+	gfb_fillbox(psurface, psurface->cliprect.x, psurface->cliprect.y, psurface->cliprect.x + psurface->cliprect.w - 1, psurface->cliprect.y + psurface->cliprect.h - 1, color, 255);
+
+	return GFB_OK;
 }
 
 GFB_LINE(gfb_soft_line) {
-	//both points on line must lie within surface cliprect.
+	//Both points on line must lie within surface cliprect, gfb_line() clips the line before calling this.
 	if (
-		   gfb_outside(x1, psurface->cliprect.x, psurface->cliprect.x + psurface->cliprect.w)
-		|| gfb_outside(y1, psurface->cliprect.y, psurface->cliprect.y + psurface->cliprect.h)
-		|| gfb_outside(x2, psurface->cliprect.x, psurface->cliprect.x + psurface->cliprect.w)
-		|| gfb_outside(y2, psurface->cliprect.y, psurface->cliprect.y + psurface->cliprect.h)
+		   gfb_outside(x1, psurface->cliprect.x, psurface->cliprect.x + psurface->cliprect.w - 1)
+		|| gfb_outside(y1, psurface->cliprect.y, psurface->cliprect.y + psurface->cliprect.h - 1)
+		|| gfb_outside(x2, psurface->cliprect.x, psurface->cliprect.x + psurface->cliprect.w - 1)
+		|| gfb_outside(y2, psurface->cliprect.y, psurface->cliprect.y + psurface->cliprect.h - 1)
 	) {
 		return GFB_EARGUMENT; //Line out of bounds.
 	}
 
+	unsigned int bpp = psurface->pformat->bytesperpixel;
 	int dx    = x2 - x1;	/* the horizontal distance of the line */
 	int dy    = y2 - y1;	/* the vertical distance of the line */
 	int dxabs = abs(dx);
 	int dyabs = abs(dy);
-	int sdx   = sgn(dx);
-	int sdy   = sgn(dy);
+	int sdx   = sgn(dx) * (int)bpp;				/* byte step along x */
+	int sdy   = sgn(dy) * (int)psurface->pitch;	/* byte step along y */
 	int x     = dyabs >> 1;
 	int y     = dxabs >> 1;
-	int px    = x1;
-	int py    = y1;
 
-	int i, rc;
+	int i;
+
+	//Opaque unless the surface blends its primitives, gfb_blendpoke() stores 255 as is.
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	uint8_t alpha = gfb_drawalpha(psurface);
 
-	psurface->op->putpixel(psurface, px,py, color);
+	//Walk the pixel buffer directly, every pixel is known to be inside the cliprect.
+	uint8_t *p = &psurface->pbuffer[ psurface->prowoffsets[y1] + psurface->pcoloffsets[x1] ];
+
+	gfb_blendpoke(p, color, alpha, pformat, bpp);
 
 	if (dxabs >= dyabs) {
 		/* the line is more horizontal than vertical */
-		for (i = 0; i < dxabs;i++) {
+		for (i = 0; i < dxabs; i++) {
 			y += dyabs;
 			if (y >= dxabs) {
 				y -= dxabs;
-				py += sdy;
+				p += sdy;
 			}
-			px += sdx;
-			rc = psurface->op->putpixel(psurface, px, py, color);
-			if (rc != GFB_OK) return rc;
+			p += sdx;
+			gfb_blendpoke(p, color, alpha, pformat, bpp);
 		}
 	} else {
 		/* the line is more vertical than horizontal */
-		for (i=0;i<dyabs;i++) {
-			x+=dxabs;
-			if (x>=dyabs) {
-				x-=dyabs;
-				px+=sdx;
+		for (i = 0; i < dyabs; i++) {
+			x += dxabs;
+			if (x >= dyabs) {
+				x -= dyabs;
+				p += sdx;
 			}
-			py+=sdy;
-			rc = psurface->op->putpixel(psurface, px,py, color);
-			if (rc != GFB_OK) return rc;
+			p += sdy;
+			gfb_blendpoke(p, color, alpha, pformat, bpp);
 		}
 	}
 
@@ -504,111 +1888,300 @@ GFB_LINE(gfb_soft_line) {
 }
 
 GFB_RECTANGLE(gfb_soft_rectangle) {
-	int rc;
-	if ((rc = psurface->op->line(psurface, prect->x, prect->y, prect->x + prect->w, prect->y, color)) != GFB_OK) return rc;
-	if ((rc = psurface->op->line(psurface, prect->x + prect->w, prect->y, prect->x + prect->w, prect->y + prect->h, color)) != GFB_OK) return rc;
-	if ((rc = psurface->op->line(psurface, prect->x, prect->y, prect->x, prect->y + prect->h, color)) != GFB_OK) return rc;
-	if ((rc = psurface->op->line(psurface, prect->x, prect->y + prect->h, prect->x + prect->w, prect->y + prect->h, color)) != GFB_OK) return rc;
-	return rc;
+	//Edges as spans, each pixel once so blended outlines have even corners.
+	return gfb_soft_rects(psurface, prect, 1, color);
 }
 
 GFB_CIRCLE(gfb_soft_circle) {
-	int X = radius;
-	int Y = 0;
-	int decisionOver2 = 1 - X;   // Decision criterion divided by 2 evaluated at X=radius, Y=0
-
-	while( Y <= X ) {
-		gfb_putpixel(psurface,  X + x,  Y + y, color); // Octant 1
-		gfb_putpixel(psurface,  Y + x,  X + y, color); // Octant 2
-		gfb_putpixel(psurface, -X + x,  Y + y, color); // Octant 4
-		gfb_putpixel(psurface, -Y + x,  X + y, color); // Octant 3
-		gfb_putpixel(psurface, -X + x, -Y + y, color); // Octant 5
-		gfb_putpixel(psurface, -Y + x, -X + y, color); // Octant 6
-		gfb_putpixel(psurface,  X + x, -Y + y, color); // Octant 7
-		gfb_putpixel(psurface,  Y + x, -X + y, color); // Octant 8
-		Y++;
-		if (decisionOver2<=0) {
-			decisionOver2 += 2 * Y + 1;   // Change in decision criterion for Y -> Y+1
-		} else {
-			X--;
-			decisionOver2 += 2 * (Y - X) + 1;   // Change for Y -> Y+1, X -> X-1
+	gfb_ellipsespans(psurface, x, y, radius, radius, color, color, 0);
+	return GFB_OK;
+}
+
+GFB_FILLEDRECTANGLE(gfb_soft_filledrectangle) {
+	//Corners at (x, y) and (x + w, y + h), clipped so a rectangle touching the far edges stays inside the buffer.
+	gfb_fillbox(psurface, prect->x, prect->y, prect->x + prect->w, prect->y + prect->h, colorb, gfb_drawalpha(psurface));
+	return GFB_OK;
+}
+
+GFB_FILLEDCIRCLE(gfb_soft_filledcircle) {
+	//Outline and interior in one pass, each row written once.
+	gfb_ellipsespans(psurface, x, y, radius, radius, colorf, colorb, 1);
+	return GFB_OK;
+}
+
+GFB_ELLIPSE(gfb_soft_ellipse) {
+	gfb_ellipsespans(psurface, x, y, rx, ry, color, color, 0);
+	return GFB_OK;
+}
+
+GFB_FILLEDELLIPSE(gfb_soft_filledellipse) {
+	gfb_ellipsespans(psurface, x, y, rx, ry, colorf, colorb, 1);
+	return GFB_OK;
+}
+
+/*
+Wu's line with a 16-bit error accumulator, after Abrash. The top 8 bits of the accumulator
+are the coverage of the pixel beside the major axis step, its complement goes to the pixel on it.
+Expanded once per pixel size by gfb_soft_line_aa() so the blend has no format test per pixel.
+*/
+static inline __attribute__((always_inline)) void gfb_wuline(gfb_surface_t *psurface, int x1, int y1, int dx, int dy, int xdir, gfb_color_t color, const unsigned int bpp) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	uint8_t alpha = gfb_drawalpha(psurface);
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	int pitch = (int)psurface->pitch;
+	int step = xdir * (int)bpp;
+	uint16_t acc = 0;
+	uint16_t adj, prev;
+
+	//The clipped line stays inside the cliprect, only the neighbour pixel needs a bounds check.
+	uint8_t *p = &psurface->pbuffer[ psurface->prowoffsets[y1] + psurface->pcoloffsets[x1] ];
+
+	if (dy > dx) {
+		//Y major, step y and carry into x.
+		int xedge = xdir > 0 ? pclip->x + pclip->w - 1 : pclip->x;
+		adj = (uint16_t)(((uint32_t)dx << 16) / (uint32_t)dy);
+		while (--dy) {
+			prev = acc;
+			acc += adj;
+			if (acc <= prev) {
+				x1 += xdir;
+				p += step;
+			}
+			p += pitch;
+			uint8_t w = (uint8_t)(acc >> 8);
+			gfb_blendpoke(p, color, gfb_scalecoverage((uint8_t)~w, alpha), pformat, bpp);
+			if (x1 != xedge) gfb_blendpoke(p + step, color, gfb_scalecoverage(w, alpha), pformat, bpp);
 		}
+	} else {
+		//X major, step x and carry into y.
+		int yedge = pclip->y + pclip->h - 1;
+		adj = (uint16_t)(((uint32_t)dy << 16) / (uint32_t)dx);
+		while (--dx) {
+			prev = acc;
+			acc += adj;
+			if (acc <= prev) {
+				y1++;
+				p += pitch;
+			}
+			p += step;
+			uint8_t w = (uint8_t)(acc >> 8);
+			gfb_blendpoke(p, color, gfb_scalecoverage((uint8_t)~w, alpha), pformat, bpp);
+			if (y1 != yedge) gfb_blendpoke(p + pitch, color, gfb_scalecoverage(w, alpha), pformat, bpp);
+		}
+	}
+}
+
+GFB_LINE_AA(gfb_soft_line_aa) {
+	unsigned int bpp = psurface->pformat->bytesperpixel;
+	int dx, dy, xdir;
+
+	//Always draw top to bottom.
+	if (y1 > y2) {
+		int t;
+		t = x1; x1 = x2; x2 = t;
+		t = y1; y1 = y2; y2 = t;
+	}
+
+	dx = x2 - x1;
+	dy = y2 - y1;
+	xdir = dx < 0 ? -1 : 1;
+	dx = abs(dx);
+
+	//No fractional coverage on these.
+	if (dx == 0 || dy == 0 || dx == dy) return gfb_soft_line(psurface, x1, y1, x2, y2, color);
+
+	//End points are exact.
+	gfb_blendpoke(&psurface->pbuffer[ psurface->prowoffsets[y1] + psurface->pcoloffsets[x1] ], color, gfb_drawalpha(psurface), psurface->pformat, bpp);
+	gfb_blendpoke(&psurface->pbuffer[ psurface->prowoffsets[y2] + psurface->pcoloffsets[x2] ], color, gfb_drawalpha(psurface), psurface->pformat, bpp);
+
+	switch (bpp) {
+		case 4: gfb_wuline(psurface, x1, y1, dx, dy, xdir, color, 4); break;
+		case 3: gfb_wuline(psurface, x1, y1, dx, dy, xdir, color, 3); break;
+		case 2: gfb_wuline(psurface, x1, y1, dx, dy, xdir, color, 2); break;
+		default: gfb_wuline(psurface, x1, y1, dx, dy, xdir, color, bpp); break;
 	}
 
 	return GFB_OK;
 }
 
-GFB_FILLEDRECTANGLE(gfb_soft_filledrectangle) {
-	uint32_t yoff = prect->y * psurface->pitch; //Byte offset where the line starts.
-	uint32_t xoff = prect->x * psurface->pformat->bytesperpixel; //Byte offset relative to yoff.
-	uint32_t idx1 = (yoff + xoff); //Byte offset of the first line.
-	uint32_t idx;
-	int x, y;
-	int pixcount = ((prect->x + prect->w) - prect->x)+1; //Number of pixels per line.
-	uint32_t pixbytes = pixcount * psurface->pformat->bytesperpixel; //Number of bytes per line.
+/** Largest radius of the anti-aliased circles, distances past it do not fit 8.8 fixed point in 64 bits. */
+#define GFB_AACIRCLE_MAXRADIUS	((1 << 23) - 1)
 
-	//Prepare the first line.
-	idx = idx1; //Byte offset of first line
-	for (x = 0; x < pixcount; x++) {
-		memcpy((uint8_t *)&psurface->pbuffer[idx], &colorb, psurface->pformat->bytesperpixel);
-		idx += psurface->pformat->bytesperpixel; //Move to next pixel
+/*
+Walk one octant (x <= y) of the circle. The exact height y = sqrt(r^2 - x^2) is taken in 8.8
+fixed point with an integer square root, its fraction splits the column between two pixels.
+Each pixel is mirrored into all eight octants, skipping the mirrors that land on themselves.
+*/
+GFB_CIRCLE_AA(gfb_soft_circle_aa) {
+	int64_t rr = (int64_t)radius * radius;
+	uint32_t h = 0;
+	int dx;
+
+	if (radius > GFB_AACIRCLE_MAXRADIUS) {
+		//The curve is flat at this size, a hard edge is drawn instead.
+		gfb_ellipsespans(psurface, x, y, radius, radius, color, color, 0);
+		return GFB_OK;
 	}
 
-	//Copy first line over the rest of the rectangle.
-	idx = ((yoff + psurface->pitch) + xoff); //Byte offset of second line.
-	for (y = prect->y; y < prect->y + prect->h; y++) {
-		memcpy((uint8_t *)&psurface->pbuffer[idx], (uint8_t *)&psurface->pbuffer[idx1], pixbytes);
-		idx += psurface->pitch; //Move to next line.
+	for (dx = 0; ; dx++) {
+		//The height only shrinks, the previous one is a close start for the root.
+		h = gfb_isqrt((uint64_t)(rr - (int64_t)dx * dx) << 16, h);
+		int dy = (int)(h >> 8);
+		uint8_t w = (uint8_t)(h & 0xff);
+
+		if (dx > dy) break;
+
+		gfb_blendpixel4(psurface, x, y, dx, dy, color, (uint8_t)~w);
+		if (dx != dy) gfb_blendpixel4(psurface, x, y, dy, dx, color, (uint8_t)~w);
+
+		if (w != 0) {
+			gfb_blendpixel4(psurface, x, y, dx, dy + 1, color, w);
+			if (dx != dy + 1) gfb_blendpixel4(psurface, x, y, dy + 1, dx, color, w);
+		}
 	}
 
 	return GFB_OK;
 }
 
-GFB_FILLEDCIRCLE(gfb_soft_filledcircle) {
-	int X = radius;
-	int Y = 0;
-	int decisionOver2 = 1 - X;   // Decision criterion divided by 2 evaluated at X=radius, Y=0
-
-	while( Y <= X ) {
-		psurface->op->line(psurface, -X + x,  Y + y, X + x,  Y + y, colorb);
-		psurface->op->line(psurface, -Y + x,  X + y, Y + x,  X + y, colorb);
-		psurface->op->line(psurface, -X + x, -Y + y, X + x, -Y + y, colorb);
-		psurface->op->line(psurface, -Y + x, -X + y, Y + x, -X + y, colorb);
-
-		Y++;
-		if (decisionOver2<=0) {
-			decisionOver2 += 2 * Y + 1;   // Change in decision criterion for Y -> Y+1
-		} else {
-			X--;
-			decisionOver2 += 2 * (Y - X) + 1;   // Change for Y -> Y+1, X -> X-1
+/*
+Same rows as gfb_ellipsespans(): pixel centers within r + 1/2 of the center. Centers within
+r - 1/2 are filled as one span, the rest are blended by (r + 1/2 - distance) in 8-bit fixed point.
+Only the rows crossing the surface cliprect are computed.
+*/
+GFB_FILLEDCIRCLE_AA(gfb_soft_filledcircle_aa) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	int64_t outer = ((int64_t)2 * radius + 1) * ((int64_t)2 * radius + 1);
+	int64_t inner = ((int64_t)2 * radius - 1) * ((int64_t)2 * radius - 1);
+	uint64_t edge = ((uint64_t)radius + 1) << 8;
+	int64_t top = (int64_t)y - pclip->y;
+	int64_t bottom = (int64_t)pclip->y + pclip->h - 1 - y;
+	int xo = radius + 1, xi = radius;
+	int dy;
+
+	if (radius > GFB_AACIRCLE_MAXRADIUS) {
+		//The curve is flat at this size, a hard edge is drawn instead.
+		gfb_ellipsespans(psurface, x, y, radius, radius, color, color, 1);
+		return GFB_OK;
+	}
+
+	//Rows dy with y - dy or y + dy inside the cliprect.
+	int64_t first = top < 0 ? -top : (bottom < 0 ? -bottom : 0);
+	int64_t last = top > bottom ? top : bottom;
+	if (last > radius) last = radius;
+
+	for (dy = (int)first; dy <= last; dy++) {
+		int64_t yy = ((int64_t)2 * dy) * (2 * dy);
+
+		//Largest x with (2x)^2 + (2dy)^2 < (2r + 1)^2, and <= (2r - 1)^2 for full coverage.
+		//Both shrink row by row, the previous root doubled is a start from above.
+		xo = (int)(gfb_isqrt((uint64_t)(outer - yy - 1), 2 * (uint64_t)xo + 1) / 2);
+		xi = (radius > 0 && inner >= yy) ? (int)(gfb_isqrt((uint64_t)(inner - yy), 2 * (uint64_t)xi + 1) / 2) : -1;
+		int dx;
+
+		if (xi >= 0) {
+			gfb_fillspan64(psurface, (int64_t)x - xi, (int64_t)x + xi, (int64_t)y - dy, color);
+			if (dy != 0) gfb_fillspan64(psurface, (int64_t)x - xi, (int64_t)x + xi, (int64_t)y + dy, color);
+		}
+
+		for (dx = xi + 1; dx <= xo; dx++) {
+			uint32_t d = gfb_isqrt(((uint64_t)dx * dx + (uint64_t)dy * dy) << 16, edge);
+			int64_t c = (int64_t)radius * 256 + 128 - d;
+			if (c <= 0) break;
+			gfb_blendpixel4(psurface, x, y, dx, dy, color, (uint8_t)(c > 255 ? 255 : c));
 		}
 	}
 
-	X = radius;
-	Y = 0;
-	decisionOver2 = 1 - X;   // Decision criterion divided by 2 evaluated at X=radius, Y=0
-	while( Y <= X ) {
-		psurface->op->putpixel(psurface,  X + x,  Y + y, colorf); // Octant 1
-		psurface->op->putpixel(psurface, -X + x,  Y + y, colorf); // Octant 4
+	return GFB_OK;
+}
+
+/** Plot a batch of points, expanded once per pixel size by gfb_soft_points(). */
+static inline __attribute__((always_inline)) void gfb_plotpoints(gfb_surface_t *psurface, const gfb_point_t *ppoints, size_t count, gfb_color_t color, const unsigned int bpp) {
+	//Unsigned compares test both sides of the cliprect at once.
+	unsigned int cx = (unsigned int)psurface->cliprect.x;
+	unsigned int cy = (unsigned int)psurface->cliprect.y;
+	unsigned int cw = (unsigned int)psurface->cliprect.w;
+	unsigned int ch = (unsigned int)psurface->cliprect.h;
+	const uint32_t *prows = psurface->prowoffsets;
+	const uint32_t *pcols = psurface->pcoloffsets;
+	uint8_t *pbuffer = psurface->pbuffer;
+	uint8_t alpha = gfb_drawalpha(psurface);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int x = (unsigned int)ppoints[i].x;
+		unsigned int y = (unsigned int)ppoints[i].y;
+		if (x - cx >= cw || y - cy >= ch) continue;
+		gfb_blendpoke(&pbuffer[ prows[y] + pcols[x] ], color, alpha, psurface->pformat, bpp);
+	}
+}
+
+GFB_POINTS(gfb_soft_points) {
+	switch (psurface->pformat->bytesperpixel) {
+		case 4: gfb_plotpoints(psurface, ppoints, count, color, 4); break;
+		case 3: gfb_plotpoints(psurface, ppoints, count, color, 3); break;
+		case 2: gfb_plotpoints(psurface, ppoints, count, color, 2); break;
+		default: gfb_plotpoints(psurface, ppoints, count, color, psurface->pformat->bytesperpixel); break;
+	}
+	return GFB_OK;
+}
 
-		psurface->op->putpixel(psurface,  Y + x,  X + y, colorf); // Octant 2
-		psurface->op->putpixel(psurface, -Y + x,  X + y, colorf); // Octant 3
+GFB_LINES(gfb_soft_lines) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	int xmin = INT_MAX, ymin = INT_MAX, xmax = INT_MIN, ymax = INT_MIN;
+	size_t i;
+	int rc;
 
-		psurface->op->putpixel(psurface, -X + x, -Y + y, colorf); // Octant 5
-		psurface->op->putpixel(psurface,  X + x, -Y + y, colorf); // Octant 7
+	//Clip the batch as a whole first, most batches are entirely visible.
+	for (i = 0; i < count; i++) {
+		xmin = gfb_mini(xmin, ppoints[i].x);
+		xmax = gfb_maxi(xmax, ppoints[i].x);
+		ymin = gfb_mini(ymin, ppoints[i].y);
+		ymax = gfb_maxi(ymax, ppoints[i].y);
+	}
 
-		psurface->op->putpixel(psurface, -Y + x, -X + y, colorf); // Octant 6
-		psurface->op->putpixel(psurface,  Y + x, -X + y, colorf); // Octant 8
+	if (xmin >= pclip->x && xmax < pclip->x + pclip->w && ymin >= pclip->y && ymax < pclip->y + pclip->h) {
+		for (i = 0; i + 1 < count; i += 2) {
+			if ((rc = gfb_soft_line(psurface, ppoints[i].x, ppoints[i].y, ppoints[i + 1].x, ppoints[i + 1].y, color)) != GFB_OK) return rc;
+		}
+		return GFB_OK;
+	}
 
-		Y++;
-		if (decisionOver2<=0) {
-			decisionOver2 += 2 * Y + 1;   // Change in decision criterion for Y -> Y+1
-		} else {
-			X--;
-			decisionOver2 += 2 * (Y - X) + 1;   // Change for Y -> Y+1, X -> X-1
+	for (i = 0; i + 1 < count; i += 2) {
+		int x1 = ppoints[i].x, y1 = ppoints[i].y;
+		int x2 = ppoints[i + 1].x, y2 = ppoints[i + 1].y;
+		if (!gfb_clipline(pclip, &x1, &y1, &x2, &y2)) continue;
+		if ((rc = gfb_soft_line(psurface, x1, y1, x2, y2, color)) != GFB_OK) return rc;
+	}
+
+	return GFB_OK;
+}
+
+GFB_RECTS(gfb_soft_rects) {
+	size_t i;
+
+	//Same outline as gfb_soft_rectangle(), corners at (x, y) and (x + w, y + h).
+	for (i = 0; i < count; i++) {
+		int x1 = prects[i].x, y1 = prects[i].y;
+		int x2 = x1 + prects[i].w, y2 = y1 + prects[i].h;
+		gfb_fillspan(psurface, x1, x2, y1, color);
+		if (y2 != y1) gfb_fillspan(psurface, x1, x2, y2, color);
+		if (y2 - y1 > 1) {
+			gfb_fillcolumn(psurface, x1, y1 + 1, y2 - 1, color);
+			if (x2 != x1) gfb_fillcolumn(psurface, x2, y1 + 1, y2 - 1, color);
 		}
 	}
 
+	return GFB_OK;
+}
+
+GFB_FILLEDRECTS(gfb_soft_filledrects) {
+	uint8_t alpha = gfb_drawalpha(psurface);
+	size_t i;
+
+	//Same pixels as gfb_soft_filledrectangle(), corners at (x, y) and (x + w, y + h).
+	for (i = 0; i < count; i++) {
+		gfb_fillbox(psurface, prects[i].x, prects[i].y, prects[i].x + prects[i].w, prects[i].y + prects[i].h, colorb, alpha);
+	}
 
 	return GFB_OK;
 }
@@ -623,7 +2196,7 @@ GFB_POLYGON(gfb_soft_polygon) {
 		y1 = ppoints[i].y;
 		x2 = ppoints[i+1].x;
 		y2 = ppoints[i+1].y;
-		if ((rc = psurface->op->line(psurface, x1, y1, x2, y2, color)) != GFB_OK) {
+		if ((rc = gfb_line(psurface, x1, y1, x2, y2, color)) != GFB_OK) {
 			return rc;
 		}
 	}
@@ -631,247 +2204,1192 @@ GFB_POLYGON(gfb_soft_polygon) {
 	return GFB_OK;
 }
 
-#if 0
-void gfb_floodfill_helper(gfb_surface_t *psurface, int x1, int x2, int y, gfb_color_t seed_color, gfb_color_t fill_color) {
-	int xL, xR;
+/** Polygon edge for the scanline converter, see gfb_soft_filledpolygon(). */
+typedef struct gfb_edge {
+	int ytop;		/**< First scanline crossed by the edge. */
+	int ybottom;	/**< Scanline after the last one crossed by the edge. */
+	int winding;	/**< +1 for edges going down, -1 for edges going up. */
+	int64_t x;		/**< Whole pixel part of the crossing on the current scanline. */
+	int64_t err;	/**< Fraction part of the crossing in units of 1/dy, 0 <= err < dy. */
+	int64_t xstep;	/**< Whole pixels to step per scanline. */
+	int64_t rem;	/**< Fraction to step per scanline in units of 1/dy. */
+	int64_t dy;		/**< Height of the edge in pixels. */
+} gfb_edge_t;
+
+/** Order edges by their first scanline, for qsort(). */
+static int gfb_edge_cmptop(const void *pa, const void *pb) {
+	const gfb_edge_t *a = pa;
+	const gfb_edge_t *b = pb;
+	return (a->ytop > b->ytop) - (a->ytop < b->ytop);
+}
 
-	if ( y < psurface->cliprect.y1 || y > psurface->cliprect.y2) return;
-	//if (( x1 < psurface->cliprect.x1 || x1 > psurface->cliprect.x2) || ( x2 < psurface->cliprect.x1 || x2 > psurface->cliprect.x2)) return;
+/** Returns non-zero if edge a crosses the current scanline to the right of edge b. */
+static inline int gfb_edge_after(const gfb_edge_t *a, const gfb_edge_t *b) {
+	if (a->x != b->x) return a->x > b->x;
+	return a->err * b->dy > b->err * a->dy;
+}
 
-	for ( xL = x1; xL >= psurface->cliprect.x1; --xL ) { // scan left
-		if ( psurface->op->getpixel(psurface, xL,y) != seed_color ) break;
-		psurface->op->putpixel(psurface, xL,y,fill_color);
+/** Move an edge down by n scanlines. */
+static inline void gfb_edge_advance(gfb_edge_t *pedge, int64_t n) {
+	if (n == 1) {
+		pedge->x += pedge->xstep;
+		pedge->err += pedge->rem;
+		if (pedge->err >= pedge->dy) {
+			pedge->x++;
+			pedge->err -= pedge->dy;
+		}
+	} else if (n > 1) {
+		int64_t err = pedge->err + pedge->rem * n;
+		pedge->x += pedge->xstep * n + err / pedge->dy;
+		pedge->err = err % pedge->dy;
 	}
+}
 
-	if ( xL < x1 ) {
-		gfb_floodfill_helper(psurface, xL, x1, y-1, seed_color, fill_color); // fill child
-		gfb_floodfill_helper(psurface, xL, x1, y+1, seed_color, fill_color); // fill child
-		++x1;
-	}
+/**
+Fill the pixels whose centers lie between two edge crossings on a scanline.
+Pixel px is filled if left <= px < right, clipped to the surface cliprect.
+*/
+static inline void gfb_edge_span(gfb_surface_t *psurface, const gfb_paint_t *ppaint, const gfb_edge_t *pleft, const gfb_edge_t *pright, int y, gfb_color_t color) {
+	int64_t x1 = pleft->x + (pleft->err > 0);
+	int64_t x2 = pright->x + (pright->err > 0) - 1;
+	int64_t xmin = psurface->cliprect.x;
+	int64_t xmax = psurface->cliprect.x + psurface->cliprect.w - 1;
+
+	if (x1 > x2 || x2 < xmin || x1 > xmax) return;
+	gfb_fillspan_paint(psurface, ppaint, (int)gfb_clampi(x1, xmin, xmax), (int)gfb_clampi(x2, xmin, xmax), y, color);
+}
 
-	for ( xR = x2;  xR <= psurface->cliprect.x2; ++xR ) { // scan right
-		if ( psurface->op->getpixel(psurface, xR,y) !=  seed_color ) break;
-		psurface->op->putpixel(psurface, xR,y,fill_color);
+/**
+Scan convert a polygon, see gfb_filledpolygon().
+@param ppaint Pointer to the gradient to fill with, NULL to fill with color.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+static int gfb_polygon_fill(gfb_surface_t *psurface, const gfb_point_t *ppoints, size_t count, gfb_color_t color, gfb_fillrule_t rule, const gfb_paint_t *ppaint) {
+	gfb_edge_t *pedges = calloc(count, sizeof(gfb_edge_t));		//Edge table, sorted by top scanline.
+	gfb_edge_t **pactive = calloc(count, sizeof(gfb_edge_t *));	//Active edge list, sorted by crossing.
+	size_t nedges = 0;
+	size_t nactive = 0;
+	size_t i, j;
+
+	if (pedges == NULL || pactive == NULL) {
+		free(pedges);
+		free(pactive);
+		return GFB_ENOMEM;
 	}
 
-	if ( xR > x2 ) {
-		gfb_floodfill_helper(psurface, x2, xR, y-1, seed_color, fill_color); // fill child
-		gfb_floodfill_helper(psurface, x2, xR, y+1, seed_color, fill_color); // fill child
-		--x2;
+	//Build the edge table, the polygon is closed from the last point back to the first.
+	int ymin = psurface->cliprect.y + psurface->cliprect.h;
+	int ymax = psurface->cliprect.y;
+	for (i = 0; i < count; i++) {
+		const gfb_point_t *p0 = &ppoints[i];
+		const gfb_point_t *p1 = &ppoints[(i + 1) % count];
+		gfb_edge_t *pedge = &pedges[nedges];
+
+		if (p0->y == p1->y) continue; //Horizontal edges never cross a scanline.
+
+		pedge->winding = 1;
+		if (p0->y > p1->y) {
+			const gfb_point_t *tmp = p0;
+			p0 = p1;
+			p1 = tmp;
+			pedge->winding = -1;
+		}
+
+		int64_t dx = (int64_t)p1->x - p0->x;
+		pedge->ytop = p0->y;
+		pedge->ybottom = p1->y;
+		pedge->dy = (int64_t)p1->y - p0->y;
+		pedge->x = p0->x;
+		pedge->err = 0;
+		pedge->xstep = dx / pedge->dy;
+		pedge->rem = dx % pedge->dy;
+		if (pedge->rem < 0) {
+			//Floor division so the fraction stays positive.
+			pedge->xstep--;
+			pedge->rem += pedge->dy;
+		}
+
+		ymin = gfb_mini(ymin, pedge->ytop);
+		ymax = gfb_maxi(ymax, pedge->ybottom);
+		nedges++;
 	}
 
-	for ( xR = x1; xR <= x2 && xR <= psurface->cliprect.x2; ++xR ) {  // scan betweens
-		if ( psurface->op->getpixel(psurface, xR,y) == seed_color )
-			psurface->op->putpixel(psurface, xR,y,fill_color);
-		else {
-			if ( x1 < xR ) {
-				// fill child
-				gfb_floodfill_helper(psurface, x1, xR-1, y-1, seed_color, fill_color);
-				// fill child
-				gfb_floodfill_helper(psurface, x1, xR-1, y+1, seed_color, fill_color);
-				x1 = xR;
+	qsort(pedges, nedges, sizeof(gfb_edge_t), gfb_edge_cmptop);
+
+	//Only walk the scanlines inside the cliprect.
+	int ystart = gfb_maxi(ymin, psurface->cliprect.y);
+	int yend = gfb_mini(ymax, psurface->cliprect.y + psurface->cliprect.h);
+	size_t next = 0; //Next edge in the edge table to activate.
+
+	for (int y = ystart; y < yend; y++) {
+		//Activate edges starting on or above this scanline.
+		while (next < nedges && pedges[next].ytop <= y) {
+			gfb_edge_t *pedge = &pedges[next++];
+			if (pedge->ybottom <= y) continue; //Ended above the cliprect.
+			gfb_edge_advance(pedge, y - pedge->ytop);
+			pactive[nactive++] = pedge;
+		}
+
+		//Drop finished edges.
+		for (i = 0, j = 0; i < nactive; i++) {
+			if (pactive[i]->ybottom > y) pactive[j++] = pactive[i];
+		}
+		nactive = j;
+
+		//Keep the list sorted by crossing, edges rarely swap places so insertion sort is close to linear.
+		for (i = 1; i < nactive; i++) {
+			gfb_edge_t *pedge = pactive[i];
+			for (j = i; j > 0 && gfb_edge_after(pactive[j - 1], pedge); j--) {
+				pactive[j] = pactive[j - 1];
 			}
-			// Note: This function still works if this step is removed.
-			for( ; xR <= x2 && xR <= psurface->cliprect.x2; ++xR) { // skip over border
-				if( psurface->op->getpixel(psurface, xR,y) == seed_color ) {
-					x1 = xR--;
-					break;
+			pactive[j] = pedge;
+		}
+
+		if (rule == GFB_FILL_NONZERO) {
+			int winding = 0;
+			const gfb_edge_t *pstart = NULL;
+			for (i = 0; i < nactive; i++) {
+				int before = winding;
+				winding += pactive[i]->winding;
+				if (before == 0 && winding != 0) {
+					pstart = pactive[i];
+				} else if (before != 0 && winding == 0) {
+					gfb_edge_span(psurface, ppaint, pstart, pactive[i], y, color);
 				}
 			}
+		} else {
+			for (i = 0; i + 1 < nactive; i += 2) {
+				gfb_edge_span(psurface, ppaint, pactive[i], pactive[i + 1], y, color);
+			}
 		}
-	}
-}
-#endif
-
-//From https://en.wikipedia.org/wiki/Flood_fill
-//Flood-fill (node, target-color, replacement-color):
-static inline void gfb_floodfill_recurse(gfb_surface_t *psurface, int x, int y, gfb_color_t target_color, gfb_color_t replacement_color) {
-	if (x < psurface->cliprect.x || x > psurface->cliprect.x + psurface->cliprect.w || y < psurface->cliprect.y || y > psurface->cliprect.y + psurface->cliprect.h) return;
 
-	//1. If target-color is equal to replacement-color, return.
-	if (target_color == replacement_color) return;
+		for (i = 0; i < nactive; i++) {
+			gfb_edge_advance(pactive[i], 1);
+		}
+	}
 
-	//2. If the color of node is not equal to target-color, return.
-	if (psurface->op->getpixel(psurface, x, y) != target_color) return;
+	free(pactive);
+	free(pedges);
 
-	//3. Set the color of node to replacement-color.
-	psurface->op->putpixel(psurface, x, y, replacement_color);
+	return GFB_OK;
+}
 
-	//4.
-	//4.1 Perform Flood-fill (one step to the south of node, target-color, replacement-color).
-	if (y+1 >= psurface->cliprect.y && y+1 <= psurface->cliprect.y + psurface->cliprect.h) gfb_floodfill_recurse(psurface, x, y+1, target_color, replacement_color);
-	//4.2 Perform Flood-fill (one step to the north of node, target-color, replacement-color).
-	if (y-1 >= psurface->cliprect.y && y-1 <= psurface->cliprect.y + psurface->cliprect.h) gfb_floodfill_recurse(psurface, x, y-1, target_color, replacement_color);
-	//4.3 Perform Flood-fill (one step to the west of node, target-color, replacement-color).
-	if (x-1 >= psurface->cliprect.x && x-1 <= psurface->cliprect.x + psurface->cliprect.w) gfb_floodfill_recurse(psurface, x-1, y, target_color, replacement_color);
-	//4.4 Perform Flood-fill (one step to the east of node, target-color, replacement-color).
-	if (x+1 >= psurface->cliprect.x && x+1 <= psurface->cliprect.x + psurface->cliprect.w) gfb_floodfill_recurse(psurface, x+1, y, target_color, replacement_color);
+GFB_FILLEDPOLYGON(gfb_soft_filledpolygon) {
+	return gfb_polygon_fill(psurface, ppoints, count, color, rule, NULL);
 }
 
-GFB_FLOODFILL(gfb_soft_floodfill) {
-	(void)psurface;
-	(void)x;
-	(void)y;
-	(void)color;
-	/*
-	gfb_color_t seed_color = psurface->op->getpixel(psurface, x,y);
-	int rc = GFB_OK;
-	if (color != seed_color) {
-		gfb_floodfill_recurse(psurface, x, y, seed_color, color);
-	}
-	return rc;
-	*/
-	return GFB_ENOTSUPPORTED;
+/** Span of pixels waiting to be scanned by the flood fill, see gfb_soft_floodfill(). */
+typedef struct gfb_floodspan {
+	int x1;	/**< Left pixel position of the parent span. */
+	int x2;	/**< Right pixel position of the parent span (inclusive). */
+	int y;	/**< Top pixel position of the parent span. */
+	int dy;	/**< Direction to scan from the parent span, +1 or -1. */
+} gfb_floodspan_t;
+
+/** Explicit span stack and match state of one flood fill. */
+typedef struct gfb_flood {
+	gfb_surface_t *psurface;	/**< Surface being filled. */
+	gfb_color_t seed;			/**< Color of the seed pixel. */
+	gfb_color_t color;			/**< Fill color. */
+	uint8_t tolerance;			/**< Largest per channel difference (0-255) still matching the seed. */
+	uint8_t *pvisited;			/**< One bit per cliprect pixel, NULL when filled pixels can not match the seed. */
+	gfb_floodspan_t *pstack;	/**< Spans waiting to be scanned. */
+	size_t count;				/**< Number of spans on the stack. */
+	size_t size;				/**< Capacity of the stack. */
+} gfb_flood_t;
+
+/** Tell if a channel of two encoded pixels differ by at most tolerance on a 0-255 scale. */
+static inline int gfb_flood_channel(gfb_color_t a, gfb_color_t b, uint32_t mask, uint8_t shift, uint8_t tolerance) {
+	int32_t ca = (int32_t)((a & mask) >> shift);
+	int32_t cb = (int32_t)((b & mask) >> shift);
+	//Compare in the native channel width: |ca - cb| * 255 <= tolerance * max.
+	return (uint32_t)abs(ca - cb) * 255u <= (uint32_t)tolerance * (mask >> shift);
 }
 
-/** See if there are trailing bytes after the character (c). */
-#define is_trail(c) (c > 0x7F && c < 0xC0)
+/** Tell if the pixel at (x, y) belongs to the filled region. */
+static inline int gfb_flood_inside(gfb_flood_t *pflood, int x, int y) {
+	gfb_surface_t *psurface = pflood->psurface;
+	gfb_pixelformat_t *pformat = psurface->pformat;
+	gfb_color_t pixel = gfb_peekpixel(&psurface->pbuffer[ psurface->prowoffsets[y] + psurface->pcoloffsets[x] ], pformat->bytesperpixel);
 
-static inline int utf8_get_next_char(const unsigned char *str, size_t str_size, size_t *cursor, int *is_valid, unsigned int *code_point)
-{
-	size_t pos = *cursor;
-	size_t rest_size = str_size - pos;
-	unsigned char c;
-	unsigned char min;
-	unsigned char max;
+	if (pflood->pvisited != NULL) {
+		size_t bit = (size_t)(y - psurface->cliprect.y) * psurface->cliprect.w + (x - psurface->cliprect.x);
+		if (pflood->pvisited[bit >> 3] & (1 << (bit & 7))) return 0;
+	}
 
-	*code_point = 0;
-	*is_valid = 1;
+	if (pflood->tolerance == 0) return pixel == pflood->seed;
 
-	if (*cursor >= str_size) {
-		return 0;
-	}
+	return gfb_flood_channel(pixel, pflood->seed, pformat->rmask, pformat->rshift, pflood->tolerance)
+		&& gfb_flood_channel(pixel, pflood->seed, pformat->gmask, pformat->gshift, pflood->tolerance)
+		&& gfb_flood_channel(pixel, pflood->seed, pformat->bmask, pformat->bshift, pflood->tolerance)
+		&& gfb_flood_channel(pixel, pflood->seed, pformat->amask, pformat->ashift, pflood->tolerance);
+}
 
-	c = str[pos];
+/** Fill pixels x1 to x2 (inclusive) on row y and mark them visited. */
+static inline void gfb_flood_fill(gfb_flood_t *pflood, int x1, int x2, int y) {
+	gfb_surface_t *psurface = pflood->psurface;
 
-	if (rest_size < 1) {
-		*is_valid = 0;
-		pos += 1;
-	} else if (c < 0x80) {
-		*code_point = str[pos];
-		*is_valid = 1;
-		pos += 1;
-	} else if (c < 0xC2) {
-		*is_valid = 0;
-		pos += 1;
-	} else if (c < 0xE0) {
+	gfb_fillspan(psurface, x1, x2, y, pflood->color);
 
-		if (rest_size < 2 || !is_trail(str[pos + 1])) {
-			*is_valid = 0;
-			pos += 1;
-		} else {
-			*code_point = ((str[pos] & 0x1F) << 6) | (str[pos + 1] & 0x3F);
-			*is_valid = 1;
-			pos += 2;
+	if (pflood->pvisited != NULL) {
+		size_t bit = (size_t)(y - psurface->cliprect.y) * psurface->cliprect.w + (x1 - psurface->cliprect.x);
+		for (int x = x1; x <= x2; x++, bit++) {
+			pflood->pvisited[bit >> 3] |= (uint8_t)(1 << (bit & 7));
 		}
+	}
+}
 
-	} else if (c < 0xF0) {
+/** Push a span to be scanned on row y + dy, if that row is inside the cliprect. */
+static inline int gfb_flood_push(gfb_flood_t *pflood, int x1, int x2, int y, int dy) {
+	const gfb_rect_t *pclip = &pflood->psurface->cliprect;
 
-		min = (c == 0xE0) ? 0xA0 : 0x80;
-		max = (c == 0xED) ? 0x9F : 0xBF;
+	if (y + dy < pclip->y || y + dy >= pclip->y + pclip->h) return GFB_OK;
 
-		if (rest_size < 2 || str[pos + 1] < min || max < str[pos + 1]) {
-			*is_valid = 0;
-			pos += 1;
-		} else if (rest_size < 3 || !is_trail(str[pos + 2])) {
-			*is_valid = 0;
-			pos += 2;
-		} else {
-			*code_point = ((str[pos]     & 0x1F) << 12)
-					   | ((str[pos + 1] & 0x3F) <<  6)
-					   |  (str[pos + 2] & 0x3F);
-			*is_valid = 1;
-			pos += 3;
-		}
-
-	} else if (c < 0xF5) {
-
-		min = (c == 0xF0) ? 0x90 : 0x80;
-		max = (c == 0xF4) ? 0x8F : 0xBF;
-
-		if (rest_size < 2 || str[pos + 1] < min || max < str[pos + 1]) {
-			*is_valid = 0;
-			pos += 1;
-		} else if (rest_size < 3 || !is_trail(str[pos + 2])) {
-			*is_valid = 0;
-			pos += 2;
-		} else if (rest_size < 4 || !is_trail(str[pos + 3])) {
-			*is_valid = 0;
-			pos += 3;
-		} else {
-			*code_point = ((str[pos]     &  0x7) << 18)
-					   | ((str[pos + 1] & 0x3F) << 12)
-					   | ((str[pos + 2] & 0x3F) << 6)
-					   |  (str[pos + 3] & 0x3F);
-			*is_valid = 1;
-			pos += 4;
-		}
+	if (pflood->count == pflood->size) {
+		size_t size = pflood->size * 2;
+		gfb_floodspan_t *pstack = realloc(pflood->pstack, size * sizeof(gfb_floodspan_t));
+		if (pstack == NULL) return GFB_ENOMEM;
+		pflood->pstack = pstack;
+		pflood->size = size;
+	}
 
-	} else {
-		*is_valid = 0;
-		pos += 1;
+	gfb_floodspan_t *pspan = &pflood->pstack[pflood->count++];
+	pspan->x1 = x1;
+	pspan->x2 = x2;
+	pspan->y = y;
+	pspan->dy = dy;
+
+	return GFB_OK;
+}
+
+/*
+Scanline seed fill with an explicit span stack, after Heckbert's "A Seed Fill Algorithm"
+in Graphics Gems. Each popped span is the parent of a run of pixels on the next row in its
+direction. Runs are found by reading the pixel buffer and filled as whole spans. Spans leaking
+past the ends of the parent are pushed back in the opposite direction.
+*/
+GFB_FLOODFILL(gfb_soft_floodfill) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	int xmin = pclip->x;
+	int xmax = pclip->x + pclip->w - 1;
+	int rc = GFB_OK;
+
+	gfb_flood_t flood = {
+		.psurface = psurface,
+		.seed = gfb_peekpixel(&psurface->pbuffer[ psurface->prowoffsets[y] + psurface->pcoloffsets[x] ], psurface->pformat->bytesperpixel),
+		.color = color,
+		.tolerance = tolerance,
+		.pvisited = NULL,
+		.pstack = NULL,
+		.count = 0,
+		.size = 64 + 2 * (size_t)pclip->h,
+	};
+
+	//Compare with the pixel as it is stored, bits of color above the pixel size are not written.
+	uint8_t written[sizeof(gfb_color_t)];
+	gfb_pokepixel(written, color, psurface->pformat->bytesperpixel);
+	gfb_color_t stored = gfb_peekpixel(written, psurface->pformat->bytesperpixel);
+
+	if (tolerance == 0 && flood.seed == stored) return GFB_OK;
+
+	//Exactly filled pixels no longer match the seed so nothing else is needed to stop the fill.
+	if (tolerance != 0 || gfb_drawalpha(psurface) != 255) {
+		//Filled or blended pixels may still match, remember which pixels are done.
+		flood.pvisited = calloc(1, ((size_t)pclip->w * pclip->h + 7) / 8);
+		if (flood.pvisited == NULL) return GFB_ENOMEM;
+	}
+
+	flood.pstack = malloc(flood.size * sizeof(gfb_floodspan_t));
+	if (flood.pstack == NULL) {
+		free(flood.pvisited);
+		return GFB_ENOMEM;
+	}
+
+	//Seed the stack with the seed row, once scanning down and once scanning up.
+	gfb_flood_push(&flood, x, x, y - 1, 1);
+	gfb_flood_push(&flood, x, x, y, -1);
+
+	while (flood.count > 0 && rc == GFB_OK) {
+		gfb_floodspan_t span = flood.pstack[--flood.count];
+		int row = span.y + span.dy;
+		int x1 = span.x1;
+		int x2 = span.x2;
+		int l, r;
+
+		//Extend left from the start of the parent span.
+		for (l = x1; l >= xmin && gfb_flood_inside(&flood, l, row); l--);
+
+		if (l < x1) {
+			l++;
+			//Extend right and fill the whole run at once.
+			for (r = x1 + 1; r <= xmax && gfb_flood_inside(&flood, r, row); r++);
+			gfb_flood_fill(&flood, l, r - 1, row);
+
+			rc = gfb_flood_push(&flood, l, r - 1, row, span.dy);
+			if (rc == GFB_OK && l < x1) rc = gfb_flood_push(&flood, l, x1 - 1, row, -span.dy);
+			if (rc == GFB_OK && r > x2 + 1) rc = gfb_flood_push(&flood, x2 + 1, r - 1, row, -span.dy);
+			l = r;
+		} else {
+			l = x1;
+		}
+
+		//Find the remaining runs below the parent span.
+		while (rc == GFB_OK) {
+			for (l++; l <= x2 && !gfb_flood_inside(&flood, l, row); l++);
+			if (l > x2) break;
+
+			for (r = l + 1; r <= xmax && gfb_flood_inside(&flood, r, row); r++);
+			gfb_flood_fill(&flood, l, r - 1, row);
+
+			rc = gfb_flood_push(&flood, l, r - 1, row, span.dy);
+			if (rc == GFB_OK && r > x2 + 1) rc = gfb_flood_push(&flood, x2 + 1, r - 1, row, -span.dy);
+			l = r;
+		}
+	}
+
+	free(flood.pstack);
+	free(flood.pvisited);
+
+	return rc;
+}
+
+/** Default flattening tolerance of a path in pixels, see gfb_path_create(). */
+#define GFB_PATH_TOLERANCE 0.25f
+
+/** Ratio of a circle's circumference to its diameter, M_PI is not part of C99. */
+#define GFB_PI 3.14159265358979323846f
+
+/** Upper limit on the number of lines a single curve or arc is flattened to. */
+#define GFB_PATH_MAXSTEPS 1024
+
+/** Signed area accumulation buffer of one path render, see gfb_coverage_line(). */
+typedef struct gfb_coverage {
+	float *pcells;	/**< Area per cell, rows of stride cells, all zero when not rendering. */
+	int w;			/**< Width of the covered box in pixels. */
+	int h;			/**< Height of the covered box in pixels. */
+	int stride;		/**< Number of cells per row, w + 2 so lines ending at x = w stay inside. */
+	float ox;		/**< Left surface position of cell (0, 0). */
+	float oy;		/**< Top surface position of cell (0, 0). */
+} gfb_coverage_t;
+
+/**
+Accumulate the signed area of a line inside the box, 0 <= x <= w.
+Each row the line crosses adds its height to the cells it touches, split by how much of each cell lies
+to the right of the line. A running sum along a row then gives the coverage of every pixel.
+*/
+static void gfb_coverage_segment(gfb_coverage_t *pcov, float x0, float y0, float x1, float y1) {
+	float dir = 1.0f;
+
+	if (y0 == y1) return;
+	if (y0 > y1) {
+		float t;
+		dir = -1.0f;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+	}
+
+	float dxdy = (x1 - x0) / (y1 - y0);
+	float x = x0;
+	if (y0 < 0.0f) {
+		x -= y0 * dxdy;
+		y0 = 0.0f;
+	}
+	if (y1 > (float)pcov->h) y1 = (float)pcov->h;
+	if (y0 >= y1) return;
+
+	for (int y = (int)y0; y < (int)ceilf(y1); y++) {
+		float *prow = &pcov->pcells[(size_t)y * pcov->stride];
+		float dy = fminf((float)(y + 1), y1) - fmaxf((float)y, y0);
+		float xnext = x + dxdy * dy;
+		float d = dy * dir;
+		float xa = fminf(x, xnext);
+		float xb = fmaxf(x, xnext);
+		int xai = (int)xa;
+		float xaf = xa - (float)xai;
+
+		if (xb <= (float)xai + 1.0f) {
+			//Line stays inside one cell, split its area between this cell and the next.
+			float xmf = 0.5f * (x + xnext) - (float)xai;
+			prow[xai] += d - d * xmf;
+			prow[xai + 1] += d * xmf;
+		} else {
+			//Line spans several cells, the first and last get a triangle, the middle a trapezoid each.
+			float s = 1.0f / (xb - xa);
+			int xbi = (int)ceilf(xb);
+			float xbf = xb - (float)xbi + 1.0f;
+			float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+			float am = 0.5f * s * xbf * xbf;
+
+			prow[xai] += d * a0;
+			if (xbi == xai + 2) {
+				prow[xai + 1] += d * (1.0f - a0 - am);
+			} else {
+				float a1 = s * (1.5f - xaf);
+				prow[xai + 1] += d * (a1 - a0);
+				for (int i = xai + 2; i < xbi - 1; i++) {
+					prow[i] += d * s;
+				}
+				float a2 = a1 + (float)(xbi - xai - 3) * s;
+				prow[xbi - 1] += d * (1.0f - a2 - am);
+			}
+			prow[xbi] += d * am;
+		}
+		x = xnext;
+	}
+}
+
+/**
+Accumulate the signed area of a line given in surface coordinates.
+The line is split where it leaves the box horizontally, the parts outside are moved to the box edge
+so they still count for the pixels to their right.
+*/
+static void gfb_coverage_line(gfb_coverage_t *pcov, float x0, float y0, float x1, float y1) {
+	float w = (float)pcov->w;
+	float ts[4];
+	int n = 0;
+
+	x0 -= pcov->ox; x1 -= pcov->ox;
+	y0 -= pcov->oy; y1 -= pcov->oy;
+	if (y0 == y1) return;
+	if ((y0 <= 0.0f && y1 <= 0.0f) || (y0 >= (float)pcov->h && y1 >= (float)pcov->h)) return;
+
+	ts[n++] = 0.0f;
+	if ((x0 < 0.0f) != (x1 < 0.0f)) ts[n++] = -x0 / (x1 - x0);
+	if ((x0 > w) != (x1 > w)) ts[n++] = (w - x0) / (x1 - x0);
+	ts[n++] = 1.0f;
+	if (n == 4 && ts[1] > ts[2]) {
+		float t = ts[1]; ts[1] = ts[2]; ts[2] = t;
+	}
+
+	float xa = x0, ya = y0;
+	for (int i = 1; i < n; i++) {
+		float xb = (i == n - 1) ? x1 : x0 + (x1 - x0) * ts[i];
+		float yb = (i == n - 1) ? y1 : y0 + (y1 - y0) * ts[i];
+		gfb_coverage_segment(pcov, fminf(fmaxf(xa, 0.0f), w), ya, fminf(fmaxf(xb, 0.0f), w), yb);
+		xa = xb;
+		ya = yb;
+	}
+}
+
+/** Accumulate a filled circle, wound the same way as gfb_coverage_quad(). */
+static void gfb_coverage_disc(gfb_coverage_t *pcov, float cx, float cy, float radius, float tolerance) {
+	int n = 8;
+
+	if (radius > tolerance) {
+		n = (int)ceilf(GFB_PI / acosf(1.0f - tolerance / radius));
+		if (n < 8) n = 8;
+		if (n > GFB_PATH_MAXSTEPS) n = GFB_PATH_MAXSTEPS;
+	}
+
+	float px = cx + radius, py = cy;
+	for (int i = 1; i <= n; i++) {
+		float a = -2.0f * GFB_PI * (float)i / (float)n;
+		float x = (i == n) ? cx + radius : cx + radius * cosf(a);
+		float y = (i == n) ? cy : cy + radius * sinf(a);
+		gfb_coverage_line(pcov, px, py, x, y);
+		px = x;
+		py = y;
+	}
+}
+
+/** Accumulate the rectangle covering a stroked line from (x0, y0) to (x1, y1) of half width hw. */
+static void gfb_coverage_quad(gfb_coverage_t *pcov, float x0, float y0, float x1, float y1, float hw) {
+	float dx = x1 - x0, dy = y1 - y0;
+	float len = sqrtf(dx * dx + dy * dy);
+
+	if (len == 0.0f) return;
+
+	//The normal is always to the right of the direction so every quad has the same winding.
+	float nx = -dy * hw / len, ny = dx * hw / len;
+	gfb_coverage_line(pcov, x0 + nx, y0 + ny, x1 + nx, y1 + ny);
+	gfb_coverage_line(pcov, x1 + nx, y1 + ny, x1 - nx, y1 - ny);
+	gfb_coverage_line(pcov, x1 - nx, y1 - ny, x0 - nx, y0 - ny);
+	gfb_coverage_line(pcov, x0 - nx, y0 - ny, x0 + nx, y0 + ny);
+}
+
+/** Accumulate the outline of every contour as a closed polygon. */
+static void gfb_path_fillcoverage(const gfb_path_t *ppath, gfb_coverage_t *pcov) {
+	for (size_t c = 0; c < ppath->ncontours; c++) {
+		const gfb_pointf_t *pp = &ppath->ppoints[ppath->pcontours[c].first];
+		size_t count = ppath->pcontours[c].count;
+
+		if (count < 2) continue;
+		for (size_t i = 0; i < count; i++) {
+			const gfb_pointf_t *pa = &pp[i];
+			const gfb_pointf_t *pb = &pp[(i + 1) % count];
+			gfb_coverage_line(pcov, pa->x, pa->y, pb->x, pb->y);
+		}
+	}
+}
+
+/**
+Accumulate the stroke of every contour.
+Segments are quads and joins and caps are discs. As all of them wind the same way the overlaps do not add
+up once the coverage is clamped. Joins bending too little to show a gap between the quads are skipped.
+*/
+static void gfb_path_strokecoverage(const gfb_path_t *ppath, gfb_coverage_t *pcov, float hw) {
+	float tolerance = ppath->tolerance;
+
+	for (size_t c = 0; c < ppath->ncontours; c++) {
+		const gfb_contour_t *pcontour = &ppath->pcontours[c];
+		const gfb_pointf_t *pp = &ppath->ppoints[pcontour->first];
+		size_t count = pcontour->count;
+		size_t nsegments = pcontour->closed ? count : count - 1;
+
+		if (count == 1 || (count == 2 && pcontour->closed)) nsegments = count - 1;
+		if (nsegments == 0) {
+			gfb_coverage_disc(pcov, pp[0].x, pp[0].y, hw, tolerance);
+			continue;
+		}
+
+		for (size_t i = 0; i < nsegments; i++) {
+			const gfb_pointf_t *pa = &pp[i];
+			const gfb_pointf_t *pb = &pp[(i + 1) % count];
+			gfb_coverage_quad(pcov, pa->x, pa->y, pb->x, pb->y, hw);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			int join = pcontour->closed ? nsegments == count : (i > 0 && i < count - 1);
+
+			if (join) {
+				const gfb_pointf_t *pa = &pp[(i + count - 1) % count];
+				const gfb_pointf_t *pb = &pp[i];
+				const gfb_pointf_t *pc = &pp[(i + 1) % count];
+				float ux = pb->x - pa->x, uy = pb->y - pa->y;
+				float vx = pc->x - pb->x, vy = pc->y - pb->y;
+				float uv = sqrtf((ux * ux + uy * uy) * (vx * vx + vy * vy));
+				//Gap between the quads is hw * (1 - cos(turn / 2)).
+				float costurn = uv > 0.0f ? (ux * vx + uy * vy) / uv : 1.0f;
+				if (hw * (1.0f - sqrtf(0.5f * (1.0f + costurn))) < 0.5f * tolerance) continue;
+			}
+			gfb_coverage_disc(pcov, pp[i].x, pp[i].y, hw, tolerance);
+		}
+	}
+}
+
+/** Convert an accumulated area to an 8-bit coverage. */
+static inline uint8_t gfb_coverage_value(float acc) {
+	acc = fabsf(acc);
+	return acc >= 1.0f ? 255 : (uint8_t)(acc * 255.0f + 0.5f);
+}
+
+/**
+Sweep the coverage buffers once per row and write the pixels.
+Runs of fully covered pixels of one color go through the span filler, edge pixels are blended.
+The fill takes its colors from ppaint instead of colorb when there is one.
+Cells are zeroed as they are read so the buffers are ready for the next render.
+*/
+static void gfb_path_composite(gfb_surface_t *psurface, gfb_coverage_t *pfill, gfb_color_t colorb, const gfb_paint_t *ppaint, gfb_coverage_t *pstroke, gfb_color_t colorf) {
+	gfb_coverage_t *pcov = pfill != NULL ? pfill : pstroke;
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	unsigned int bpp = pformat->bytesperpixel;
+	uint8_t alpha = gfb_drawalpha(psurface);
+	int ox = (int)pcov->ox, oy = (int)pcov->oy;
+
+	for (int y = 0; y < pcov->h; y++) {
+		float *pf = pfill != NULL ? &pfill->pcells[(size_t)y * pcov->stride] : NULL;
+		float *ps = pstroke != NULL ? &pstroke->pcells[(size_t)y * pcov->stride] : NULL;
+		uint8_t *prow = &psurface->pbuffer[ psurface->prowoffsets[oy + y] ];
+		float accf = 0.0f, accs = 0.0f;
+		int runstart = -1;
+		gfb_color_t runcolor = 0;
+		const gfb_paint_t *runpaint = NULL;
+
+		for (int x = 0; x < pcov->w; x++) {
+			uint8_t cf = 0, cs = 0;
+
+			if (pf != NULL) {
+				accf += pf[x];
+				pf[x] = 0.0f;
+				cf = gfb_coverage_value(accf);
+			}
+			if (ps != NULL) {
+				accs += ps[x];
+				ps[x] = 0.0f;
+				cs = gfb_coverage_value(accs);
+			}
+
+			//Fully covered pixels extend or start a run, anything else ends it.
+			int full = cs == 255 || (cs == 0 && cf == 255);
+			gfb_color_t color = cs == 255 ? colorf : colorb;
+			if (runstart >= 0 && (!full || color != runcolor)) {
+				gfb_fillspan_paint(psurface, runpaint, ox + runstart, ox + x - 1, oy + y, runcolor);
+				runstart = -1;
+			}
+			if (full) {
+				if (runstart < 0) {
+					runstart = x;
+					runcolor = color;
+					runpaint = cs == 255 ? NULL : ppaint;
+				}
+				continue;
+			}
+
+			uint8_t *p = &prow[ psurface->pcoloffsets[ox + x] ];
+			if (cf != 0 && ppaint != NULL) {
+				gfb_paint_span(psurface, ppaint, ox + x, ox + x, oy + y, cf);
+			} else if (cf != 0) {
+				gfb_blendpoke(p, colorb, gfb_scalecoverage(cf, alpha), pformat, bpp);
+			}
+			if (cs != 0) gfb_blendpoke(p, colorf, gfb_scalecoverage(cs, alpha), pformat, bpp);
+		}
+
+		if (runstart >= 0) gfb_fillspan_paint(psurface, runpaint, ox + runstart, ox + pcov->w - 1, oy + y, runcolor);
+
+		if (pf != NULL) pf[pcov->w] = pf[pcov->w + 1] = 0.0f;
+		if (ps != NULL) ps[pcov->w] = ps[pcov->w + 1] = 0.0f;
 	}
+}
+
+/**
+Rasterize the fill and/or stroke of a path.
+@param psurface Pointer to the surface to draw on.
+@param ppath Pointer to the path.
+@param fill Non-zero to fill the path with colorb.
+@param width Width of the stroke, 0 for none.
+@param colorf Encoded pixel value of the stroke.
+@param colorb Encoded pixel value of the fill.
+@param ppaint Pointer to the gradient to fill with instead of colorb, NULL for none.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+static int gfb_path_render(gfb_surface_t *psurface, gfb_path_t *ppath, int fill, float width, gfb_color_t colorf, gfb_color_t colorb, const gfb_paint_t *ppaint) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	float hw = 0.5f * width;
+	float minx = INFINITY, miny = INFINITY, maxx = -INFINITY, maxy = -INFINITY;
+
+	if (ppath->count == 0) return GFB_OK;
+
+	for (size_t i = 0; i < ppath->count; i++) {
+		minx = fminf(minx, ppath->ppoints[i].x);
+		maxx = fmaxf(maxx, ppath->ppoints[i].x);
+		miny = fminf(miny, ppath->ppoints[i].y);
+		maxy = fmaxf(maxy, ppath->ppoints[i].y);
+	}
+
+	//Covered box in surface pixels, clipped to the cliprect.
+	float x1 = fmaxf(floorf(minx - hw), (float)pclip->x);
+	float y1 = fmaxf(floorf(miny - hw), (float)pclip->y);
+	float x2 = fminf(ceilf(maxx + hw), (float)(pclip->x + pclip->w));
+	float y2 = fminf(ceilf(maxy + hw), (float)(pclip->y + pclip->h));
+	if (x1 >= x2 || y1 >= y2) return GFB_OK;
+
+	gfb_coverage_t cov;
+	cov.w = (int)(x2 - x1);
+	cov.h = (int)(y2 - y1);
+	cov.stride = cov.w + 2;
+	cov.ox = x1;
+	cov.oy = y1;
+
+	size_t cells = (size_t)cov.stride * cov.h;
+	size_t need = cells * ((fill ? 1 : 0) + (width > 0.0f ? 1 : 0));
+	if (need > ppath->cellcount) {
+		float *pcells = calloc(need, sizeof(float));
+		if (pcells == NULL) return GFB_ENOMEM;
+		free(ppath->pcells);
+		ppath->pcells = pcells;
+		ppath->cellcount = need;
+	}
+
+	gfb_coverage_t fillcov = cov, strokecov = cov;
+	gfb_coverage_t *pfill = NULL, *pstroke = NULL;
+	if (fill) {
+		fillcov.pcells = ppath->pcells;
+		pfill = &fillcov;
+		gfb_path_fillcoverage(ppath, pfill);
+	}
+	if (width > 0.0f) {
+		strokecov.pcells = ppath->pcells + (fill ? cells : 0);
+		pstroke = &strokecov;
+		gfb_path_strokecoverage(ppath, pstroke, hw);
+	}
+
+	gfb_path_composite(psurface, pfill, colorb, ppaint, pstroke, colorf);
+
+	return GFB_OK;
+}
+
+/** Make room for n more points in a path. */
+static int gfb_path_reserve(gfb_path_t *ppath, size_t n) {
+	if (ppath->count + n <= ppath->size) return GFB_OK;
+
+	size_t size = ppath->size ? ppath->size : 64;
+	while (size < ppath->count + n) size *= 2;
 
-	*cursor = pos;
+	gfb_pointf_t *ppoints = realloc(ppath->ppoints, size * sizeof(gfb_pointf_t));
+	if (ppoints == NULL) return GFB_ENOMEM;
+	ppath->ppoints = ppoints;
+	ppath->size = size;
+
+	return GFB_OK;
+}
+
+/** Append a point to the current contour, repeated points are dropped. */
+static inline void gfb_path_push(gfb_path_t *ppath, float x, float y) {
+	gfb_contour_t *pcontour = &ppath->pcontours[ppath->ncontours - 1];
+
+	if (pcontour->count > 0) {
+		const gfb_pointf_t *plast = &ppath->ppoints[ppath->count - 1];
+		if (plast->x == x && plast->y == y) return;
+	}
+	ppath->ppoints[ppath->count].x = x;
+	ppath->ppoints[ppath->count].y = y;
+	ppath->count++;
+	pcontour->count++;
+}
+
+/** Get the current point of a path, returns 0 if there is none. */
+static int gfb_path_current(const gfb_path_t *ppath, float *px, float *py) {
+	if (ppath->ncontours == 0) return 0;
+
+	const gfb_contour_t *pcontour = &ppath->pcontours[ppath->ncontours - 1];
+	const gfb_pointf_t *ppoint = &ppath->ppoints[pcontour->closed ? pcontour->first : ppath->count - 1];
+	*px = ppoint->x;
+	*py = ppoint->y;
 
 	return 1;
 }
 
-//FIXME, kerning and glyph cache!
-GFB_TEXT(gfb_soft_text) {
-	FT_GlyphSlot slot = gfb_fontstore[fontid]->glyph;
-	FT_Vector pen;
-
-	/* set up matrix */
-	/*
-	FT_Matrix matrix;
-	double angle = 0;//6.25;
-	matrix.xx = (FT_Fixed)( cos( angle ) * 0x10000L );
-	matrix.xy = (FT_Fixed)(-sin( angle ) * 0x10000L );
-	matrix.yx = (FT_Fixed)( sin( angle ) * 0x10000L );
-	matrix.yy = (FT_Fixed)( cos( angle ) * 0x10000L );
-	*/
+/** Make sure the path has an open contour to add n points to, starting at the current point. */
+static int gfb_path_begin(gfb_path_t *ppath, size_t n) {
+	float x, y;
+	int rc;
 
-	/* the pen position in 26.6 cartesian space coordinates; */
-	/* start at (x,y) relative to the upper left corner  */
-	pen.x = x * 64;
-	pen.y = y * 64;
+	if (!gfb_path_current(ppath, &x, &y)) return GFB_EARGUMENT;
+	if ((rc = gfb_path_reserve(ppath, n + 1)) != GFB_OK) return rc;
+	if (ppath->pcontours[ppath->ncontours - 1].closed) {
+		if ((rc = gfb_path_moveto(ppath, x, y)) != GFB_OK) return rc;
+	}
+
+	return GFB_OK;
+}
 
-	gfb_rect_t destrect;
-	gfb_rect_t srcrect;
+/** Number of lines to flatten a curve to, from the second difference dd of its control points. */
+static inline int gfb_path_steps(float dd, float tolerance) {
+	float n = ceilf(sqrtf(dd / (4.0f * tolerance)));
 
-	size_t n;
-	for ( n = 0; n < count; n++ ) {
-		/* set transformation */
-		FT_Set_Transform( gfb_fontstore[fontid], /*&matrix*/ 0, &pen );
+	if (!(n >= 1.0f)) return 1;
+	if (n > (float)GFB_PATH_MAXSTEPS) return GFB_PATH_MAXSTEPS;
+	return (int)n;
+}
 
-		/* load glyph image into the slot (erase previous one) */
-		FT_Error error = FT_Load_Char( gfb_fontstore[fontid], text[n], FT_LOAD_RENDER);
-		if ( error ) continue; /* ignore errors */
+/** See if there are trailing bytes after the character (c). */
+#define is_trail(c) (c > 0x7F && c < 0xC0)
+
+/**
+Decode the next character of a NUL terminated UTF-8 string and step past it.
+Overlong forms, surrogates and code points above U+10FFFF are invalid. An invalid sequence is consumed
+up to the first byte that does not fit and decodes to 0. A NUL inside a sequence is never stepped over.
+@param pp Pointer to the position in the string.
+@param pcode Pointer to store the code point, 0 if invalid.
+@return Returns 0 at the end of the string, 1 otherwise.
+*/
+static inline int gfb_utf8_next(const uint8_t **pp, uint32_t *pcode) {
+	const uint8_t *p = *pp;
+	uint8_t c = p[0];
+	uint8_t min = 0x80, max = 0xBF;
+
+	*pcode = 0;
+	if (c == 0) return 0;
+
+	if (c < 0x80) {
+		*pcode = c;
+		*pp = p + 1;
+		return 1;
+	}
+
+	if (c < 0xC2 || c > 0xF4) {
+		*pp = p + 1;
+		return 1;
+	}
+
+	if (c < 0xE0) {
+		if (!is_trail(p[1])) {
+			*pp = p + 1;
+		} else {
+			*pcode = ((uint32_t)(c & 0x1F) << 6) | (p[1] & 0x3F);
+			*pp = p + 2;
+		}
+		return 1;
+	}
+
+	if (c < 0xF0) {
+		if (c == 0xE0) min = 0xA0;
+		if (c == 0xED) max = 0x9F;
+		if (p[1] < min || p[1] > max) {
+			*pp = p + 1;
+		} else if (!is_trail(p[2])) {
+			*pp = p + 2;
+		} else {
+			*pcode = ((uint32_t)(c & 0x0F) << 12) | ((uint32_t)(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+			*pp = p + 3;
+		}
+		return 1;
+	}
+
+	if (c == 0xF0) min = 0x90;
+	if (c == 0xF4) max = 0x8F;
+	if (p[1] < min || p[1] > max) {
+		*pp = p + 1;
+	} else if (!is_trail(p[2])) {
+		*pp = p + 2;
+	} else if (!is_trail(p[3])) {
+		*pp = p + 3;
+	} else {
+		*pcode = ((uint32_t)(c & 0x07) << 18) | ((uint32_t)(p[1] & 0x3F) << 12) | ((uint32_t)(p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+		*pp = p + 4;
+	}
+	return 1;
+}
+
+/** Number of hash buckets of the text run cache, a power of two. */
+#define GFB_RUNCACHE_BUCKETS	256
+
+/** Number of recently drawn strings remembered, a string is only cached the second time it is drawn. */
+#define GFB_RUNCACHE_SEEN		256
+
+/** Part of a cached run covered by one glyph, relative to the top left of the strip. */
+typedef struct gfb_runbox {
+	int16_t x;
+	int16_t y;
+	uint16_t w;
+	uint16_t h;
+} gfb_runbox_t;
+
+/** Text drawn before, kept as the coverage of all its glyphs composited into one strip. */
+typedef struct gfb_run {
+	struct gfb_run *hnext;	/**< Next run in the same hash bucket. */
+	struct gfb_run *prev;	/**< More recently used run. */
+	struct gfb_run *next;	/**< Less recently used run. */
+	uint32_t hash;			/**< Hash of the font, size and text. */
+	gfb_font_id fontid;		/**< Font the run was rendered from. */
+	uint8_t ptsize;			/**< Point size the run was rendered at. */
+	uint8_t codes;			/**< Non-zero if the key holds code points, zero if it holds UTF-8. */
+	size_t keysize;			/**< Number of bytes in pkey[]. */
+	int left;				/**< Pixels from the pen start to the left edge of the strip. */
+	int top;				/**< Pixels from the baseline up to the top edge of the strip. */
+	int w;					/**< Width of the strip in pixels. */
+	int h;					/**< Height of the strip in pixels. */
+	uint32_t nboxes;		/**< Number of items in pboxes[]. */
+	size_t size;			/**< Bytes allocated for the run. */
+	gfb_runbox_t *pboxes;	/**< Glyph boxes, the rest of the strip is never drawn. */
+	uint8_t *pcoverage;		/**< Coverage strip as rows of w bytes. */
+	uint8_t *pkey;			/**< Copy of the text the run was rendered from. */
+} gfb_run_t;
+
+/** Recently drawn runs of text, bounded by a memory budget. */
+typedef struct gfb_runcache {
+	size_t budget;									/**< Bytes for all runs together, 0 disables the cache. */
+	size_t bytes;									/**< Bytes held by cached runs. */
+	size_t count;									/**< Number of cached runs. */
+	gfb_run_t *pbuckets[GFB_RUNCACHE_BUCKETS];		/**< First run of each hash bucket. */
+	gfb_run_t *head;								/**< Most recently used run. */
+	gfb_run_t *tail;								/**< Least recently used run, evicted first. */
+	uint32_t seen[GFB_RUNCACHE_SEEN];				/**< Hashes of strings drawn once but not cached. */
+	uint64_t hits;									/**< Runs drawn from the cache. */
+	uint64_t misses;								/**< Runs drawn glyph by glyph. */
+	uint64_t evictions;								/**< Runs dropped to make room. */
+} gfb_runcache_t;
+
+/** The text run cache, protected by the glyph cache lock. */
+static gfb_runcache_t gfb_runcache = { .budget = GFB_RUNCACHE_BYTES };
+
+/** Drop a run from the cache and free it. */
+static void gfb_run_evict(gfb_run_t *prun) {
+	gfb_runcache_t *pcache = &gfb_runcache;
+	gfb_run_t **pp = &pcache->pbuckets[prun->hash & (GFB_RUNCACHE_BUCKETS - 1)];
+
+	while (*pp != prun) pp = &(*pp)->hnext;
+	*pp = prun->hnext;
+
+	if (prun->prev != NULL) prun->prev->next = prun->next; else pcache->head = prun->next;
+	if (prun->next != NULL) prun->next->prev = prun->prev; else pcache->tail = prun->prev;
+
+	pcache->bytes -= prun->size;
+	pcache->count--;
+	free(prun);
+}
+
+/** Free every cached run. */
+static void gfb_runcache_release(void) {
+	while (gfb_runcache.tail != NULL) gfb_run_evict(gfb_runcache.tail);
+	memset(gfb_runcache.seen, 0, sizeof(gfb_runcache.seen));
+}
+
+/**
+Hash the text of a run and find the number of bytes it spans.
+A UTF-8 string is stepped through count characters or up to its NUL, whichever comes first.
+*/
+static uint32_t gfb_run_hash(gfb_font_id fontid, uint8_t ptsize, const uint8_t *putf8, const uint32_t *pcodes, size_t count, size_t *pkeysize) {
+	const uint8_t *pkey = putf8 != NULL ? putf8 : (const uint8_t *)pcodes;
+	uint32_t h = 2166136261u ^ ((uint32_t)fontid << 8) ^ ptsize ^ (putf8 != NULL ? 0 : 0x80000000u);
+	size_t size;
+
+	if (putf8 != NULL) {
+		const uint8_t *p = putf8;
+		uint32_t code;
+		for (size_t n = 0; n < count && gfb_utf8_next(&p, &code); n++);
+		size = (size_t)(p - putf8);
+	} else {
+		size = count * sizeof(uint32_t);
+	}
+
+	//FNV-1a
+	for (size_t i = 0; i < size; i++) {
+		h = (h ^ pkey[i]) * 16777619u;
+	}
+
+	*pkeysize = size;
+	return h != 0 ? h : 1;
+}
+
+/**
+Lay out the glyphs of a run the same way gfb_textrun() draws them.
+Without a run the box of all the glyphs is found, with one their coverage is copied into its strip.
+@return Returns the number of glyph boxes.
+*/
+static uint32_t gfb_run_layout(gfb_font_id fontid, uint8_t ptsize, const uint8_t *putf8, const uint32_t *pcodes, size_t count, gfb_run_t *prun, gfb_rect_t *pbox) {
+	gfb_glyphinfo_t glyph;
+	uint32_t code, previndex = 0, nboxes = 0;
+	int32_t pen = 0;
+	int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+
+	for (size_t n = 0; n < count; n++) {
+		if (putf8 != NULL) {
+			if (!gfb_utf8_next(&putf8, &code)) break;
+			if (code == 0) continue;
+		} else {
+			code = pcodes[n];
+		}
+
+		if (gfb_glyph_get(fontid, ptsize, code, 1, &glyph) != GFB_OK) continue;
+		pen += gfb_glyph_kerning(fontid, ptsize, previndex, glyph.index);
+		previndex = glyph.index;
+
+		if (glyph.w > 0 && glyph.h > 0) {
+			int gx = (pen >> 6) + glyph.left;
+			int gy = -glyph.top;
+
+			if (prun == NULL) {
+				x1 = gfb_mini(x1, gx);
+				y1 = gfb_mini(y1, gy);
+				x2 = gfb_maxi(x2, gx + glyph.w);
+				y2 = gfb_maxi(y2, gy + glyph.h);
+			} else {
+				//Later glyphs overwrite earlier ones, as they do when drawn one by one.
+				gfb_runbox_t *pbox = &prun->pboxes[nboxes];
+				pbox->x = (int16_t)(gx - prun->left);
+				pbox->y = (int16_t)(gy + prun->top);
+				pbox->w = (uint16_t)glyph.w;
+				pbox->h = (uint16_t)glyph.h;
+				for (int row = 0; row < glyph.h; row++) {
+					memcpy(&prun->pcoverage[(pbox->y + row) * prun->w + pbox->x], &glyph.pcoverage[row * glyph.pitch], glyph.w);
+				}
+			}
+			nboxes++;
+		}
+		pen += glyph.advance;
+	}
+
+	if (pbox != NULL) {
+		if (nboxes == 0) x1 = y1 = x2 = y2 = 0;
+		pbox->x = x1;
+		pbox->y = y1;
+		pbox->w = x2 - x1;
+		pbox->h = y2 - y1;
+	}
+
+	return nboxes;
+}
+
+/** Render a run into a new cache entry, NULL if it is not worth caching. */
+static gfb_run_t *gfb_run_create(gfb_font_id fontid, uint8_t ptsize, const uint8_t *putf8, const uint32_t *pcodes, size_t count, uint32_t hash, size_t keysize) {
+	gfb_runcache_t *pcache = &gfb_runcache;
+	gfb_rect_t box;
+	uint32_t nboxes = gfb_run_layout(fontid, ptsize, putf8, pcodes, count, NULL, &box);
+
+	if (box.w > INT16_MAX || box.h > INT16_MAX) return NULL;
+
+	size_t size = sizeof(gfb_run_t) + nboxes * sizeof(gfb_runbox_t) + (size_t)box.w * box.h + keysize;
+	if (size > pcache->budget / 4) return NULL;
+
+	while (pcache->tail != NULL && pcache->bytes + size > pcache->budget) {
+		gfb_run_evict(pcache->tail);
+		pcache->evictions++;
+	}
+
+	gfb_run_t *prun = malloc(size);
+	if (prun == NULL) return NULL;
+
+	prun->hash = hash;
+	prun->fontid = fontid;
+	prun->ptsize = ptsize;
+	prun->codes = putf8 == NULL;
+	prun->keysize = keysize;
+	prun->left = box.x;
+	prun->top = -box.y;
+	prun->w = box.w;
+	prun->h = box.h;
+	prun->size = size;
+	prun->pboxes = (gfb_runbox_t *)(prun + 1);
+	prun->pcoverage = (uint8_t *)(prun->pboxes + nboxes);
+	prun->pkey = prun->pcoverage + (size_t)box.w * box.h;
+	memcpy(prun->pkey, putf8 != NULL ? putf8 : (const uint8_t *)pcodes, keysize);
+
+	//The glyphs are still cached from the first pass, unless the run alone outgrows the glyph cache.
+	prun->nboxes = gfb_run_layout(fontid, ptsize, putf8, pcodes, count, prun, NULL);
+	if (prun->nboxes != nboxes) {
+		free(prun);
+		return NULL;
+	}
 
-		if (slot->bitmap.width > 0 && slot->bitmap.rows > 0) {
-			/* now, draw to our target surface (convert position) */
-			destrect.x = pen.x / 64;
-			destrect.y = (pen.y / 64) - (slot->metrics.horiBearingY / 64);
-			destrect.w = slot->bitmap.width;
-			destrect.h = slot->bitmap.rows;
+	gfb_run_t **pbucket = &pcache->pbuckets[hash & (GFB_RUNCACHE_BUCKETS - 1)];
+	prun->hnext = *pbucket;
+	*pbucket = prun;
+	prun->prev = NULL;
+	prun->next = pcache->head;
+	if (pcache->head != NULL) pcache->head->prev = prun; else pcache->tail = prun;
+	pcache->head = prun;
+	pcache->bytes += size;
+	pcache->count++;
+
+	return prun;
+}
+
+/**
+Draw text from the run cache, rendering it into the cache the second time it is drawn.
+Called with the glyph cache lock held, which also guards the run cache.
+@return Returns GFB_OK if the text was drawn, otherwise it has to be drawn glyph by glyph,
+also when the run cache is disabled.
+*/
+static int gfb_run_draw(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, const uint8_t *putf8, const uint32_t *pcodes, size_t count, const gfb_color_t *pramp) {
+	gfb_runcache_t *pcache = &gfb_runcache;
+	const uint8_t *pkey = putf8 != NULL ? putf8 : (const uint8_t *)pcodes;
+	size_t keysize;
+	uint32_t hash;
+	gfb_run_t *prun;
+
+	if (pcache->budget == 0) return GFB_ERROR;
+
+	hash = gfb_run_hash(fontid, ptsize, putf8, pcodes, count, &keysize);
+
+	for (prun = pcache->pbuckets[hash & (GFB_RUNCACHE_BUCKETS - 1)]; prun != NULL; prun = prun->hnext) {
+		if (
+			   prun->hash == hash
+			&& prun->fontid == fontid
+			&& prun->ptsize == ptsize
+			&& prun->codes == (putf8 == NULL)
+			&& prun->keysize == keysize
+			&& memcmp(prun->pkey, pkey, keysize) == 0
+		) {
+			break;
+		}
+	}
+
+	if (prun != NULL) {
+		if (prun != pcache->head) {
+			prun->prev->next = prun->next;
+			if (prun->next != NULL) prun->next->prev = prun->prev; else pcache->tail = prun->prev;
+			prun->prev = NULL;
+			prun->next = pcache->head;
+			pcache->head->prev = prun;
+			pcache->head = prun;
+		}
+		pcache->hits++;
+	} else {
+		uint32_t *pseen = &pcache->seen[hash % GFB_RUNCACHE_SEEN];
+
+		pcache->misses++;
+		if (*pseen != hash) {
+			//Text that changes every frame never gets past here.
+			*pseen = hash;
+			return GFB_ERROR;
+		}
+		*pseen = 0;
+		if ((prun = gfb_run_create(fontid, ptsize, putf8, pcodes, count, hash, keysize)) == NULL) return GFB_ERROR;
+	}
+
+	for (uint32_t i = 0; i < prun->nboxes; i++) {
+		const gfb_runbox_t *pbox = &prun->pboxes[i];
+		gfb_glyphinfo_t glyph = {
+			.pcoverage = &prun->pcoverage[pbox->y * prun->w + pbox->x],
+			.pitch = prun->w,
+			.w = pbox->w,
+			.h = pbox->h
+		};
+		gfb_glyphblit(psurface, x + prun->left + pbox->x, y - prun->top + pbox->y, &glyph, pramp);
+	}
 
-			srcrect.x = 0;
-			srcrect.y = 0;
-			srcrect.w = slot->bitmap.width;
-			srcrect.h = slot->bitmap.rows-1;
+	return GFB_OK;
+}
+
+/**
+Render glyphs from either a UTF-8 string or an array of code points.
+Text drawn before is blitted from the run cache. Otherwise the string is decoded one character ahead of
+the glyph lookup, nothing is buffered. The glyph cache lock is held per glyph so other threads can draw
+in between.
+*/
+static inline __attribute__((always_inline)) int gfb_textrun(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, const uint8_t *putf8, const uint32_t *pcodes, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	unsigned int bpp = pformat->bytesperpixel;
+	gfb_color_t ramp[256];
+	gfb_glyphinfo_t glyph;
+	uint32_t code;
+	uint32_t previndex = 0;
+
+	//Every coverage value blended once, glyph pixels are then a table lookup.
+	for (int i = 0; i < 256; i++) {
+		ramp[i] = gfb_blendcolor(colorf, colorb, (uint8_t)i, pformat, bpp);
+	}
+	ramp[255] = colorf;
+
+	//A run keeps only the last glyph's coverage where boxes overlap, blending those pixels once per glyph needs every glyph.
+	if (!(psurface->flags & GFB_TRANSPARENTTEXT)) {
+		gfb_glyphcache_lock();
+		int rc = gfb_run_draw(psurface, fontid, ptsize, x, y, putf8, pcodes, count, ramp);
+		gfb_glyphcache_unlock();
+		if (rc == GFB_OK) return GFB_OK;
+	}
+
+	/* the pen position in 26.6 cartesian space coordinates; */
+	/* start at (x,y) relative to the upper left corner  */
+	int32_t penx = x * 64;
 
-			gfb_ftbitmapblit( psurface, &destrect, &slot->bitmap, &srcrect, colorf, colorb);
+	size_t n;
+	for ( n = 0; n < count; n++ ) {
+		if (putf8 != NULL) {
+			if (!gfb_utf8_next(&putf8, &code)) break;
+			if (code == 0) continue;
+		} else {
+			code = pcodes[n];
 		}
 
-		/* increment pen position */
-		pen.x += slot->advance.x;
-		pen.y += slot->advance.y;
+		gfb_glyphcache_lock();
+		if (gfb_glyph_get(fontid, ptsize, code, 1, &glyph) == GFB_OK) {
+			penx += gfb_glyph_kerning(fontid, ptsize, previndex, glyph.index);
+			previndex = glyph.index;
+			if (glyph.w > 0 && glyph.h > 0) {
+				gfb_glyphblit(psurface, (penx >> 6) + glyph.left, y - glyph.top, &glyph, ramp);
+			}
+
+			/* increment pen position */
+			penx += glyph.advance;
+		}
+		gfb_glyphcache_unlock();
 	}
 
 	return GFB_OK;
 }
 
+GFB_TEXT(gfb_soft_text) {
+	return gfb_textrun(psurface, fontid, ptsize, x, y, (const uint8_t *)pzutf8, NULL, count, colorf, colorb);
+}
+
+GFB_TEXTU(gfb_soft_textu) {
+	return gfb_textrun(psurface, fontid, ptsize, x, y, NULL, pcodes, count, colorf, colorb);
+}
+
 /** Map of software drawing operations. */
 gfb_devop_t gfb_soft_devops = {
 	.putpixel       = gfb_soft_putpixel,
@@ -884,9 +3402,20 @@ gfb_devop_t gfb_soft_devops = {
 	.circle         = gfb_soft_circle,
 	.filledrectangle= gfb_soft_filledrectangle,
 	.filledcircle   = gfb_soft_filledcircle,
+	.ellipse        = gfb_soft_ellipse,
+	.filledellipse  = gfb_soft_filledellipse,
 	.polygon		= gfb_soft_polygon,
+	.filledpolygon	= gfb_soft_filledpolygon,
 	.floodfill		= gfb_soft_floodfill,
-	.text			= gfb_soft_text
+	.line_aa		= gfb_soft_line_aa,
+	.circle_aa		= gfb_soft_circle_aa,
+	.filledcircle_aa= gfb_soft_filledcircle_aa,
+	.points			= gfb_soft_points,
+	.lines			= gfb_soft_lines,
+	.rects			= gfb_soft_rects,
+	.filledrects	= gfb_soft_filledrects,
+	.text			= gfb_soft_text,
+	.textu			= gfb_soft_textu
 };
 
 
@@ -939,6 +3468,7 @@ int gfb_surface_create(gfb_surface_t **ppsurface, int width, int height, gfb_pix
 	}
 
 	(*ppsurface)->flags = flags;
+	(*ppsurface)->drawalpha = 255;
 
 	(*ppsurface)->pformat = &gfb_pixelformats[format];
 
@@ -1222,7 +3752,7 @@ gfb_color_t gfb_maprgba(gfb_surface_t *psurface, uint8_t red, uint8_t green, uin
 	    case GFB_PIXELFORMAT_RGB32: //8.8.8.0.8
 	        return GFB_MAP_PIXELFORMAT_32BIT_RGB(red, green, blue);
 	    case GFB_PIXELFORMAT_ARGB32://8.8.8.8.0
-	        return GFB_MAP_PIXELFORMAT_32BIT_ARGB(alpha, red, green, blue);
+	        return GFB_MAP_PIXELFORMAT_32BIT_ARGB((uint32_t)alpha, red, green, blue);
 
 	    default:
 	        return 0;
@@ -1241,7 +3771,16 @@ int gfb_setcliprect(gfb_surface_t *psurface, gfb_rect_t *prect) {
 	    psurface->cliprect.w = psurface->w;
 	    psurface->cliprect.h = psurface->h;
 	} else {
-	    memcpy(&psurface->cliprect, prect, sizeof(gfb_rect_t));
+		//Keep the cliprect inside the surface, primitives index the pixel buffer directly.
+		int x1 = gfb_maxi(prect->x, 0);
+		int y1 = gfb_maxi(prect->y, 0);
+		int x2 = gfb_mini(prect->x + prect->w, psurface->w);
+		int y2 = gfb_mini(prect->y + prect->h, psurface->h);
+
+		psurface->cliprect.x = x1;
+		psurface->cliprect.y = y1;
+		psurface->cliprect.w = gfb_maxi(x2 - x1, 0);
+		psurface->cliprect.h = gfb_maxi(y2 - y1, 0);
 	}
 
 	return GFB_OK;
@@ -1257,6 +3796,31 @@ int gfb_setcolorkey(gfb_surface_t *psurface, gfb_color_t colorkey) {
 }
 
 
+int gfb_setdrawalpha(gfb_surface_t *psurface, uint8_t alpha) {
+	if (psurface == NULL) return GFB_EARGUMENT;
+
+	psurface->drawalpha = alpha;
+	if (alpha == 255) {
+		psurface->flags &= ~GFB_DRAWBLEND;
+	} else {
+		psurface->flags |= GFB_DRAWBLEND;
+	}
+
+	return GFB_OK;
+}
+
+int gfb_settransparenttext(gfb_surface_t *psurface, int enable) {
+	if (psurface == NULL) return GFB_EARGUMENT;
+
+	if (enable) {
+		psurface->flags |= GFB_TRANSPARENTTEXT;
+	} else {
+		psurface->flags &= ~GFB_TRANSPARENTTEXT;
+	}
+
+	return GFB_OK;
+}
+
 int gfb_setalpha(gfb_surface_t *psurface, uint8_t alpha) {
 	if (psurface == NULL) return GFB_EARGUMENT;
 
@@ -1314,15 +3878,20 @@ int gfb_flip(gfb_surface_t *psurface) {
 
 int gfb_clear(gfb_surface_t *psurface) {
 	if (psurface == NULL) return GFB_EARGUMENT;
-	return psurface->op->clear(psurface);
+	return psurface->op->clear(psurface, 0x00000000);
+}
+
+int gfb_clear_color(gfb_surface_t *psurface, gfb_color_t color) {
+	if (psurface == NULL) return GFB_EARGUMENT;
+	return psurface->op->clear(psurface, color);
 }
 
 int gfb_line(gfb_surface_t *psurface, int x1, int y1, int x2, int y2, gfb_color_t color) {
 	if (psurface == NULL) return GFB_EARGUMENT;
-	x1 = gfb_clampi(x1, psurface->cliprect.x, psurface->cliprect.x + psurface->cliprect.w);
-	x2 = gfb_clampi(x2, psurface->cliprect.x, psurface->cliprect.x + psurface->cliprect.w);
-	y1 = gfb_clampi(y1, psurface->cliprect.y, psurface->cliprect.y + psurface->cliprect.h);
-	y2 = gfb_clampi(y2, psurface->cliprect.y, psurface->cliprect.y + psurface->cliprect.h);
+
+	//Clip analytically so the slope is kept, lines entirely outside cost nothing.
+	if (!gfb_clipline(&psurface->cliprect, &x1, &y1, &x2, &y2)) return GFB_OK;
+
 	return psurface->op->line(psurface, x1, y1, x2, y2, color);
 }
 
@@ -1360,33 +3929,111 @@ int gfb_filledrectangle(gfb_surface_t *psurface, gfb_rect_t *prect, gfb_color_t
 	return psurface->op->filledrectangle(psurface, &rect, colorb);
 }
 
-int gfb_circle(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t color) {
-	int t, l, r, b;
+/**
+Test if the box of a circle or ellipse misses a cliprect, in 64 bits so any int center and radius fit.
+@param pclip Pointer to the cliprect.
+@param x Left pixel position of the center.
+@param y Top pixel position of the center.
+@param rx Horizontal reach from the center.
+@param ry Vertical reach from the center.
+@return Non-zero if no pixel of the box is inside the cliprect.
+*/
+static inline int gfb_boxoutside(const gfb_rect_t *pclip, int x, int y, int64_t rx, int64_t ry) {
+	return
+		   x + rx < pclip->x || x - rx >= (int64_t)pclip->x + pclip->w
+		|| y + ry < pclip->y || y - ry >= (int64_t)pclip->y + pclip->h;
+}
 
-	if (psurface == NULL) return GFB_EARGUMENT;
+int gfb_circle(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t color) {
+	if (psurface == NULL || radius < 0) return GFB_EARGUMENT;
 
-	t = y - radius;
-	b = y + radius;
-	l = x - radius;
-	r = x + radius;
-
-	if (   (l < psurface->cliprect.x || r >= (psurface->cliprect.x + psurface->cliprect.w))
-	    || (t < psurface->cliprect.y || b >= (psurface->cliprect.y + psurface->cliprect.h))
-	) return GFB_EARGUMENT;
+	//Spans are clipped individually, only skip circles entirely outside the cliprect.
+	if (gfb_boxoutside(&psurface->cliprect, x, y, radius, radius)) return GFB_OK;
 
 	return psurface->op->circle(psurface, x, y, radius, color);
 }
 
 int gfb_filledcircle(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t colorf, gfb_color_t colorb) {
-	if (
-		psurface == NULL
-		|| ((x - radius) < psurface->cliprect.x || (x + radius) >= (psurface->cliprect.x + psurface->cliprect.w))
-		|| ((y - radius) < psurface->cliprect.y || (y + radius) >= (psurface->cliprect.y + psurface->cliprect.h))
-	) return GFB_EARGUMENT;
+	if (psurface == NULL || radius < 0) return GFB_EARGUMENT;
+
+	if (gfb_boxoutside(&psurface->cliprect, x, y, radius, radius)) return GFB_OK;
 
 	return psurface->op->filledcircle(psurface, x, y, radius, colorf, colorb);
 }
 
+int gfb_ellipse(gfb_surface_t *psurface, int x, int y, int rx, int ry, gfb_color_t color) {
+	if (psurface == NULL || rx < 0 || ry < 0) return GFB_EARGUMENT;
+
+	if (gfb_boxoutside(&psurface->cliprect, x, y, rx, ry)) return GFB_OK;
+
+	return psurface->op->ellipse(psurface, x, y, rx, ry, color);
+}
+
+int gfb_filledellipse(gfb_surface_t *psurface, int x, int y, int rx, int ry, gfb_color_t colorf, gfb_color_t colorb) {
+	if (psurface == NULL || rx < 0 || ry < 0) return GFB_EARGUMENT;
+
+	if (gfb_boxoutside(&psurface->cliprect, x, y, rx, ry)) return GFB_OK;
+
+	return psurface->op->filledellipse(psurface, x, y, rx, ry, colorf, colorb);
+}
+
+int gfb_line_aa(gfb_surface_t *psurface, int x1, int y1, int x2, int y2, gfb_color_t color) {
+	if (psurface == NULL) return GFB_EARGUMENT;
+
+	if (!gfb_clipline(&psurface->cliprect, &x1, &y1, &x2, &y2)) return GFB_OK;
+
+	return psurface->op->line_aa(psurface, x1, y1, x2, y2, color);
+}
+
+int gfb_circle_aa(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t color) {
+	if (psurface == NULL || radius < 0) return GFB_EARGUMENT;
+
+	//The smoothed outline reaches one pixel past the radius.
+	if (gfb_boxoutside(&psurface->cliprect, x, y, (int64_t)radius + 1, (int64_t)radius + 1)) return GFB_OK;
+
+	return psurface->op->circle_aa(psurface, x, y, radius, color);
+}
+
+int gfb_filledcircle_aa(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t color) {
+	if (psurface == NULL || radius < 0) return GFB_EARGUMENT;
+
+	if (gfb_boxoutside(&psurface->cliprect, x, y, radius, radius)) return GFB_OK;
+
+	return psurface->op->filledcircle_aa(psurface, x, y, radius, color);
+}
+
+int gfb_points(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color) {
+	if (psurface == NULL || (ppoints == NULL && count != 0)) return GFB_EARGUMENT;
+
+	if (count == 0) return GFB_OK;
+
+	return psurface->op->points(psurface, ppoints, count, color);
+}
+
+int gfb_lines(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color) {
+	if (psurface == NULL || (ppoints == NULL && count != 0) || (count & 1)) return GFB_EARGUMENT;
+
+	if (count == 0) return GFB_OK;
+
+	return psurface->op->lines(psurface, ppoints, count, color);
+}
+
+int gfb_rects(gfb_surface_t *psurface, gfb_rect_t *prects, size_t count, gfb_color_t color) {
+	if (psurface == NULL || (prects == NULL && count != 0)) return GFB_EARGUMENT;
+
+	if (count == 0) return GFB_OK;
+
+	return psurface->op->rects(psurface, prects, count, color);
+}
+
+int gfb_filledrects(gfb_surface_t *psurface, gfb_rect_t *prects, size_t count, gfb_color_t colorb) {
+	if (psurface == NULL || (prects == NULL && count != 0)) return GFB_EARGUMENT;
+
+	if (count == 0) return GFB_OK;
+
+	return psurface->op->filledrects(psurface, prects, count, colorb);
+}
+
 int gfb_polygon(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color) {
 	if (psurface == NULL || ppoints == NULL || count < 3) {
 		return GFB_EARGUMENT;
@@ -1395,43 +4042,482 @@ int gfb_polygon(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count
 	return psurface->op->polygon(psurface, ppoints, count, color);
 }
 
+int gfb_filledpolygon(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color, gfb_fillrule_t rule) {
+	if (psurface == NULL || ppoints == NULL || count < 3 || (rule != GFB_FILL_EVENODD && rule != GFB_FILL_NONZERO)) {
+		return GFB_EARGUMENT;
+	}
+
+	return psurface->op->filledpolygon(psurface, ppoints, count, color, rule);
+}
+
 int gfb_floodfill(gfb_surface_t *psurface, int x, int y, gfb_color_t color) {
 	if (psurface == NULL || x < psurface->cliprect.x || x >= (psurface->cliprect.x + psurface->cliprect.w) || y < psurface->cliprect.y || y >= (psurface->cliprect.y + psurface->cliprect.h)) {
 		return GFB_EARGUMENT;
 	}
 
-	psurface->op->floodfill(psurface, x, y, color);
+	return psurface->op->floodfill(psurface, x, y, color, 0);
+}
+
+int gfb_floodfill_tolerance(gfb_surface_t *psurface, int x, int y, gfb_color_t color, uint8_t tolerance) {
+	if (psurface == NULL || x < psurface->cliprect.x || x >= (psurface->cliprect.x + psurface->cliprect.w) || y < psurface->cliprect.y || y >= (psurface->cliprect.y + psurface->cliprect.h)) {
+		return GFB_EARGUMENT;
+	}
+
+	return psurface->op->floodfill(psurface, x, y, color, tolerance);
+}
+
+int gfb_path_create(gfb_path_t *ppath) {
+	if (ppath == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	memset(ppath, 0, sizeof(gfb_path_t));
+	ppath->tolerance = GFB_PATH_TOLERANCE;
+
 	return GFB_OK;
 }
 
-gfb_font_id gfb_ttf_load_memory(uint8_t *pttf, size_t ttfsize) {
-	if (pttf == NULL || ttfsize == 0) {
+void gfb_path_destroy(gfb_path_t *ppath) {
+	if (ppath == NULL) {
+		return;
+	}
+
+	free(ppath->ppoints);
+	free(ppath->pcontours);
+	free(ppath->pcells);
+	memset(ppath, 0, sizeof(gfb_path_t));
+}
+
+void gfb_path_reset(gfb_path_t *ppath) {
+	if (ppath == NULL) {
+		return;
+	}
+
+	ppath->count = 0;
+	ppath->ncontours = 0;
+}
+
+int gfb_path_moveto(gfb_path_t *ppath, float x, float y) {
+	int rc;
+
+	if (ppath == NULL || !isfinite(x) || !isfinite(y)) {
 		return GFB_EARGUMENT;
 	}
 
-	//Find free slot in the font store.
-	int i;
-	for (i = 0; i < MAX_GFB_FONT; i++) {
-		if (gfb_fontstore[i] == NULL) {
-			break;
+	//A contour holding only its start point is moved rather than left behind as a dot.
+	if (ppath->ncontours > 0 && ppath->pcontours[ppath->ncontours - 1].count == 1 && !ppath->pcontours[ppath->ncontours - 1].closed) {
+		ppath->ppoints[ppath->count - 1].x = x;
+		ppath->ppoints[ppath->count - 1].y = y;
+		return GFB_OK;
+	}
+
+	if (ppath->ncontours == ppath->contoursize) {
+		size_t size = ppath->contoursize ? ppath->contoursize * 2 : 8;
+		gfb_contour_t *pcontours = realloc(ppath->pcontours, size * sizeof(gfb_contour_t));
+		if (pcontours == NULL) return GFB_ENOMEM;
+		ppath->pcontours = pcontours;
+		ppath->contoursize = size;
+	}
+	if ((rc = gfb_path_reserve(ppath, 1)) != GFB_OK) {
+		return rc;
+	}
+
+	gfb_contour_t *pcontour = &ppath->pcontours[ppath->ncontours++];
+	pcontour->first = ppath->count;
+	pcontour->count = 0;
+	pcontour->closed = 0;
+	gfb_path_push(ppath, x, y);
+
+	return GFB_OK;
+}
+
+int gfb_path_lineto(gfb_path_t *ppath, float x, float y) {
+	int rc;
+
+	if (ppath == NULL || !isfinite(x) || !isfinite(y)) {
+		return GFB_EARGUMENT;
+	}
+	if (ppath->ncontours == 0) {
+		return gfb_path_moveto(ppath, x, y);
+	}
+	if ((rc = gfb_path_begin(ppath, 1)) != GFB_OK) {
+		return rc;
+	}
+
+	gfb_path_push(ppath, x, y);
+
+	return GFB_OK;
+}
+
+int gfb_path_quadto(gfb_path_t *ppath, float cx, float cy, float x, float y) {
+	float x0 = 0.0f, y0 = 0.0f;
+	int rc;
+
+	if (ppath == NULL || !isfinite(cx) || !isfinite(cy) || !isfinite(x) || !isfinite(y) || !(ppath->tolerance > 0.0f)) {
+		return GFB_EARGUMENT;
+	}
+	if (ppath->ncontours == 0 && (rc = gfb_path_moveto(ppath, cx, cy)) != GFB_OK) {
+		return rc;
+	}
+	gfb_path_current(ppath, &x0, &y0);
+
+	//Deviation from the chord is at most |p0 - 2p1 + p2| / (4n^2) with n lines.
+	float ddx = x0 - 2.0f * cx + x, ddy = y0 - 2.0f * cy + y;
+	int n = gfb_path_steps(sqrtf(ddx * ddx + ddy * ddy), ppath->tolerance);
+	if ((rc = gfb_path_begin(ppath, n)) != GFB_OK) {
+		return rc;
+	}
+
+	for (int i = 1; i < n; i++) {
+		float t = (float)i / (float)n, mt = 1.0f - t;
+		gfb_path_push(ppath, mt * mt * x0 + 2.0f * mt * t * cx + t * t * x, mt * mt * y0 + 2.0f * mt * t * cy + t * t * y);
+	}
+	gfb_path_push(ppath, x, y);
+
+	return GFB_OK;
+}
+
+int gfb_path_cubicto(gfb_path_t *ppath, float cx1, float cy1, float cx2, float cy2, float x, float y) {
+	float x0 = 0.0f, y0 = 0.0f;
+	int rc;
+
+	if (ppath == NULL || !isfinite(cx1) || !isfinite(cy1) || !isfinite(cx2) || !isfinite(cy2) || !isfinite(x) || !isfinite(y) || !(ppath->tolerance > 0.0f)) {
+		return GFB_EARGUMENT;
+	}
+	if (ppath->ncontours == 0 && (rc = gfb_path_moveto(ppath, cx1, cy1)) != GFB_OK) {
+		return rc;
+	}
+	gfb_path_current(ppath, &x0, &y0);
+
+	//Deviation from the chord is at most 3 * max|p(i) - 2p(i+1) + p(i+2)| / (4n^2) with n lines.
+	float ax = x0 - 2.0f * cx1 + cx2, ay = y0 - 2.0f * cy1 + cy2;
+	float bx = cx1 - 2.0f * cx2 + x, by = cy1 - 2.0f * cy2 + y;
+	float dd = sqrtf(fmaxf(ax * ax + ay * ay, bx * bx + by * by));
+	int n = gfb_path_steps(3.0f * dd, ppath->tolerance);
+	if ((rc = gfb_path_begin(ppath, n)) != GFB_OK) {
+		return rc;
+	}
+
+	for (int i = 1; i < n; i++) {
+		float t = (float)i / (float)n, mt = 1.0f - t;
+		float a = mt * mt * mt, b = 3.0f * mt * mt * t, c = 3.0f * mt * t * t, d = t * t * t;
+		gfb_path_push(ppath, a * x0 + b * cx1 + c * cx2 + d * x, a * y0 + b * cy1 + c * cy2 + d * y);
+	}
+	gfb_path_push(ppath, x, y);
+
+	return GFB_OK;
+}
+
+int gfb_path_arc(gfb_path_t *ppath, float cx, float cy, float radius, float start, float end) {
+	int rc;
+
+	if (ppath == NULL || !isfinite(cx) || !isfinite(cy) || !isfinite(start) || !isfinite(end) || !(radius >= 0.0f) || !isfinite(radius) || !(ppath->tolerance > 0.0f)) {
+		return GFB_EARGUMENT;
+	}
+
+	//Each line of n spans an angle of at most 2 * acos(1 - tolerance / radius).
+	float sweep = end - start;
+	int n = 1;
+	if (radius > ppath->tolerance) {
+		float steps = ceilf(fabsf(sweep) / (2.0f * acosf(1.0f - ppath->tolerance / radius)));
+		n = steps > (float)GFB_PATH_MAXSTEPS ? GFB_PATH_MAXSTEPS : (steps < 1.0f ? 1 : (int)steps);
+	}
+
+	if ((rc = gfb_path_lineto(ppath, cx + radius * cosf(start), cy + radius * sinf(start))) != GFB_OK) {
+		return rc;
+	}
+	if ((rc = gfb_path_begin(ppath, n)) != GFB_OK) {
+		return rc;
+	}
+
+	for (int i = 1; i <= n; i++) {
+		float a = start + sweep * (float)i / (float)n;
+		gfb_path_push(ppath, cx + radius * cosf(a), cy + radius * sinf(a));
+	}
+
+	return GFB_OK;
+}
+
+int gfb_path_roundrect(gfb_path_t *ppath, float x, float y, float w, float h, float radius) {
+	const float pi = GFB_PI;
+	int rc;
+
+	if (ppath == NULL || !(w >= 0.0f) || !(h >= 0.0f) || !(radius >= 0.0f)) {
+		return GFB_EARGUMENT;
+	}
+
+	if (radius > 0.5f * w) radius = 0.5f * w;
+	if (radius > 0.5f * h) radius = 0.5f * h;
+
+	if ((rc = gfb_path_moveto(ppath, x + radius, y)) != GFB_OK) return rc;
+	if ((rc = gfb_path_arc(ppath, x + w - radius, y + radius, radius, -0.5f * pi, 0.0f)) != GFB_OK) return rc;
+	if ((rc = gfb_path_arc(ppath, x + w - radius, y + h - radius, radius, 0.0f, 0.5f * pi)) != GFB_OK) return rc;
+	if ((rc = gfb_path_arc(ppath, x + radius, y + h - radius, radius, 0.5f * pi, pi)) != GFB_OK) return rc;
+	if ((rc = gfb_path_arc(ppath, x + radius, y + radius, radius, pi, 1.5f * pi)) != GFB_OK) return rc;
+
+	return gfb_path_close(ppath);
+}
+
+int gfb_path_close(gfb_path_t *ppath) {
+	if (ppath == NULL) {
+		return GFB_EARGUMENT;
+	}
+	if (ppath->ncontours == 0) {
+		return GFB_OK;
+	}
+
+	gfb_contour_t *pcontour = &ppath->pcontours[ppath->ncontours - 1];
+	const gfb_pointf_t *pfirst = &ppath->ppoints[pcontour->first];
+	const gfb_pointf_t *plast = &ppath->ppoints[ppath->count - 1];
+
+	//The closing line is implicit, drop an explicit copy of the first point.
+	if (pcontour->count > 1 && pfirst->x == plast->x && pfirst->y == plast->y) {
+		pcontour->count--;
+		ppath->count--;
+	}
+	pcontour->closed = 1;
+
+	return GFB_OK;
+}
+
+int gfb_path_fill(gfb_surface_t *psurface, gfb_path_t *ppath, gfb_color_t color) {
+	if (psurface == NULL || ppath == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	return gfb_path_render(psurface, ppath, 1, 0.0f, 0, color, NULL);
+}
+
+int gfb_path_stroke(gfb_surface_t *psurface, gfb_path_t *ppath, float width, gfb_color_t color) {
+	if (psurface == NULL || ppath == NULL || !(width > 0.0f) || !isfinite(width) || !(ppath->tolerance > 0.0f)) {
+		return GFB_EARGUMENT;
+	}
+
+	return gfb_path_render(psurface, ppath, 0, width, color, 0, NULL);
+}
+
+int gfb_path_fillstroke(gfb_surface_t *psurface, gfb_path_t *ppath, float width, gfb_color_t colorf, gfb_color_t colorb) {
+	if (psurface == NULL || ppath == NULL || !(width > 0.0f) || !isfinite(width) || !(ppath->tolerance > 0.0f)) {
+		return GFB_EARGUMENT;
+	}
+
+	return gfb_path_render(psurface, ppath, 1, width, colorf, colorb, NULL);
+}
+
+/** Rebuild the color table of a gradient from its stops. */
+static void gfb_gradient_build(gfb_gradient_t *pgradient) {
+	const gfb_gradientstop_t *pstops = pgradient->stops;
+	size_t n = pgradient->nstops;
+	size_t s = 0;
+
+	for (int i = 0; i < 256; i++) {
+		float t = (float)i / 255.0f;
+		const gfb_gradientstop_t *pa, *pb;
+		float f = 0.0f;
+
+		while (s + 1 < n && pstops[s + 1].offset <= t) s++;
+		pa = &pstops[s];
+		pb = s + 1 < n ? &pstops[s + 1] : pa;
+		if (t > pa->offset && pb->offset > pa->offset) f = (t - pa->offset) / (pb->offset - pa->offset);
+		if (t < pa->offset) f = 0.0f;
+
+		uint32_t red = (uint32_t)(pa->red + (pb->red - pa->red) * f + 0.5f);
+		uint32_t green = (uint32_t)(pa->green + (pb->green - pa->green) * f + 0.5f);
+		uint32_t blue = (uint32_t)(pa->blue + (pb->blue - pa->blue) * f + 0.5f);
+		uint32_t alpha = (uint32_t)(pa->alpha + (pb->alpha - pa->alpha) * f + 0.5f);
+		pgradient->lut[i] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+	}
+}
+
+int gfb_gradient_linear(gfb_gradient_t *pgradient, float x0, float y0, float x1, float y1) {
+	if (pgradient == NULL || !isfinite(x0) || !isfinite(y0) || !isfinite(x1) || !isfinite(y1)) {
+		return GFB_EARGUMENT;
+	}
+
+	memset(pgradient, 0, sizeof(gfb_gradient_t));
+	pgradient->type = GFB_GRADIENT_LINEAR;
+	pgradient->x0 = x0;
+	pgradient->y0 = y0;
+	pgradient->x1 = x1;
+	pgradient->y1 = y1;
+
+	return GFB_OK;
+}
+
+int gfb_gradient_radial(gfb_gradient_t *pgradient, float cx, float cy, float radius) {
+	if (pgradient == NULL || !isfinite(cx) || !isfinite(cy) || !(radius > 0.0f) || !isfinite(radius)) {
+		return GFB_EARGUMENT;
+	}
+
+	memset(pgradient, 0, sizeof(gfb_gradient_t));
+	pgradient->type = GFB_GRADIENT_RADIAL;
+	pgradient->x0 = cx;
+	pgradient->y0 = cy;
+	pgradient->radius = radius;
+
+	return GFB_OK;
+}
+
+int gfb_gradient_addstop(gfb_gradient_t *pgradient, float offset, uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) {
+	if (pgradient == NULL || !(offset >= 0.0f && offset <= 1.0f)) {
+		return GFB_EARGUMENT;
+	}
+	if (pgradient->nstops >= MAX_GFB_GRADIENT_STOPS) {
+		return GFB_ENOMEM;
+	}
+
+	//Keep the stops sorted, a stop at an existing offset goes after it for a hard edge.
+	size_t i = pgradient->nstops;
+	while (i > 0 && pgradient->stops[i - 1].offset > offset) {
+		pgradient->stops[i] = pgradient->stops[i - 1];
+		i--;
+	}
+	pgradient->stops[i].offset = offset;
+	pgradient->stops[i].red = red;
+	pgradient->stops[i].green = green;
+	pgradient->stops[i].blue = blue;
+	pgradient->stops[i].alpha = alpha;
+	pgradient->nstops++;
+
+	gfb_gradient_build(pgradient);
+
+	return GFB_OK;
+}
+
+int gfb_gradient_fillrect(gfb_surface_t *psurface, gfb_rect_t *prect, const gfb_gradient_t *pgradient) {
+	if (psurface == NULL || pgradient == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	gfb_rect_t rect = prect != NULL ? *prect : *pclip;
+	int y1 = gfb_maxi(rect.y, pclip->y);
+	int y2 = gfb_mini(rect.y + rect.h, pclip->y + pclip->h - 1);
+	gfb_paint_t paint;
+
+	gfb_paint_init(&paint, psurface, pgradient);
+	for (int y = y1; y <= y2; y++) {
+		gfb_fillspan_paint(psurface, &paint, rect.x, rect.x + rect.w, y, 0);
+	}
+
+	return GFB_OK;
+}
+
+int gfb_gradient_fillpolygon(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, const gfb_gradient_t *pgradient, gfb_fillrule_t rule) {
+	if (psurface == NULL || ppoints == NULL || count < 3 || pgradient == NULL || (rule != GFB_FILL_EVENODD && rule != GFB_FILL_NONZERO)) {
+		return GFB_EARGUMENT;
+	}
+
+	gfb_paint_t paint;
+	int rc;
+
+	//Always the software scan converter, device polygon fills only take a color.
+	gfb_paint_init(&paint, psurface, pgradient);
+	rc = gfb_polygon_fill(psurface, ppoints, count, 0, rule, &paint);
+
+	return rc;
+}
+
+int gfb_gradient_fillpath(gfb_surface_t *psurface, gfb_path_t *ppath, const gfb_gradient_t *pgradient) {
+	if (psurface == NULL || ppath == NULL || pgradient == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	gfb_paint_t paint;
+	int rc;
+
+	gfb_paint_init(&paint, psurface, pgradient);
+	rc = gfb_path_render(psurface, ppath, 1, 0.0f, 0, 0, &paint);
+
+	return rc;
+}
+
+/** Drop the glyphs and text runs of a font from the caches, the font id is about to be reused. */
+static void gfb_font_forget(gfb_font_id fontid) {
+	gfb_glyphcache_t *pcache = &gfb_glyphcache;
+	uint32_t i = pcache->pslots != NULL ? pcache->head : GFB_GLYPH_NONE;
+
+	while (i != GFB_GLYPH_NONE) {
+		uint32_t next = pcache->pslots[i].next;
+		if (pcache->pslots[i].fontid == fontid) gfb_glyph_evict(i);
+		i = next;
+	}
+
+	gfb_run_t *prun = gfb_runcache.head;
+	while (prun != NULL) {
+		gfb_run_t *pnext = prun->next;
+		if (prun->fontid == fontid) gfb_run_evict(prun);
+		prun = pnext;
+	}
+}
+
+/** Take a reference to a loaded font so its face outlives gfb_ttf_unload(), called with the glyph cache lock held. */
+static int gfb_font_ref(gfb_font_id fontid) {
+	if (gfb_font_loaded(fontid) == NULL) return GFB_EARGUMENT;
+
+	gfb_font_entry(fontid)->refs++;
+
+	return GFB_OK;
+}
+
+/** Drop a reference to a font, the last one frees the face. Called with the glyph cache lock held. */
+static void gfb_font_release(gfb_font_id fontid) {
+	gfb_fontentry_t *pentry = gfb_font_entry(fontid);
+	if (pentry == NULL || pentry->refs == 0 || --pentry->refs > 0) return;
+
+	gfb_font_forget(fontid);
+#if GFB_WITH_FREETYPE
+	if (pentry->face != NULL) FT_Done_Face(pentry->face);
+#endif
+	free(pentry->pbmfdata);
+	if (pentry->pmapping != NULL) munmap(pentry->pmapping, pentry->mapsize);
+	memset(pentry, 0x00, sizeof(gfb_fontentry_t));
+}
+
+/**
+Find a free entry in the font store, allocating a block when the allocated ones are full.
+Called with the glyph cache lock held.
+@return On success, returns the font id of the entry.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+static gfb_font_id gfb_font_alloc(void) {
+	for (int i = 0; i < MAX_GFB_FONT; i++) {
+		gfb_fontentry_t **ppblock = &gfb_fontblocks[i / GFB_FONT_BLOCK];
+		if (*ppblock == NULL && (*ppblock = calloc(GFB_FONT_BLOCK, sizeof(gfb_fontentry_t))) == NULL) {
+			return GFB_ENOMEM;
+		}
+		if ((*ppblock)[i % GFB_FONT_BLOCK].refs == 0) {
+			return i;
 		}
 	}
 
-	if (i < 0 || i >= MAX_GFB_FONT || gfb_fontstore[i] != NULL) {
-		//All slots occupied.
-		return GFB_ERROR;
+	//All slots occupied.
+	return GFB_ERROR;
+}
+
+#if GFB_WITH_FREETYPE
+/** Create a face from a font file in memory and store it, pmapping is unmapped with it if not NULL. */
+static gfb_font_id gfb_font_add(const uint8_t *pttf, size_t ttfsize, void *pmapping, size_t mapsize) {
+	gfb_glyphcache_lock();
+
+	gfb_font_id i = gfb_font_alloc();
+	if (i < 0) {
+		gfb_glyphcache_unlock();
+		return i;
 	}
+	gfb_fontentry_t *pentry = gfb_font_entry(i);
 
 	//Load font into library state.
-	FT_Error e = FT_New_Memory_Face(libft2, pttf, ttfsize, 0, &gfb_fontstore[i]);
+	FT_Error e = FT_New_Memory_Face(libft2, pttf, (FT_Long)ttfsize, 0, &pentry->face);
 
 	if ( e ) {
-		gfb_fontstore[i] = NULL;
+		pentry->face = NULL;
+		gfb_glyphcache_unlock();
 		return GFB_ERROR;
 	}
 
 	e = FT_Set_Char_Size(
-		gfb_fontstore[i],	/* Handle to face object.			*/
+		pentry->face,		/* Handle to face object.			*/
 		0,					/* Char_width in 1/64th of points.	*/
 		32*64,				/* Char_height in 1/64th of points.	*/
 		72,				/* Horizontal device resolution.	*/
@@ -1441,229 +4527,1448 @@ gfb_font_id gfb_ttf_load_memory(uint8_t *pttf, size_t ttfsize) {
 	if (e) {
 		fprintf(stderr, "Error %d setting font size.\n", e);
 	}
+	pentry->sizes[0] = pentry->face->size;
+	pentry->active = 0;
+	pentry->loaded = 1;
+	pentry->refs = 1;
+	pentry->pmapping = pmapping;
+	pentry->mapsize = mapsize;
+
+	gfb_glyphcache_unlock();
 
 	return i;
 }
 
-//FIXME, solve this buffering
-static uint16_t text[1024];
-
-int gfb_textu(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, uint16_t *punicode, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
-	if (
-		   psurface == NULL
-		|| fontid >= MAX_GFB_FONT
-		|| gfb_fontstore[fontid] == NULL
-		|| ptsize < 1
-		|| punicode == NULL
-		|| count == 0
-	) {
+gfb_font_id gfb_ttf_load_memory(uint8_t *pttf, size_t ttfsize) {
+	if (pttf == NULL || ttfsize == 0) {
 		return GFB_EARGUMENT;
 	}
 
-	/* FIXME using 75dpi */
-	FT_Error error = FT_Set_Char_Size( gfb_fontstore[fontid], ptsize * 64, 0, 100, 0 );
-	if (error) return GFB_ERROR;
+	return gfb_font_add(pttf, ttfsize, NULL, 0);
+}
+
+gfb_font_id gfb_ttf_load_file(const char *pzpath) {
+	if (pzpath == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	int fd = open(pzpath, O_RDONLY);
+	if (fd < 0) {
+		return GFB_EFILEOPEN;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return GFB_EFILEREAD;
+	}
+
+	//Shared and read-only, every process using the font maps the same page cache pages.
+	size_t mapsize = (size_t)st.st_size;
+	void *pmapping = mmap(NULL, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pmapping == MAP_FAILED) {
+		return GFB_EFILEREAD;
+	}
+
+	gfb_font_id fontid = gfb_font_add(pmapping, mapsize, pmapping, mapsize);
+	if (fontid < 0) {
+		munmap(pmapping, mapsize);
+	}
+
+	return fontid;
+}
+#else
+gfb_font_id gfb_ttf_load_memory(uint8_t *pttf, size_t ttfsize) {
+	return GFB_ENOTSUPPORTED;
+}
+
+gfb_font_id gfb_ttf_load_file(const char *pzpath) {
+	return GFB_ENOTSUPPORTED;
+}
+#endif
+
+/** Bitmap font with room for nglyphs glyphs and nbits bytes of rows, allocated as one block freed with free(). */
+static gfb_bmf_t *gfb_bmf_alloc(size_t nglyphs, size_t nbits, gfb_bmf_glyph_t **ppglyphs, uint8_t **ppbits) {
+	size_t head = (sizeof(gfb_bmf_t) + 7) & ~(size_t)7;
+
+	if (nglyphs > (SIZE_MAX - head - nbits) / sizeof(gfb_bmf_glyph_t)) return NULL;
+
+	uint8_t *pblock = calloc(1, head + nglyphs * sizeof(gfb_bmf_glyph_t) + nbits);
+	if (pblock == NULL) return NULL;
+
+	gfb_bmf_t *pbmf = (gfb_bmf_t *)pblock;
+	*ppglyphs = (gfb_bmf_glyph_t *)(pblock + head);
+	*ppbits = pblock + head + nglyphs * sizeof(gfb_bmf_glyph_t);
+	pbmf->pglyphs = *ppglyphs;
+	pbmf->pbits = *ppbits;
+
+	return pbmf;
+}
+
+/** Order bitmap font glyphs by code point. */
+static int gfb_bmf_cmpcode(const void *pa, const void *pb) {
+	const gfb_bmf_glyph_t *a = pa, *b = pb;
+	return (a->code > b->code) - (a->code < b->code);
+}
+
+/** Store a bitmap font, pdata is freed with it if not NULL. */
+static gfb_font_id gfb_bmf_add(const gfb_bmf_t *pbmf, void *pdata) {
+	gfb_glyphcache_lock();
+
+	gfb_font_id i = gfb_font_alloc();
+	if (i >= 0) {
+		gfb_fontentry_t *pentry = gfb_font_entry(i);
+		pentry->pbmf = pbmf;
+		pentry->pbmfdata = pdata;
+		pentry->loaded = 1;
+		pentry->refs = 1;
+	}
+
+	gfb_glyphcache_unlock();
+
+	return i;
+}
+
+/** Little-endian 32-bit value. */
+static inline uint32_t gfb_le32(const uint8_t *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+Walk the unicode table of a PSF font, every code point maps to the glyph whose entry it is in.
+Multi-character sequences are skipped, they have no single code point to draw them for.
+@param pglyphs Glyphs to fill in, NULL to only count the code points.
+@return Returns the number of code points in the table.
+*/
+static size_t gfb_psf_table(const uint8_t *p, const uint8_t *pend, int version, uint32_t nglyphs, uint32_t cellsize, gfb_bmf_glyph_t *pglyphs) {
+	size_t n = 0;
+
+	for (uint32_t g = 0; g < nglyphs && p < pend; g++) {
+		int sequence = 0;
+
+		while (p < pend) {
+			uint32_t code;
+
+			if (version == 1) {
+				if (pend - p < 2) return n;
+				code = (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+				p += 2;
+				if (code == 0xffff) break;
+				if (code == 0xfffe) {
+					sequence = 1;
+					continue;
+				}
+			} else {
+				if (*p == 0xff) {
+					p++;
+					break;
+				}
+				if (*p == 0xfe) {
+					sequence = 1;
+					p++;
+					continue;
+				}
+				if (*p == 0x00) {
+					code = 0;
+					p++;
+				} else if (*p < 0x80 || pend - p >= 4) {
+					gfb_utf8_next(&p, &code);
+				} else {
+					return n;	//Truncated, the decoder could read past the end.
+				}
+			}
+
+			if (sequence) continue;
+			if (pglyphs != NULL) {
+				pglyphs[n].code = code;
+				pglyphs[n].offset = g * cellsize;
+			}
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/** Parse a PSF1 or PSF2 console font, they have no baseline so a quarter of the cell is put below it. */
+static int gfb_psf_parse(const uint8_t *pdata, size_t size, gfb_bmf_t **ppbmf) {
+	uint32_t nglyphs, charsize, width, height, headersize;
+	int version, unicode;
+
+	if (size >= 4 && pdata[0] == 0x36 && pdata[1] == 0x04) {
+		version = 1;
+		nglyphs = (pdata[2] & 0x01) ? 512 : 256;
+		unicode = (pdata[2] & 0x06) != 0;
+		charsize = height = pdata[3];
+		width = 8;
+		headersize = 4;
+	} else if (size >= 32 && gfb_le32(pdata) == 0x864ab572u) {
+		version = 2;
+		headersize = gfb_le32(&pdata[8]);
+		unicode = gfb_le32(&pdata[12]) & 0x01;
+		nglyphs = gfb_le32(&pdata[16]);
+		charsize = gfb_le32(&pdata[20]);
+		height = gfb_le32(&pdata[24]);
+		width = gfb_le32(&pdata[28]);
+	} else {
+		return GFB_ENOTSUPPORTED;
+	}
+
+	if (
+		   width < 1 || width > UINT8_MAX
+		|| height < 1 || height > UINT8_MAX
+		|| charsize < (uint32_t)gfb_bmf_pitch(width) * height
+		|| headersize > size
+		|| nglyphs > (size - headersize) / charsize
+	) {
+		return GFB_ERROR;
+	}
+
+	//Rows are packed without any padding charsize may have.
+	uint32_t cellsize = (uint32_t)gfb_bmf_pitch(width) * height;
+	const uint8_t *ptable = &pdata[headersize + (size_t)nglyphs * charsize];
+	size_t count = unicode ? gfb_psf_table(ptable, &pdata[size], version, nglyphs, cellsize, NULL) : 0;
+	gfb_bmf_glyph_t *pglyphs;
+	uint8_t *pbits;
+
+	gfb_bmf_t *pbmf = gfb_bmf_alloc(count, (size_t)nglyphs * cellsize, &pglyphs, &pbits);
+	if (pbmf == NULL) return GFB_ENOMEM;
+
+	for (uint32_t g = 0; g < nglyphs; g++) {
+		memcpy(&pbits[(size_t)g * cellsize], &pdata[headersize + (size_t)g * charsize], cellsize);
+	}
+
+	pbmf->width = (int)width;
+	pbmf->height = (int)height;
+	pbmf->ascent = gfb_mini((int)(height - height / 4), INT8_MAX);
+	if (unicode) {
+		gfb_psf_table(ptable, &pdata[size], version, nglyphs, cellsize, pglyphs);
+		for (size_t i = 0; i < count; i++) {
+			pglyphs[i].width = (uint8_t)width;
+			pglyphs[i].height = (uint8_t)height;
+			pglyphs[i].ybearing = (int8_t)pbmf->ascent;
+			pglyphs[i].xadvance = (uint8_t)width;
+		}
+		qsort(pglyphs, count, sizeof(gfb_bmf_glyph_t), gfb_bmf_cmpcode);
+		pbmf->count = count;
+	} else {
+		//Glyph n is code point n, an array of cells.
+		pbmf->pglyphs = NULL;
+		pbmf->count = nglyphs;
+	}
+
+	*ppbmf = pbmf;
+
+	return GFB_OK;
+}
+
+/** Copy the next line of a BDF file to pzline, cut to n - 1 characters. */
+static int gfb_bdf_line(const uint8_t **pp, const uint8_t *pend, char *pzline, size_t n) {
+	const uint8_t *p = *pp;
+	size_t len = 0;
+
+	if (p >= pend) return 0;
+
+	for (; p < pend && *p != '\n'; p++) {
+		if (*p != '\r' && len + 1 < n) pzline[len++] = (char)*p;
+	}
+	pzline[len] = '\0';
+	*pp = p < pend ? p + 1 : p;
+
+	return 1;
+}
+
+/** Arguments of a BDF line starting with a keyword, NULL if it starts with another one. */
+static const char *gfb_bdf_keyword(const char *pzline, const char *pzkeyword) {
+	size_t len = strlen(pzkeyword);
+
+	if (strncmp(pzline, pzkeyword, len) != 0 || (pzline[len] != ' ' && pzline[len] != '\0')) return NULL;
+
+	return &pzline[len];
+}
+
+/** Value of a hexadecimal digit, 0 if it is not one. */
+static inline uint8_t gfb_hexdigit(char c) {
+	if (c >= '0' && c <= '9') return (uint8_t)(c - '0');
+	if (c >= 'a' && c <= 'f') return (uint8_t)(c - 'a' + 10);
+	if (c >= 'A' && c <= 'F') return (uint8_t)(c - 'A' + 10);
+	return 0;
+}
+
+/**
+Parse a BDF font. The glyph table is sized by CHARS and the font bounding box, which every glyph fits in.
+Glyphs without an encoding are left out.
+*/
+static int gfb_bdf_parse(const uint8_t *pdata, size_t size, gfb_bmf_t **ppbmf) {
+	const uint8_t *p = pdata, *pend = &pdata[size];
+	char line[256];
+	const char *parg;
+	gfb_bmf_t *pbmf = NULL;
+	gfb_bmf_glyph_t *pglyphs = NULL;
+	uint8_t *pbits = NULL;
+	size_t nglyphs = 0, maxglyphs = 0, nbits = 0, maxbits = 0;
+	int fbw = 0, fbh = 0, fbx = 0, fby = 0, ascent = -1, descent = -1;
+	int code = -1, dwidth = 0, w = 0, h = 0, x = 0, y = 0;
+
+	if (!gfb_bdf_line(&p, pend, line, sizeof(line)) || gfb_bdf_keyword(line, "STARTFONT") == NULL) return GFB_ENOTSUPPORTED;
+
+	while (gfb_bdf_line(&p, pend, line, sizeof(line))) {
+		if ((parg = gfb_bdf_keyword(line, "FONTBOUNDINGBOX")) != NULL) {
+			sscanf(parg, "%d %d %d %d", &fbw, &fbh, &fbx, &fby);
+		} else if ((parg = gfb_bdf_keyword(line, "FONT_ASCENT")) != NULL) {
+			sscanf(parg, "%d", &ascent);
+		} else if ((parg = gfb_bdf_keyword(line, "FONT_DESCENT")) != NULL) {
+			sscanf(parg, "%d", &descent);
+		} else if ((parg = gfb_bdf_keyword(line, "CHARS")) != NULL) {
+			if (
+				   pbmf != NULL
+				|| fbw < 1 || fbw > UINT8_MAX || fbh < 1 || fbh > UINT8_MAX
+				|| sscanf(parg, "%zu", &maxglyphs) != 1
+				|| maxglyphs > 0x110000
+				|| (uint64_t)maxglyphs * gfb_bmf_pitch(fbw) * fbh > SIZE_MAX / 2
+			) {
+				free(pbmf);
+				return GFB_ERROR;
+			}
+			maxbits = maxglyphs * gfb_bmf_pitch(fbw) * fbh;
+			if ((pbmf = gfb_bmf_alloc(maxglyphs, maxbits, &pglyphs, &pbits)) == NULL) return GFB_ENOMEM;
+		} else if (gfb_bdf_keyword(line, "STARTCHAR") != NULL) {
+			code = -1;
+			dwidth = fbw;
+			w = fbw;
+			h = fbh;
+			x = fbx;
+			y = fby;
+		} else if ((parg = gfb_bdf_keyword(line, "ENCODING")) != NULL) {
+			sscanf(parg, "%d", &code);
+		} else if ((parg = gfb_bdf_keyword(line, "DWIDTH")) != NULL) {
+			sscanf(parg, "%d", &dwidth);
+		} else if ((parg = gfb_bdf_keyword(line, "BBX")) != NULL) {
+			sscanf(parg, "%d %d %d %d", &w, &h, &x, &y);
+		} else if (gfb_bdf_keyword(line, "BITMAP") != NULL) {
+			if (pbmf == NULL || w < 0 || w > UINT8_MAX || h < 0 || h > UINT8_MAX) {
+				free(pbmf);
+				return GFB_ERROR;
+			}
+
+			int pitch = gfb_bmf_pitch(w);
+			int keep = code >= 0 && nglyphs < maxglyphs && nbits + (size_t)pitch * h <= maxbits;
+
+			for (int row = 0; row < h; row++) {
+				if (!gfb_bdf_line(&p, pend, line, sizeof(line))) {
+					free(pbmf);
+					return GFB_ERROR;
+				}
+				if (!keep) continue;
+
+				//Rows are hex digits padded to whole bytes, short rows are blank at the end.
+				size_t len = strlen(line);
+				for (int i = 0; i < pitch && (size_t)i * 2 < len; i++) {
+					pbits[nbits + row * pitch + i] = (uint8_t)((gfb_hexdigit(line[i * 2]) << 4) | gfb_hexdigit(line[i * 2 + 1]));
+				}
+			}
+
+			if (keep) {
+				gfb_bmf_glyph_t *pglyph = &pglyphs[nglyphs++];
+				pglyph->code = (uint32_t)code;
+				pglyph->offset = (uint32_t)nbits;
+				pglyph->width = (uint8_t)w;
+				pglyph->height = (uint8_t)h;
+				pglyph->xbearing = (int8_t)gfb_clampi(x, INT8_MIN, INT8_MAX);
+				pglyph->ybearing = (int8_t)gfb_clampi(y + h, INT8_MIN, INT8_MAX);
+				pglyph->xadvance = (uint8_t)gfb_clampi(dwidth, 0, UINT8_MAX);
+				nbits += (size_t)pitch * h;
+			}
+		} else if (gfb_bdf_keyword(line, "ENDFONT") != NULL) {
+			break;
+		}
+	}
+
+	if (pbmf == NULL) return GFB_ERROR;
+
+	if (ascent < 0 || descent < 0) {
+		ascent = fbh + fby;
+		descent = -fby;
+	}
+	pbmf->width = fbw;
+	pbmf->ascent = gfb_clampi(ascent, 0, INT8_MAX);
+	pbmf->height = gfb_clampi(ascent + descent, 1, UINT8_MAX);
+	pbmf->count = nglyphs;
+	qsort(pglyphs, nglyphs, sizeof(gfb_bmf_glyph_t), gfb_bmf_cmpcode);
+
+	*ppbmf = pbmf;
+
+	return GFB_OK;
+}
+
+gfb_font_id gfb_bmf_load_memory(const uint8_t *pdata, size_t size) {
+	if (pdata == NULL || size == 0) {
+		return GFB_EARGUMENT;
+	}
+
+	gfb_bmf_t *pbmf = NULL;
+	int rc = gfb_psf_parse(pdata, size, &pbmf);
+	if (rc == GFB_ENOTSUPPORTED) {
+		rc = gfb_bdf_parse(pdata, size, &pbmf);
+	}
+	if (rc != GFB_OK) {
+		return rc;
+	}
+
+	gfb_font_id fontid = gfb_bmf_add(pbmf, pbmf);
+	if (fontid < 0) {
+		free(pbmf);
+	}
+
+	return fontid;
+}
+
+gfb_font_id gfb_bmf_load_file(const char *pzpath) {
+	if (pzpath == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	int fd = open(pzpath, O_RDONLY);
+	if (fd < 0) {
+		return GFB_EFILEOPEN;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return GFB_EFILEREAD;
+	}
+
+	//The glyphs are copied out, the mapping is only needed while parsing.
+	size_t mapsize = (size_t)st.st_size;
+	void *pmapping = mmap(NULL, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pmapping == MAP_FAILED) {
+		return GFB_EFILEREAD;
+	}
+
+	gfb_font_id fontid = gfb_bmf_load_memory(pmapping, mapsize);
+	munmap(pmapping, mapsize);
+
+	return fontid;
+}
+
+gfb_font_id gfb_bmf_load_array(const gfb_bmf_t *pbmf) {
+	if (
+		   pbmf == NULL
+		|| pbmf->pbits == NULL
+		|| pbmf->width < 1 || pbmf->width > UINT8_MAX
+		|| pbmf->height < 1 || pbmf->height > UINT8_MAX
+		|| pbmf->ascent < 0 || pbmf->ascent > INT8_MAX
+		|| pbmf->count == 0
+	) {
+		return GFB_EARGUMENT;
+	}
+
+	return gfb_bmf_add(pbmf, NULL);
+}
+
+int gfb_ttf_unload(gfb_font_id fontid) {
+	gfb_glyphcache_lock();
+
+	if (gfb_font_loaded(fontid) == NULL) {
+		gfb_glyphcache_unlock();
+		return GFB_EARGUMENT;
+	}
+
+	//Fixed fonts created from the face keep it until they are destroyed, the id can no longer be drawn with.
+	gfb_font_entry(fontid)->loaded = 0;
+	gfb_font_release(fontid);
+
+	gfb_glyphcache_unlock();
+
+	return GFB_OK;
+}
+
+int gfb_textu(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, uint32_t *punicode, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
+	if (
+		   psurface == NULL
+		|| gfb_font_loaded(fontid) == NULL
+		|| ptsize < 1
+		|| punicode == NULL
+		|| count == 0
+	) {
+		return GFB_EARGUMENT;
+	}
+
+	return psurface->op->textu(psurface, fontid, ptsize, x, y, punicode, count, colorf, colorb);
+}
+
+int gfb_text(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, char *pzutf8, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
+	if (
+		   psurface == NULL
+		|| gfb_font_loaded(fontid) == NULL
+		|| ptsize < 1
+		|| pzutf8 == NULL
+		|| count == 0
+	) {
+		return GFB_EARGUMENT;
+	}
+
+	return psurface->op->text(psurface, fontid, ptsize, x, y, pzutf8, count, colorf, colorb);
+}
+
+int gfb_text_measure(gfb_font_id fontid, uint8_t ptsize, const char *pzutf8, size_t count, gfb_textmetrics_t *pmetrics) {
+	if (gfb_font_loaded(fontid) == NULL || ptsize < 1 || pzutf8 == NULL || pmetrics == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	const uint8_t *p = (const uint8_t *)pzutf8;
+	gfb_glyphinfo_t glyph;
+	uint32_t code, previndex = 0;
+	int32_t pen = 0;
+	int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
+	size_t n;
+
+	memset(pmetrics, 0, sizeof(gfb_textmetrics_t));
+
+	gfb_glyphcache_lock();
+	const gfb_bmf_t *pbmf = gfb_font_entry(fontid)->pbmf;
+	if (pbmf != NULL) {
+		pmetrics->ascent = pbmf->ascent;
+		pmetrics->descent = pbmf->height - pbmf->ascent;
+		pmetrics->lineheight = pbmf->height;
+	} else {
+#if GFB_WITH_FREETYPE
+		int rc = gfb_font_setsize(fontid, ptsize);
+		if (rc != GFB_OK) {
+			gfb_glyphcache_unlock();
+			return rc;
+		}
+
+		FT_Size_Metrics *psize = &gfb_font_face(fontid)->size->metrics;
+		pmetrics->ascent = (int)((psize->ascender + 63) >> 6);
+		pmetrics->descent = (int)((63 - psize->descender) >> 6);
+		pmetrics->lineheight = (int)((psize->height + 63) >> 6);
+#endif
+	}
+
+	for (n = 0; n < count; n++) {
+		if (!gfb_utf8_next(&p, &code)) break;
+		if (code == 0 || gfb_glyph_get(fontid, ptsize, code, 0, &glyph) != GFB_OK) continue;
+
+		pen += gfb_glyph_kerning(fontid, ptsize, previndex, glyph.index);
+		previndex = glyph.index;
+		if (glyph.w > 0 && glyph.h > 0) {
+			x1 = gfb_mini(x1, (pen >> 6) + glyph.left);
+			y1 = gfb_mini(y1, -glyph.top);
+			x2 = gfb_maxi(x2, (pen >> 6) + glyph.left + glyph.w);
+			y2 = gfb_maxi(y2, glyph.h - glyph.top);
+		}
+		pen += glyph.advance;
+	}
+	gfb_glyphcache_unlock();
+
+	pmetrics->advance = (pen + 63) >> 6;
+	pmetrics->count = n;
+	if (x1 < x2) {
+		pmetrics->bbox.x = x1;
+		pmetrics->bbox.y = y1;
+		pmetrics->bbox.w = x2 - x1;
+		pmetrics->bbox.h = y2 - y1;
+	}
+
+	return GFB_OK;
+}
+
+/** Store a wrapped line if there is room and count it. */
+static inline void gfb_text_addline(gfb_textline_t *plines, size_t maxlines, size_t *pnlines, const uint8_t *pstart, const uint8_t *pline, const uint8_t *pend, size_t count, int32_t pen) {
+	if (plines != NULL && *pnlines < maxlines) {
+		gfb_textline_t *pl = &plines[*pnlines];
+		pl->offset = (size_t)(pline - pstart);
+		pl->length = (size_t)(pend - pline);
+		pl->count = count;
+		pl->advance = (pen + 63) >> 6;
+	}
+	(*pnlines)++;
+}
+
+int gfb_text_wrap(gfb_font_id fontid, uint8_t ptsize, const char *pzutf8, int width, gfb_textline_t *plines, size_t maxlines, size_t *pcount) {
+	if (gfb_font_loaded(fontid) == NULL || ptsize < 1 || pzutf8 == NULL || width < 1 || pcount == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	const uint8_t *pstart = (const uint8_t *)pzutf8;
+	const uint8_t *p = pstart;
+	const uint8_t *pline = pstart;	//Start of the current line.
+	const uint8_t *pbreak = NULL;	//Where the current line ends if broken at the last spaces.
+	const uint8_t *pnext = NULL;	//Where the next line starts if broken at the last spaces.
+	int32_t limit = width * 64;
+	int32_t pen = 0, breakpen = 0, nextpen = 0;
+	size_t chars = 0, breakchars = 0, nextchars = 0;
+	size_t nlines = 0;
+	uint32_t code, previndex = 0;
+	gfb_glyphinfo_t glyph;
+
+	gfb_glyphcache_lock();
+	for (;;) {
+		const uint8_t *pchar = p;
+		int more = gfb_utf8_next(&p, &code);
+
+		if (!more || code == '\n') {
+			//Hard break, trailing spaces are left out.
+			if (pbreak != NULL && pnext == pchar) {
+				gfb_text_addline(plines, maxlines, &nlines, pstart, pline, pbreak, breakchars, breakpen);
+			} else {
+				gfb_text_addline(plines, maxlines, &nlines, pstart, pline, pchar, chars, pen);
+			}
+			if (!more) break;
+
+			pline = p;
+			pbreak = pnext = NULL;
+			pen = 0;
+			chars = 0;
+			previndex = 0;
+			continue;
+		}
+
+		if (code == 0 || gfb_glyph_get(fontid, ptsize, code, 0, &glyph) != GFB_OK) {
+			chars++;
+			continue;
+		}
+
+		int32_t advance = glyph.advance + gfb_glyph_kerning(fontid, ptsize, previndex, glyph.index);
+		previndex = glyph.index;
+
+		if (code == ' ') {
+			if (pnext != pchar) {
+				pbreak = pchar;
+				breakpen = pen;
+				breakchars = chars;
+			}
+			//Spaces may hang past the width, the line is broken before the next word.
+			pen += advance;
+			chars++;
+			pnext = p;
+			nextpen = pen;
+			nextchars = chars;
+			continue;
+		}
+
+		while (pen + advance > limit && pchar > pline) {
+			if (pbreak != NULL && pbreak > pline) {
+				gfb_text_addline(plines, maxlines, &nlines, pstart, pline, pbreak, breakchars, breakpen);
+				pline = pnext;
+				pen -= nextpen;
+				chars -= nextchars;
+			} else {
+				//No space to break at, break the word between characters.
+				gfb_text_addline(plines, maxlines, &nlines, pstart, pline, pchar, chars, pen);
+				pline = pchar;
+				pen = 0;
+				chars = 0;
+			}
+			pbreak = pnext = NULL;
+			if (pline == pchar) advance = glyph.advance;
+		}
+
+		pen += advance;
+		chars++;
+	}
+	gfb_glyphcache_unlock();
+
+	*pcount = nlines;
+
+	return GFB_OK;
+}
+
+int gfb_glyphcache_configure(size_t budget) {
+	if (budget < 4096) {
+		return GFB_EARGUMENT;
+	}
+
+	gfb_glyphcache_lock();
+	gfb_glyphcache_release();
+	gfb_glyphcache.budget = budget;
+	gfb_glyphcache_unlock();
+
+	return GFB_OK;
+}
+
+void gfb_glyphcache_flush(void) {
+	gfb_glyphcache_lock();
+	gfb_glyphcache_release();
+	gfb_glyphcache_unlock();
+}
+
+int gfb_glyphcache_stats(gfb_glyphcache_stats_t *pstats) {
+	if (pstats == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	gfb_glyphcache_lock();
+	pstats->hits = gfb_glyphcache.hits;
+	pstats->misses = gfb_glyphcache.misses;
+	pstats->evictions = gfb_glyphcache.evictions;
+	pstats->glyphs = gfb_glyphcache.count;
+	pstats->bytes = gfb_glyphcache.live;
+	pstats->budget = gfb_glyphcache.budget;
+	gfb_glyphcache_unlock();
+
+	return GFB_OK;
+}
+
+int gfb_runcache_configure(size_t budget) {
+	gfb_glyphcache_lock();
+	gfb_runcache_release();
+	gfb_runcache.budget = budget;
+	gfb_glyphcache_unlock();
+
+	return GFB_OK;
+}
+
+void gfb_runcache_flush(void) {
+	gfb_glyphcache_lock();
+	gfb_runcache_release();
+	gfb_glyphcache_unlock();
+}
+
+int gfb_runcache_stats(gfb_runcache_stats_t *pstats) {
+	if (pstats == NULL) {
+		return GFB_EARGUMENT;
+	}
+
+	gfb_glyphcache_lock();
+	pstats->hits = gfb_runcache.hits;
+	pstats->misses = gfb_runcache.misses;
+	pstats->evictions = gfb_runcache.evictions;
+	pstats->runs = gfb_runcache.count;
+	pstats->bytes = gfb_runcache.bytes;
+	pstats->budget = gfb_runcache.budget;
+	gfb_glyphcache_unlock();
+
+	return GFB_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+//Initialize library state.
+int gfb_initialize(void) {
+#if GFB_WITH_FREETYPE
+	if (libft2 == NULL) {
+		FT_Error e = FT_Init_FreeType( &libft2 );
+		if ( e ) {
+			libft2 = NULL;
+			return GFB_ERROR;
+		}
+	}
+#endif
+
+	return GFB_OK;
+}
+
+void gfb_finalize(void) {
+	int i;
+
+	gfb_glyphcache_release();
+	gfb_runcache_release();
+	for (i = 0; i < MAX_GFB_FONT; i++) {
+		gfb_fontentry_t *pentry = gfb_font_entry(i);
+		if (pentry != NULL && pentry->refs > 0) {
+#if GFB_WITH_FREETYPE
+			if (pentry->face != NULL) FT_Done_Face(pentry->face);
+#endif
+			free(pentry->pbmfdata);
+			if (pentry->pmapping != NULL) munmap(pentry->pmapping, pentry->mapsize);
+		}
+	}
+	for (i = 0; i < (MAX_GFB_FONT + GFB_FONT_BLOCK - 1) / GFB_FONT_BLOCK; i++) {
+		free(gfb_fontblocks[i]);
+		gfb_fontblocks[i] = NULL;
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+/** Bytes taken by a row of n pixels of coverage at the depth of a fixed font. */
+static inline int gfb_fft_rowbytes(const gfb_fft_t *pfont, int n) {
+	return (n * pfont->depth + 7) / 8;
+}
+
+/** Number of slots of a cache asked for n, rounded down to whole sets so every slot can be reached. */
+static inline int gfb_fft_slots(int n) {
+	return n > GFB_FFT_WAYS ? n - n % GFB_FFT_WAYS : n;
+}
+
+/** Allocate a fixed font cache of n slots and cachesize bytes of coverage. */
+static int gfb_fft_init(gfb_fft_t *pfft, gfb_font_id fontid, int ptsize, int n, int w, int h, size_t cachesize, int packed) {
+	if (pfft == NULL || n < 1 || n > UINT16_MAX || w < 1 || w > UINT8_MAX / 2 || h < 1 || h > UINT8_MAX) return GFB_EARGUMENT;
+
+	n = gfb_fft_slots(n);
+
+	memset(pfft, 0x00, sizeof(gfb_fft_t));
+	pfft->parentid = -1;
+
+	pfft->pcache = calloc(1, cachesize);
+	if (pfft->pcache == NULL) {
+		return GFB_ENOMEM;	//Out of memory.
+	}
+
+	size_t metaSize = sizeof (gfb_fft_meta_t) * n;
+
+	pfft->pmeta = calloc(1, metaSize);
+	pfft->plastuse = calloc(n, sizeof(uint32_t));
+	if (pfft->pmeta == NULL || pfft->plastuse == NULL) {
+		gfb_fft_destroy(pfft);
+		return GFB_ENOMEM;	//Out of memory.
+	}
+
+	pfft->count = n;
+	pfft->ways = gfb_mini(n, GFB_FFT_WAYS);
+	pfft->nsets = n / pfft->ways;
+	pfft->w = w;
+	pfft->h = h;
+	pfft->ptsize = ptsize;
+	pfft->stride = (w * 2);
+	pfft->gsize = ((w * 2) * h);
+	pfft->depth = 8;
+	pfft->packed = packed;
+	pfft->cachesize = cachesize;
+
+	//Hold on to the face, the font may be unloaded before the fixed font is destroyed.
+	gfb_glyphcache_lock();
+	pfft->parentid = gfb_font_ref(fontid) == GFB_OK ? fontid : -1;
+	gfb_glyphcache_unlock();
+
+	return GFB_OK;
+}
+
+int gfb_fft_create(gfb_fft_t *pfft, gfb_font_id fontid, int ptsize, int n, int w, int h) {
+	if (w < 1 || h < 1) return GFB_EARGUMENT;
+
+	return gfb_fft_init(pfft, fontid, ptsize, n, w, h, (size_t)((w * 2) * h) * gfb_fft_slots(n), 0);
+}
+
+int gfb_fft_create_packed(gfb_fft_t *pfft, gfb_font_id fontid, int ptsize, int n, int w, int h, size_t size) {
+	if (size < 1 || size > UINT32_MAX) return GFB_EARGUMENT;
+
+	return gfb_fft_init(pfft, fontid, ptsize, n, w, h, size, 1);
+}
+
+int gfb_fft_depth(gfb_fft_t *pfont, int depth) {
+	if (pfont == NULL || pfont->pmeta == NULL || (depth != 8 && depth != 4 && depth != 1)) return GFB_EARGUMENT;
+	if (pfont->pmapping != NULL) return GFB_ENOTSUPPORTED;	//The layout of a mapped cache is fixed by its file.
+
+	if (depth != pfont->depth) {
+		pfont->depth = depth;
+		pfont->gsize = gfb_fft_rowbytes(pfont, pfont->stride) * pfont->h;
+
+		if (!pfont->packed) {
+			//A fixed cache holds exactly count glyphs, resize it for the new depth.
+			size_t cachesize = (size_t)pfont->gsize * pfont->count;
+			uint8_t *pcache = realloc(pfont->pcache, cachesize);
+			if (pcache == NULL) return GFB_ENOMEM;
+			pfont->pcache = pcache;
+			pfont->cachesize = cachesize;
+		}
+	}
+
+	//Cached coverage is at the old depth, start over.
+	memset(pfont->pmeta, 0x00, sizeof(gfb_fft_meta_t) * pfont->count);
+	memset(pfont->plastuse, 0x00, sizeof(uint32_t) * pfont->count);
+	pfont->used = pfont->live = 0;
+
+	return GFB_OK;
+}
+
+void gfb_fft_destroy(gfb_fft_t *pfont) {
+	if (pfont == NULL) return;
+
+	if (pfont->parentid >= 0) {
+		gfb_glyphcache_lock();
+		gfb_font_release(pfont->parentid);
+		gfb_glyphcache_unlock();
+		pfont->parentid = -1;
+	}
+
+	if (pfont->pmapping != NULL) {
+		//Metadata and glyphs live in the mapping.
+		munmap(pfont->pmapping, pfont->mapsize);
+		pfont->pmapping = NULL;
+		pfont->pmeta = NULL;
+		pfont->pcache = NULL;
+	}
+
+	if (pfont->pmeta != NULL) {
+		free(pfont->pmeta);
+		pfont->pmeta = NULL;
+	}
+
+	if (pfont->pcache != NULL) {
+		free(pfont->pcache);
+		pfont->pcache = NULL;
+	}
+
+	free(pfont->plastuse);
+	pfont->plastuse = NULL;
+}
 
-	return psurface->op->text(psurface, fontid, x, y, punicode, count, colorf, colorb);
+/** First slot of the set a code point is cached in, hashed so neighbouring code points spread out. */
+static inline int gfb_fft_set(const gfb_fft_t *pfont, uint16_t code) {
+	//The top bits of the product are the well mixed ones, scale them to the number of sets.
+	uint32_t h = (uint32_t)code * 0x9e3779b1u;
+	return (int)(((uint64_t)h * pfont->nsets) >> 32) * pfont->ways;
 }
 
-int gfb_text(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, char *pzutf8, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
-	if (
-		   psurface == NULL
-		|| fontid >= MAX_GFB_FONT
-		|| gfb_fontstore[fontid] == NULL
-		|| ptsize < 1
-		|| pzutf8 == NULL
-		|| count == 0
-	) {
-		return GFB_EARGUMENT;
+/** Slot holding a code point, -1 if it is not cached. */
+static inline int gfb_fft_find(const gfb_fft_t *pfont, uint16_t code) {
+	int first = gfb_fft_set(pfont, code);
+
+	for (int idx = first; idx < first + pfont->ways; idx++) {
+		if (pfont->pmeta[idx].code == code && (pfont->pmeta[idx].flags & GFB_ISCACHED)) return idx;
 	}
 
-	/* FIXME using 75dpi */
-	FT_Error error = FT_Set_Char_Size( gfb_fontstore[fontid], ptsize * 64, 0, 100, 0 );
-	if (error) return GFB_ERROR;
+	return -1;
+}
 
-	size_t cursor = 0;
-	int is_valid = 0;
-	unsigned int code = 0;
-	size_t zlen = strlen(pzutf8);
+/** Bytes of coverage per row of a cached glyph. */
+static inline int gfb_fft_pitch(const gfb_fft_t *pfont, const gfb_fft_meta_t *pmeta) {
+	return gfb_fft_rowbytes(pfont, pfont->packed ? gfb_mini(pmeta->width, pfont->stride) : pfont->stride);
+}
 
-	unsigned int n = count;
-	unsigned int i = 0;
+/** Bytes a cached glyph takes in a packed cache, 0 in a fixed one. */
+static inline size_t gfb_fft_glyphsize(const gfb_fft_t *pfont, const gfb_fft_meta_t *pmeta) {
+	if (!pfont->packed) return 0;
+	return (size_t)gfb_fft_pitch(pfont, pmeta) * gfb_mini(pmeta->height, pfont->h);
+}
 
-	//Decode UTF-8 string into text[].
-	while (utf8_get_next_char((uint8_t *)pzutf8, zlen, &cursor, &is_valid, &code)) {
-		if (n == 0) break;
+/**
+Write n pixels of a glyph row starting at pixel j, expanding the coverage through a color table.
+4-bit coverage is read a byte (two pixels) at a time. 1-bit coverage picks between the two end colors a
+byte (eight pixels) at a time, blank and solid bytes become a single fill.
+*/
+static inline void gfb_fft_span(uint8_t *pdst, const uint8_t *prow, int j, int n, int depth, const gfb_color_t *plut, unsigned int bpp) {
+	int end = j + n;
 
-		if (is_valid && code) {
-			text[i++] = code;
+	switch (depth) {
+		case 8:
+			for (; j < end; j++, pdst += bpp) gfb_pokepixel(pdst, plut[prow[j]], bpp);
+			break;
+		case 4:
+			if (j & 1) {
+				gfb_pokepixel(pdst, plut[(prow[j >> 1] & 0x0f) * 17], bpp);
+				pdst += bpp;
+				j++;
+			}
+			for (; j + 1 < end; j += 2, pdst += 2 * bpp) {
+				uint8_t pair = prow[j >> 1];
+				gfb_pokepixel(pdst, plut[(pair >> 4) * 17], bpp);
+				gfb_pokepixel(pdst + bpp, plut[(pair & 0x0f) * 17], bpp);
+			}
+			if (j < end) gfb_pokepixel(pdst, plut[(prow[j >> 1] >> 4) * 17], bpp);
+			break;
+		default: {
+			gfb_color_t color0 = plut[0], color1 = plut[255];
+			for (; j < end && (j & 7); j++, pdst += bpp) {
+				gfb_pokepixel(pdst, (prow[j >> 3] & (0x80 >> (j & 7))) ? color1 : color0, bpp);
+			}
+			for (; j + 8 <= end; j += 8, pdst += 8 * bpp) {
+				uint8_t bits = prow[j >> 3];
+				if (bits == 0x00 || bits == 0xff) {
+					gfb_fillrow(pdst, 8, bits ? color1 : color0, bpp);
+					continue;
+				}
+				for (int b = 0; b < 8; b++) gfb_pokepixel(pdst + b * bpp, (bits & (0x80 >> b)) ? color1 : color0, bpp);
+			}
+			for (; j < end; j++, pdst += bpp) {
+				gfb_pokepixel(pdst, (prow[j >> 3] & (0x80 >> (j & 7))) ? color1 : color0, bpp);
+			}
+			break;
 		}
+	}
+}
 
-		if (n > 0) --n;
+/** Blend a color over n pixels through a glyph row starting at pixel j, coverage of 4 and 1 bits is widened to bytes first. */
+static inline void gfb_fft_maskspan(uint8_t *pdst, const uint8_t *prow, int j, int n, int depth, gfb_color_t colorf, const gfb_pixelformat_t *pformat) {
+	uint8_t mask[UINT8_MAX];
+
+	if (depth == 8) {
+		gfb_maskrow(pdst, &prow[j], n, colorf, pformat);
+		return;
 	}
 
-	return psurface->op->text(psurface, fontid, x, y, &text[0], i, colorf, colorb);
+	for (int i = 0; i < n; i++, j++) {
+		mask[i] = depth == 4 ? ((prow[j >> 1] >> ((~j & 1) << 2)) & 0x0f) * 17 : ((prow[j >> 3] & (0x80 >> (j & 7))) ? 255 : 0);
+	}
+	gfb_maskrow(pdst, mask, n, colorf, pformat);
 }
 
+/** Cached glyph and its slot in a packed cache, see gfb_fft_compact(). */
+typedef struct gfb_fftpack {
+	uint32_t offset;	/**< Position of the coverage in pcache[]. */
+	int idx;			/**< Slot of the glyph. */
+} gfb_fftpack_t;
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
+/** Order packed glyphs by their position in the cache. */
+static int gfb_fft_cmpoffset(const void *pa, const void *pb) {
+	const gfb_fftpack_t *a = pa, *b = pb;
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
 
+/** Move the glyphs of a packed cache down over the holes left by replaced ones. */
+static int gfb_fft_compact(gfb_fft_t *pfont) {
+	gfb_fftpack_t *plist = malloc(pfont->count * sizeof(gfb_fftpack_t));
+	int n = 0;
 
-//Initialize library state.
-int gfb_initialize(void) {
-	if (libft2 == NULL) {
-		FT_Error e = FT_Init_FreeType( &libft2 );
-		if ( e ) {
-			libft2 = NULL;
-			return GFB_ERROR;
+	if (plist == NULL) return GFB_ENOMEM;
+
+	for (int i = 0; i < pfont->count; i++) {
+		if ((pfont->pmeta[i].flags & GFB_ISCACHED) && gfb_fft_glyphsize(pfont, &pfont->pmeta[i]) > 0) {
+			plist[n].offset = pfont->pmeta[i].offset;
+			plist[n].idx = i;
+			n++;
 		}
 	}
+	qsort(plist, n, sizeof(gfb_fftpack_t), gfb_fft_cmpoffset);
+
+	pfont->used = 0;
+	for (int i = 0; i < n; i++) {
+		gfb_fft_meta_t *pmeta = &pfont->pmeta[plist[i].idx];
+		size_t size = gfb_fft_glyphsize(pfont, pmeta);
+		memmove(&pfont->pcache[pfont->used], &pfont->pcache[pmeta->offset], size);
+		pmeta->offset = (uint32_t)pfont->used;
+		pfont->used += size;
+	}
+
+	free(plist);
 
 	return GFB_OK;
 }
 
-void gfb_finalize(void) {
-	int i;
-	for (i = 0; i < MAX_GFB_FONT; i++) {
-		if (gfb_fontstore[i] != NULL) {
-			FT_Done_Face(gfb_fontstore[i]);
-			gfb_fontstore[i] = NULL;
+/**
+Reserve bytes for a glyph in a packed cache.
+Glyphs are allocated back to back. When the end is reached the cache is compacted, after first dropping
+the least recently used glyphs of any set if the live glyphs leave too little room.
+@return Returns the offset in pcache[], SIZE_MAX if the glyph can not be cached.
+*/
+static size_t gfb_fft_reserve(gfb_fft_t *pfont, size_t size) {
+	if (size > pfont->cachesize) return SIZE_MAX;
+
+	if (pfont->used + size > pfont->cachesize) {
+		while (pfont->live + size > pfont->cachesize) {
+			int oldest = -1;
+
+			for (int i = 0; i < pfont->count; i++) {
+				if (!(pfont->pmeta[i].flags & GFB_ISCACHED) || gfb_fft_glyphsize(pfont, &pfont->pmeta[i]) == 0) continue;
+				if (oldest < 0 || pfont->tick - pfont->plastuse[i] > pfont->tick - pfont->plastuse[oldest]) oldest = i;
+			}
+			if (oldest < 0) return SIZE_MAX;
+
+			pfont->live -= gfb_fft_glyphsize(pfont, &pfont->pmeta[oldest]);
+			pfont->pmeta[oldest].flags = 0;
+			pfont->evictions++;
 		}
+
+		if (gfb_fft_compact(pfont) != GFB_OK) return SIZE_MAX;
 	}
+
+	size_t offset = pfont->used;
+	pfont->used += size;
+	pfont->live += size;
+
+	return offset;
 }
 
+/** Render a glyph into a cache slot. */
+static void gfb_fft_render(gfb_fft_t *pfont, int idx, uint16_t code) {
+	gfb_fft_meta_t *pmeta = &pfont->pmeta[idx];
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
+	//Give back the bytes of the glyph being replaced.
+	if (pmeta->flags & GFB_ISCACHED) pfont->live -= gfb_fft_glyphsize(pfont, pmeta);
+	memset(pmeta, 0x00, sizeof(gfb_fft_meta_t));
+	pmeta->code = code;
 
+	gfb_fontentry_t *pentry = gfb_font_entry(pfont->parentid);
+	if (pentry == NULL || pentry->refs == 0) {
+		//Opened from a file without a font, glyphs missing from it stay blank.
+		pmeta->flags = GFB_ISCACHED;
+		return;
+	}
 
-int gfb_fft_create(gfb_fft_t *pfft, gfb_font_id fontid, int ptsize, int n, int w, int h) {
-	memset(pfft, 0x00, sizeof(gfb_fft_t));
+	const uint8_t *psrcrow;
+	int srcpitch, srcwidth, mono;
+
+	//The face glyph slot is shared with the text renderer.
+	gfb_glyphcache_lock();
+	if (pentry->pbmf != NULL) {
+		//Bitmap font rows are copied as they are, whatever point size the fixed font was created with.
+		gfb_bmf_glyph_t cell;
+		const gfb_bmf_glyph_t *pglyph = gfb_bmf_glyph(pentry->pbmf, code, &cell);
+
+		psrcrow = &pentry->pbmf->pbits[pglyph->offset];
+		srcpitch = gfb_bmf_pitch(pglyph->width);
+		srcwidth = pglyph->width;
+		mono = 1;
+		pmeta->width = pglyph->width;
+		pmeta->height = pglyph->height;
+		pmeta->xbearing = pglyph->xbearing;
+		pmeta->ybearing = pglyph->ybearing;
+		pmeta->xadvance = pglyph->xadvance;
+	} else {
+#if GFB_WITH_FREETYPE
+		/*int error = */gfb_font_setsize(pfont->parentid, pfont->ptsize);
+		/* FIXME ignoring errors is not cool */
 
-	size_t slotSize = ((w * 2) * h) * n;
+		FT_GlyphSlot slot = pentry->face->glyph;
+		FT_Vector pen;
 
-	pfft->pcache = calloc(1, slotSize);
-	if (pfft->pcache == NULL) {
-		return GFB_ENOMEM;	//Out of memory.
+		pen.x = 0;
+		pen.y = 0;
+
+		/* set transformation */
+		FT_Set_Transform( pentry->face, /*&matrix*/ 0, &pen );
+
+		/* load glyph image into the slot (erase previous one) */
+		/*error = */FT_Load_Char( pentry->face, code, FT_LOAD_RENDER | (pfont->depth == 1 ? FT_LOAD_TARGET_MONO : 0));// | FT_LOAD_FORCE_AUTOHINT );
+		/* FIXME ignoring errors is not cool */
+
+		psrcrow = slot->bitmap.buffer;
+		srcpitch = slot->bitmap.pitch;
+		srcwidth = slot->bitmap.width;
+		mono = slot->bitmap.pixel_mode == FT_PIXEL_MODE_MONO;
+		pmeta->width = gfb_mini(slot->bitmap.width, UINT8_MAX);
+		pmeta->height = gfb_mini(slot->bitmap.rows, UINT8_MAX);
+		pmeta->xbearing = (slot->metrics.horiBearingX / 64);
+		pmeta->ybearing = (slot->metrics.horiBearingY / 64);
+		pmeta->xadvance = (slot->advance.x / 64);
+#else
+		gfb_glyphcache_unlock();
+		pmeta->flags = GFB_ISCACHED;
+		return;
+#endif
 	}
 
-	size_t metaSize = sizeof (gfb_fft_meta_t) * n;
+	//Full-width glyphs use the whole stride, packed glyphs only take the bytes they cover.
+	int ncols = gfb_mini(pfont->stride, pmeta->width);
+	int nlines = gfb_mini(pfont->h, pmeta->height);
+	int pitch = gfb_fft_pitch(pfont, pmeta);
+
+	if (pfont->packed) {
+		size_t offset = ncols * nlines > 0 ? gfb_fft_reserve(pfont, (size_t)pitch * nlines) : 0;
+		if (offset == SIZE_MAX) {
+			//Does not fit at all, keep the metrics and draw it blank.
+			pmeta->width = pmeta->height = 0;
+			ncols = nlines = 0;
+			offset = 0;
+		}
+		pmeta->offset = (uint32_t)offset;
+	} else {
+		//Clear out cache entry.
+		pmeta->offset = (uint32_t)idx * pfont->gsize;
+		memset(&pfont->pcache[pmeta->offset], 0x00, pfont->gsize);
+	}
 
-	pfft->pmeta = calloc(1, metaSize);
-	if (pfft->pmeta == NULL) {
-		free(pfft->pmeta);
-		return GFB_ENOMEM;	//Out of memory.
+	if (srcwidth > pfont->w) {
+		pmeta->flags |= GFB_ISFULLWIDTH;
 	}
 
-	pfft->parentid = fontid;
-	pfft->count = n;
-	pfft->w = w;
-	pfft->h = h;
-	pfft->ptsize = ptsize;
-	pfft->stride = (w * 2);
-	pfft->gsize = ((w * 2) * h);
+	uint8_t *pdstrow = &pfont->pcache[pmeta->offset];
+	for (int i = 0; i < nlines; i++) {
+		//Copy row over, converting to the depth of the cache.
+		if (pfont->depth == 1 && mono) {
+			memcpy(pdstrow, psrcrow, gfb_fft_rowbytes(pfont, ncols));
+		} else if (pfont->depth == 1) {
+			memset(pdstrow, 0x00, gfb_fft_rowbytes(pfont, ncols));
+			for (int j = 0; j < ncols; j++) {
+				if (psrcrow[j] >= 128) pdstrow[j >> 3] |= 0x80 >> (j & 7);
+			}
+		} else if (mono) {
+			for (int j = 0; j < ncols; j++) {
+				uint8_t v = (psrcrow[j >> 3] & (0x80 >> (j & 7))) ? 0xff : 0x00;
+				if (pfont->depth == 8) pdstrow[j] = v; else pdstrow[j >> 1] = (pdstrow[j >> 1] & (0x0f << ((j & 1) << 2))) | ((v & 0x0f) << ((~j & 1) << 2));
+			}
+		} else if (pfont->depth == 4) {
+			for (int j = 0; j < ncols; j++) {
+				uint8_t v = (uint8_t)((psrcrow[j] * 15 + 127) / 255);
+				pdstrow[j >> 1] = (pdstrow[j >> 1] & (0x0f << ((j & 1) << 2))) | (v << ((~j & 1) << 2));
+			}
+		} else {
+			memcpy(pdstrow, psrcrow, ncols);
+		}
 
-	printf("Allocated %zu for glyph cache.\r\n", slotSize + metaSize);
+		//Advance by row in source and destination buffers.
+		pdstrow += pitch;
+		psrcrow += srcpitch;
+	}
+	gfb_glyphcache_unlock();
 
-	return GFB_OK;
+	pmeta->flags |= GFB_ISCACHED;
 }
 
-void gfb_fft_destroy(gfb_fft_t *pfont) {
-	if (pfont == NULL) return;
+/** Slot a code point missing from the cache goes into, an empty one if there is one, otherwise the one unused for the longest. */
+static inline int gfb_fft_victim(const gfb_fft_t *pfont, uint16_t code) {
+	int first = gfb_fft_set(pfont, code);
+	int idx = first;
 
-	if (pfont->pmeta != NULL) {
-		free(pfont->pmeta);
-		pfont->pmeta = NULL;
+	for (int i = first; i < first + pfont->ways; i++) {
+		if (!(pfont->pmeta[i].flags & GFB_ISCACHED)) return i;
+		if (pfont->tick - pfont->plastuse[i] > pfont->tick - pfont->plastuse[idx]) idx = i;
 	}
 
-	if (pfont->pcache != NULL) {
-		free(pfont->pcache);
-		pfont->pcache = NULL;
+	return idx;
+}
+
+/**
+Find the slot of a code point, rendering it into the least recently used slot of its set on a miss.
+@return Returns the slot index.
+*/
+static int gfb_fft_slot(gfb_fft_t *pfont, uint16_t code) {
+	int idx = gfb_fft_find(pfont, code);
+
+	pfont->tick++;
+	if (idx >= 0) {
+		pfont->hits++;
+	} else {
+		idx = gfb_fft_victim(pfont, code);
+		pfont->misses++;
+		if (pfont->pmeta[idx].flags & GFB_ISCACHED) pfont->evictions++;
+		gfb_fft_render(pfont, idx, code);
 	}
+	pfont->plastuse[idx] = pfont->tick;
+
+	return idx;
 }
 
 int gfb_fft_cache(gfb_fft_t *pfont, uint16_t code) {
 	if (pfont == NULL) return GFB_EARGUMENT;
 
-	uint16_t idx = code % pfont->count;
+	gfb_fft_slot(pfont, code);
 
-	if (pfont->pmeta[idx].code == code) {
-		//Already in cache.
-		return GFB_OK;
+	return GFB_OK;
+}
+
+int gfb_fft_warmup(gfb_fft_t *pfont, const char *pzutf8) {
+	if (pfont == NULL || pzutf8 == NULL) return GFB_EARGUMENT;
+
+	const uint8_t *p = (const uint8_t *)pzutf8;
+	uint32_t code;
+
+	while (gfb_utf8_next(&p, &code)) {
+		if (code != 0 && code <= UINT16_MAX && gfb_fft_find(pfont, code) < 0) gfb_fft_slot(pfont, code);
 	}
 
-	//Clear out cache entry.
-	memset(&pfont->pcache[idx * pfont->gsize], 0x00, pfont->gsize);
+	return GFB_OK;
+}
 
-	/*FT_Error error = */FT_Set_Char_Size( gfb_fontstore[pfont->parentid], pfont->ptsize * 64, 0, 100, 0 );
-	/* FIXME ignoring errors is not cool */
+/** Identifies a fixed font file, "GFFT" when read in the byte order it was written in. */
+#define GFB_FFT_MAGIC	0x54464647u
+
+/** Layout of fixed font files, bumped whenever gfb_fftfile_t or gfb_fft_meta_t change. */
+#define GFB_FFT_VERSION	4
+
+/** Header of a fixed font file, followed by the metadata and the coverage of every slot. */
+typedef struct gfb_fftfile {
+	uint32_t magic;			/**< GFB_FFT_MAGIC. */
+	uint32_t version;		/**< GFB_FFT_VERSION. */
+	uint16_t metasize;		/**< Size of gfb_fft_meta_t. */
+	uint16_t count;			/**< Number of slots. */
+	uint16_t gsize;			/**< Bytes per glyph. */
+	uint16_t ways;			/**< Slots per set. */
+	uint16_t nsets;			/**< Number of sets. */
+	uint8_t ptsize;			/**< Point size of rendered glyphs. */
+	uint8_t stride;			/**< Pixels per row. */
+	uint8_t w;				/**< Nominal width of each glyph. */
+	uint8_t h;				/**< Height of each glyph. */
+	uint8_t packed;			/**< Non-zero if glyphs are packed at their own size. */
+	uint8_t depth;			/**< Bits of coverage per pixel, 8, 4 or 1. */
+	uint32_t metaoffset;	/**< File offset of the metadata. */
+	uint32_t cacheoffset;	/**< File offset of the coverage, 16 byte aligned. */
+	uint32_t cachesize;		/**< Bytes of coverage. */
+	uint32_t used;			/**< Bytes of coverage handed out in a packed cache. */
+} gfb_fftfile_t;
+
+int gfb_fft_save(const gfb_fft_t *pfont, const char *pzpath) {
+	if (pfont == NULL || pfont->pmeta == NULL || pfont->pcache == NULL || pzpath == NULL) return GFB_EARGUMENT;
+
+	size_t metasize = sizeof(gfb_fft_meta_t) * pfont->count;
+	gfb_fftfile_t file = {
+		.magic = GFB_FFT_MAGIC,
+		.version = GFB_FFT_VERSION,
+		.metasize = sizeof(gfb_fft_meta_t),
+		.count = pfont->count,
+		.gsize = pfont->gsize,
+		.ways = pfont->ways,
+		.nsets = pfont->nsets,
+		.ptsize = pfont->ptsize,
+		.stride = pfont->stride,
+		.w = pfont->w,
+		.h = pfont->h,
+		.packed = pfont->packed,
+		.depth = pfont->depth,
+		.cachesize = (uint32_t)pfont->cachesize,
+		.used = (uint32_t)pfont->used,
+		.metaoffset = sizeof(gfb_fftfile_t),
+		.cacheoffset = (uint32_t)((sizeof(gfb_fftfile_t) + metasize + 15) & ~(size_t)15)
+	};
+	size_t padlen = file.cacheoffset - sizeof(file) - metasize;
+	uint8_t padding[16] = { 0 };
 
-	FT_GlyphSlot slot = gfb_fontstore[pfont->parentid]->glyph;
-	FT_Vector pen;
+	FILE *F = fopen(pzpath, "wb");
+	if (F == NULL) {
+		return GFB_EFILEOPEN;
+	}
 
-	pen.x = 0;
-	pen.y = 0;
+	if (
+		   fwrite(&file, sizeof(file), 1, F) != 1
+		|| fwrite(pfont->pmeta, metasize, 1, F) != 1
+		|| (padlen > 0 && fwrite(padding, padlen, 1, F) != 1)
+		|| fwrite(pfont->pcache, pfont->cachesize, 1, F) != 1
+	) {
+		fclose(F);
+		return GFB_EFILEWRITE;
+	}
 
-	/* set transformation */
-	FT_Set_Transform( gfb_fontstore[pfont->parentid], /*&matrix*/ 0, &pen );
+	if (fclose(F) != 0) {
+		return GFB_EFILEWRITE;
+	}
 
-	/* load glyph image into the slot (erase previous one) */
-	/*error = */FT_Load_Char( gfb_fontstore[pfont->parentid], code, FT_LOAD_RENDER);// | FT_LOAD_FORCE_AUTOHINT );
-	/* FIXME ignoring errors is not cool */
+	return GFB_OK;
+}
 
-	if (slot->bitmap.width > 0 && slot->bitmap.rows > 0) {
-		int ncols = gfb_mini(pfont->w, slot->bitmap.width);
-		int nlines = gfb_mini(pfont->h, slot->bitmap.rows);
+int gfb_fft_open(gfb_fft_t *pfft, const char *pzpath, gfb_font_id fontid) {
+	if (pfft == NULL || pzpath == NULL) return GFB_EARGUMENT;
 
-		uint8_t *psrcrow = &slot->bitmap.buffer[0];
-		uint8_t *pdstrow = &pfont->pcache[idx * pfont->gsize];
+	memset(pfft, 0x00, sizeof(gfb_fft_t));
+	pfft->parentid = -1;
 
-		if (slot->bitmap.width > (unsigned int)(pfont->w)) {
-			pfont->pmeta[idx].flags |= GFB_ISFULLWIDTH;
-		} else {
-			pfont->pmeta[idx].flags &= ~GFB_ISFULLWIDTH;
-		}
+	int fd = open(pzpath, O_RDONLY);
+	if (fd < 0) {
+		return GFB_EFILEOPEN;
+	}
 
-		for (int i = 0; i < nlines; i++) {
-			//Copy row over.
-			memcpy(pdstrow, psrcrow, ncols);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(gfb_fftfile_t)) {
+		close(fd);
+		return GFB_EFILEREAD;
+	}
+
+	//Private and writable so glyphs missing from the file can still be rendered into it.
+	size_t mapsize = (size_t)st.st_size;
+	uint8_t *pmapping = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pmapping == MAP_FAILED) {
+		return GFB_EFILEREAD;
+	}
+
+	const gfb_fftfile_t *pfile = (const gfb_fftfile_t *)pmapping;
+	if (
+		   pfile->magic != GFB_FFT_MAGIC
+		|| pfile->version != GFB_FFT_VERSION
+		|| pfile->metasize != sizeof(gfb_fft_meta_t)
+		|| pfile->count == 0
+		|| pfile->ways == 0
+		|| pfile->nsets == 0
+		|| (uint32_t)pfile->ways * pfile->nsets > pfile->count
+		|| pfile->stride != pfile->w * 2
+		|| (pfile->depth != 8 && pfile->depth != 4 && pfile->depth != 1)
+		|| pfile->gsize != (pfile->stride * pfile->depth + 7) / 8 * pfile->h
+		|| pfile->metaoffset % sizeof(uint32_t) != 0
+		|| pfile->metaoffset + (size_t)pfile->count * sizeof(gfb_fft_meta_t) > mapsize
+		|| (!pfile->packed && pfile->cachesize != (size_t)pfile->count * pfile->gsize)
+		|| pfile->used > pfile->cachesize
+		|| pfile->cacheoffset + (size_t)pfile->cachesize > mapsize
+	) {
+		munmap(pmapping, mapsize);
+		return GFB_EFILEREAD;
+	}
 
-			//Advance by row in source and destination buffers.
-			pdstrow += pfont->stride;
-			psrcrow += slot->bitmap.width;
+	pfft->packed = pfile->packed;
+	pfft->depth = pfile->depth;
+	pfft->stride = pfile->stride;
+	pfft->h = pfile->h;
+	pfft->gsize = pfile->gsize;
+
+	//Every cached glyph has to lie within the coverage.
+	const gfb_fft_meta_t *pmeta = (const gfb_fft_meta_t *)&pmapping[pfile->metaoffset];
+	for (int i = 0; i < pfile->count; i++, pmeta++) {
+		size_t size = pfile->packed ? gfb_fft_glyphsize(pfft, pmeta) : pfile->gsize;
+		if (!(pmeta->flags & GFB_ISCACHED) || size == 0) continue;
+		if (pmeta->offset + size > (pfile->packed ? pfile->used : pfile->cachesize)) {
+			munmap(pmapping, mapsize);
+			return GFB_EFILEREAD;
 		}
+		pfft->live += gfb_fft_glyphsize(pfft, pmeta);
 	}
 
-	pfont->pmeta[idx].width = (slot->bitmap.width);
-	pfont->pmeta[idx].height = (slot->bitmap.rows);
-	pfont->pmeta[idx].xbearing = (slot->metrics.horiBearingX / 64);
-	pfont->pmeta[idx].ybearing = (slot->metrics.horiBearingY / 64);
-	pfont->pmeta[idx].xadvance = (slot->advance.x / 64);
+	pfft->plastuse = calloc(pfile->count, sizeof(uint32_t));
+	if (pfft->plastuse == NULL) {
+		munmap(pmapping, mapsize);
+		return GFB_ENOMEM;
+	}
 
-	pfont->pmeta[idx].code = code;
+	gfb_glyphcache_lock();
+	pfft->parentid = gfb_font_ref(fontid) == GFB_OK ? fontid : -1;
+	gfb_glyphcache_unlock();
+	pfft->count = pfile->count;
+	pfft->gsize = pfile->gsize;
+	pfft->ptsize = pfile->ptsize;
+	pfft->stride = pfile->stride;
+	pfft->w = pfile->w;
+	pfft->h = pfile->h;
+	pfft->ways = pfile->ways;
+	pfft->nsets = pfile->nsets;
+	pfft->pmeta = (gfb_fft_meta_t *)&pmapping[pfile->metaoffset];
+	pfft->pcache = &pmapping[pfile->cacheoffset];
+	pfft->cachesize = pfile->cachesize;
+	pfft->used = pfile->used;
+	pfft->pmapping = pmapping;
+	pfft->mapsize = mapsize;
 
 	return GFB_OK;
 }
 
-int gfb_fft_draw(gfb_surface_t *pdest, gfb_fft_t *pfont, uint16_t code, int x, int y, int xmax, int ymax, gfb_color_t colorf, gfb_color_t colorb) {
-	if (pfont == NULL || x >= pdest->w || y >= pdest->h) return GFB_EARGUMENT;
+/** Build the coverage to pixel table of a fixed font for a pair of colors, skipped if it is up to date. */
+static void gfb_fft_lut(gfb_fft_t *pfont, gfb_surface_t *pdest, gfb_color_t colorf, gfb_color_t colorb) {
+	const gfb_pixelformat_t *pformat = pdest->pformat;
+
+	if (pfont->plutformat == pformat && pfont->lutcolorf == colorf && pfont->lutcolorb == colorb) return;
+
+	uint8_t sr = (uint8_t)((colorf & pformat->rmask) >> pformat->rshift);
+	uint8_t sg = (uint8_t)((colorf & pformat->gmask) >> pformat->gshift);
+	uint8_t sb = (uint8_t)((colorf & pformat->bmask) >> pformat->bshift);
+	uint8_t da = (uint8_t)((colorb & pformat->amask) >> pformat->ashift);
+	uint8_t dr = (uint8_t)((colorb & pformat->rmask) >> pformat->rshift);
+	uint8_t dg = (uint8_t)((colorb & pformat->gmask) >> pformat->gshift);
+	uint8_t db = (uint8_t)((colorb & pformat->bmask) >> pformat->bshift);
+
+	for (int i = 0; i < 256; i++) {
+		float a = (float)i / 255.0f;
+		pfont->lut[i] = gfb_maprgba(
+			pdest,
+			(uint8_t)(a * sr + (1 - a) * dr),
+			(uint8_t)(a * sg + (1 - a) * dg),
+			(uint8_t)(a * sb + (1 - a) * db),
+			da
+		);
+	}
 
-	uint16_t idx = code % pfont->count;
+	pfont->plutformat = pformat;
+	pfont->lutcolorf = colorf;
+	pfont->lutcolorb = colorb;
+}
 
-	gfb_color_t row[256];
+int gfb_fft_draw(gfb_surface_t *pdest, gfb_fft_t *pfont, uint16_t code, int x, int y, int xmax, int ymax, gfb_color_t colorf, gfb_color_t colorb) {
+	if (pfont == NULL || x >= pdest->w || y >= pdest->h) return GFB_EARGUMENT;
 
-	//Prepare a row of background color.
-	for (int i = 0; i < pfont->w; i++) {
-		row[i] = colorb;
-	}
+	unsigned int bpp = pdest->pformat->bytesperpixel;
 
 	//Cache this code point if needed.
-	if (pfont->pmeta[idx].code != code) {
-		gfb_fft_cache(pfont, code);
-	}
+	int idx = gfb_fft_slot(pfont, code);
 
 	//Render the cached entry.
 	int ncols = pfont->pmeta[idx].xadvance;
-	int nlines = pfont->pmeta[idx].height;
+	int nlines = gfb_mini(pfont->pmeta[idx].height, pfont->h);
+	int pitch = gfb_fft_pitch(pfont, &pfont->pmeta[idx]);
+	int width = gfb_mini(pfont->pmeta[idx].width, pfont->stride);
 
 	if (x + ncols >= pdest->w || y + nlines >= pdest->h) return GFB_EWOULDCLIP;	//Won't fit on screen.
 	if (x + ncols >= xmax/* FIXME || y + nlines >= ymax*/) {
@@ -1671,59 +5976,40 @@ int gfb_fft_draw(gfb_surface_t *pdest, gfb_fft_t *pfont, uint16_t code, int x, i
 		return GFB_EWOULDCLIP;	//Won't fit on target area.
 	}
 
-	uint8_t *psrcrow = &pfont->pcache[idx * pfont->gsize];
+	//Every coverage value blended once per color pair, pixels are then a table lookup.
+	gfb_fft_lut(pfont, pdest, colorf, colorb);
+	const gfb_color_t *plut = pfont->lut;
+
+	uint8_t *psrcrow = &pfont->pcache[pfont->pmeta[idx].offset];
 	uint8_t *pdstrow = &pdest->pbuffer[ pdest->prowoffsets[y - pfont->pmeta[idx].ybearing] + pdest->pcoloffsets[x + pfont->pmeta[idx].xbearing] ];
 	uint8_t *pdstrow2 = &pdest->pbuffer[ pdest->prowoffsets[y - pfont->pmeta[idx].ybearing] + pdest->pcoloffsets[x]];
 
-	uint8_t sr = (uint8_t)((colorf & pdest->pformat->rmask) >> pdest->pformat->rshift);
-	uint8_t sg = (uint8_t)((colorf & pdest->pformat->gmask) >> pdest->pformat->gshift);
-	uint8_t sb = (uint8_t)((colorf & pdest->pformat->bmask) >> pdest->pformat->bshift);
-
 	for (int i = 0; i < nlines; i++) {
+		uint8_t *pdstpix = pdstrow2;
+		int j;
+
+		if (pdest->flags & GFB_TRANSPARENTTEXT) {
+			//Only the glyph coverage, blended over the surface.
+			gfb_fft_maskspan(pdstrow, psrcrow, 0, gfb_mini(ncols, width), pfont->depth, colorf, pdest->pformat);
+			psrcrow += pitch;
+			pdstrow += pdest->pitch;
+			continue;
+		}
 
-		uint8_t *psrcpix = psrcrow;
-		uint8_t *pdstpix = pdstrow;
-
-		//FIXME, bytes per color on destination surface!
-		memcpy(pdstrow2, row, ncols * sizeof(gfb_color_t));
-
-		for (int j = 0; j < ncols; j++) {
-			//If within the rendered area.
-			if (i <= pfont->pmeta[idx].height && j <= pfont->pmeta[idx].width) {
-				uint8_t sa = *psrcpix;
-
-				//Fetch and decode destination pixel.
-				uint8_t da = (uint8_t)((colorb & pdest->pformat->amask) >> pdest->pformat->ashift);
-				uint8_t dr = (uint8_t)((colorb & pdest->pformat->rmask) >> pdest->pformat->rshift);
-				uint8_t dg = (uint8_t)((colorb & pdest->pformat->gmask) >> pdest->pformat->gshift);
-				uint8_t db = (uint8_t)((colorb & pdest->pformat->bmask) >> pdest->pformat->bshift);
-
-				float a = (float)sa / 255.0f;
-
-				//Encode and write to destination.
-				gfb_color_t destcolor = gfb_maprgba(
-					pdest,
-					(uint8_t)(a * sr + (1 - a) * dr),
-					(uint8_t)(a * sg + (1 - a) * dg),
-					(uint8_t)(a * sb + (1 - a) * db),
-					da
-				);
-				memcpy(pdstpix, &destcolor, pdest->pformat->bytesperpixel);
-				//gfb_putpixel(pdest, x + j, y + i - pfont->pmeta[idx].ybearing, destcolor);
-
-				//Advance pixel positions.
-				psrcpix += 1;
-				pdstpix += pdest->pformat->bytesperpixel;
+		//Background under the bearing.
+		for (j = 0; j < ncols; j++, pdstpix += bpp) {
+			gfb_pokepixel(pdstpix, colorb, bpp);
+		}
 
-			} else {
-				//Fill rest of box with background.
-				memcpy(pdstpix, &colorb, pdest->pformat->bytesperpixel);
-				psrcpix += 1;
-				pdstpix += pdest->pformat->bytesperpixel;
-			}
+		//Glyph coverage within the rendered area, background past it.
+		j = gfb_mini(ncols, width);
+		gfb_fft_span(pdstrow, psrcrow, 0, j, pfont->depth, plut, bpp);
+		pdstpix = pdstrow + j * bpp;
+		for (; j < ncols; j++, pdstpix += bpp) {
+			gfb_pokepixel(pdstpix, colorb, bpp);
 		}
 
-		psrcrow += pfont->stride;
+		psrcrow += pitch;
 		pdstrow += pdest->pitch;
 		pdstrow2 += pdest->pitch;
 	}
@@ -1732,32 +6018,163 @@ int gfb_fft_draw(gfb_surface_t *pdest, gfb_fft_t *pfont, uint16_t code, int x, i
 }
 
 int gfb_fft_iscached(gfb_fft_t *pfont, uint16_t code) {
-	return (pfont != NULL && pfont->pmeta[(code % pfont->count)].code == code);
+	return (pfont != NULL && gfb_fft_find(pfont, code) >= 0);
 }
 
-int gfb_fft_text(gfb_surface_t *psurface, gfb_fft_t *pfont, int x, int y, int w, int h, char *pzutf8, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
-	if (psurface == NULL || pfont == NULL || count <= 0 || x < 0 || y < 0 || (x + pfont->w) >= psurface->w || (y + pfont->h) >= psurface->h) {
-		return GFB_EARGUMENT;
+/** Number of glyphs a line of fixed font text is composited in at once. */
+#define GFB_FFT_LINE	128
+
+/** Glyph placed on a line of fixed font text, see gfb_fft_line(). */
+typedef struct gfb_fftcell {
+	int idx;		/**< Cache slot of the glyph. */
+	int x1;			/**< Left edge of the cell. */
+	int x2;			/**< Right edge of the cell, the left edge of the next one. */
+	int gx;			/**< Left edge of the glyph coverage. */
+	int gw;			/**< Number of coverage columns. */
+	int top;		/**< Top row of the glyph coverage. */
+	int height;		/**< Number of coverage rows. */
+} gfb_fftcell_t;
+
+/**
+Write the cells of a line row by row, each destination pixel once.
+With fill set every row of the band is written, with it unset a cell only writes the rows of its glyph.
+With GFB_TRANSPARENTTEXT set on the surface only the glyph coverage is blended over the pixels.
+*/
+static void gfb_fft_compose(gfb_surface_t *psurface, const gfb_fft_t *pfont, const gfb_fftcell_t *pcells, int ncells, int x2, int y1, int y2, int fill, gfb_color_t colorf, gfb_color_t colorb) {
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	unsigned int bpp = psurface->pformat->bytesperpixel;
+	const gfb_color_t *plut = pfont->lut;
+	int transparent = (psurface->flags & GFB_TRANSPARENTTEXT) != 0;
+	int cx1 = pclip->x, cx2 = gfb_mini(pclip->x + pclip->w, x2);
+
+	y1 = gfb_maxi(y1, pclip->y);
+	y2 = gfb_mini(y2, pclip->y + pclip->h);
+
+	for (int row = y1; row < y2; row++) {
+		uint8_t *pdstrow = &psurface->pbuffer[psurface->prowoffsets[row]];
+
+		for (int c = 0; c < ncells; c++) {
+			const gfb_fftcell_t *pcell = &pcells[c];
+			int inglyph = row >= pcell->top && row < pcell->top + pcell->height;
+			int a = gfb_maxi(pcell->x1, cx1), b = gfb_mini(pcell->x2, cx2);
+			int g1 = gfb_clampi(pcell->gx, a, b), g2 = gfb_clampi(pcell->gx + pcell->gw, g1, b);
+
+			if (a >= b || (!fill && !inglyph)) continue;
+			if (!inglyph) g1 = g2 = b;
+
+			uint8_t *pdst = &pdstrow[psurface->pcoloffsets[a]];
+			if (a < g1 && !transparent) gfb_fillrow(pdst, g1 - a, colorb, bpp);
+			pdst += (g1 - a) * bpp;
+			if (g1 < g2) {
+				const gfb_fft_meta_t *pmeta = &pfont->pmeta[pcell->idx];
+				const uint8_t *psrc = &pfont->pcache[pmeta->offset + (row - pcell->top) * gfb_fft_pitch(pfont, pmeta)];
+				if (transparent) {
+					gfb_fft_maskspan(pdst, psrc, g1 - pcell->gx, g2 - g1, pfont->depth, colorf, psurface->pformat);
+				} else {
+					gfb_fft_span(pdst, psrc, g1 - pcell->gx, g2 - g1, pfont->depth, plut, bpp);
+				}
+				pdst += (g2 - g1) * bpp;
+			}
+			if (g2 < b && !transparent) gfb_fillrow(pdst, b - g2, colorb, bpp);
+		}
+
+		if (fill && ncells > 0) {
+			//Pad the rest of the box.
+			int col = gfb_maxi(pcells[ncells - 1].x2, cx1);
+			if (col < cx2) gfb_fillrow(&pdstrow[psurface->pcoloffsets[col]], cx2 - col, colorb, bpp);
+		}
 	}
+}
 
-	size_t cursor = 0;
-	int is_valid = 0;
-	unsigned int code = 0;
-	size_t zlen = strlen(pzutf8);
-	unsigned int i = 0;
+/**
+Draw a line of fixed font text from either a UTF-8 string or an array of code points.
+The glyphs are gathered first and then composited row by row, GFB_FFT_LINE glyphs at a time. A batch is
+also cut short when a missing glyph would replace one it already holds.
+@param xmax The line ends at the first glyph that would reach this column.
+@param y1 Top row of the box to fill, or of the glyphs if fill is unset.
+@param y2 Bottom row of the box, exclusive.
+@param x2 Right edge of the box, exclusive, padded with the background if fill is set.
+*/
+static inline __attribute__((always_inline)) void gfb_fft_line(gfb_surface_t *psurface, gfb_fft_t *pfont, const uint8_t *putf8, const uint16_t *pcodes, size_t count, int x, int xmax, int x2, int y1, int y2, int baseline, int fill, gfb_color_t colorf, gfb_color_t colorb) {
+	gfb_fftcell_t cells[GFB_FFT_LINE];
+	int ncells = 0;
+	int top = INT_MAX, bottom = INT_MIN;
+	uint32_t code;
+
+	gfb_fft_lut(pfont, psurface, colorf, colorb);
+
+	//Transparent text only blends the glyphs, there is no box to fill.
+	if (psurface->flags & GFB_TRANSPARENTTEXT) fill = 0;
+
+	for (size_t n = 0; n < count; n++) {
+		if (putf8 != NULL) {
+			if (!gfb_utf8_next(&putf8, &code)) break;
+			//Fixed fonts cache 16-bit codes, like gfb_fft_warmup() skip what does not fit.
+			if (code == 0 || code > UINT16_MAX) continue;
+		} else {
+			code = pcodes[n];
+		}
 
-	//Decode UTF-8 string and draw each glyph.
-	while (utf8_get_next_char((uint8_t *)pzutf8, zlen, &cursor, &is_valid, &code)) {
-		if (i >= count) break;
+		int idx = gfb_fft_find(pfont, (uint16_t)code);
+		if (idx < 0 && ncells > 0) {
+			//A packed cache may drop glyphs of any set to make room.
+			int victim = gfb_fft_victim(pfont, (uint16_t)code);
+			int c = pfont->packed ? 0 : ncells;
+			for (int i = 0; i < ncells && c == ncells; i++) {
+				if (cells[i].idx == victim) c = i;
+			}
+			if (c < ncells) {
+				//The glyph about to be rendered could overwrite one still to be drawn.
+				gfb_fft_compose(psurface, pfont, cells, ncells, cells[ncells - 1].x2, fill ? y1 : top, fill ? y2 : bottom, fill, colorf, colorb);
+				ncells = 0;
+				top = INT_MAX;
+				bottom = INT_MIN;
+			}
+		}
 
-		if (is_valid) {
-			if (gfb_fft_draw(psurface, pfont, code, x, y, x + w, y + h, colorf, colorb) != GFB_OK) break;
-			uint16_t idx = code % pfont->count;
-			x += pfont->pmeta[idx].xadvance;
+		idx = gfb_fft_slot(pfont, (uint16_t)code);
+
+		const gfb_fft_meta_t *pmeta = &pfont->pmeta[idx];
+		if (x + pmeta->xadvance >= xmax) break;
+
+		//Bearings are stored as bytes, negative ones wrap around.
+		gfb_fftcell_t *pcell = &cells[ncells++];
+		pcell->idx = idx;
+		pcell->x1 = x;
+		pcell->x2 = x + pmeta->xadvance;
+		pcell->gx = x + (int8_t)pmeta->xbearing;
+		pcell->gw = gfb_mini(pmeta->width, pfont->stride);
+		pcell->top = baseline - (int8_t)pmeta->ybearing;
+		pcell->height = gfb_mini(pmeta->height, pfont->h);
+		top = gfb_mini(top, pcell->top);
+		bottom = gfb_maxi(bottom, pcell->top + pcell->height);
+		x = pcell->x2;
+
+		if (ncells == GFB_FFT_LINE) {
+			gfb_fft_compose(psurface, pfont, cells, ncells, x, fill ? y1 : top, fill ? y2 : bottom, fill, colorf, colorb);
+			ncells = 0;
+			top = INT_MAX;
+			bottom = INT_MIN;
 		}
+	}
+
+	if (ncells > 0) {
+		gfb_fft_compose(psurface, pfont, cells, ncells, fill ? x2 : x, fill ? y1 : top, fill ? y2 : bottom, fill, colorf, colorb);
+	} else if (fill) {
+		//Nothing left to draw, pad from the last glyph to the end of the box.
+		gfb_fftcell_t empty = { .x1 = x, .x2 = x };
+		gfb_fft_compose(psurface, pfont, &empty, 1, x2, y1, y2, fill, colorf, colorb);
+	}
+}
 
-		++i;
+int gfb_fft_text(gfb_surface_t *psurface, gfb_fft_t *pfont, int x, int y, int w, int h, char *pzutf8, size_t count, gfb_color_t colorf, gfb_color_t colorb) {
+	if (psurface == NULL || pfont == NULL || pzutf8 == NULL || count <= 0 || x < 0 || y < 0 || (x + pfont->w) >= psurface->w || (y + pfont->h) >= psurface->h) {
+		return GFB_EARGUMENT;
 	}
+
+	//Glyphs sit on the baseline at y, only the glyph cells are drawn.
+	gfb_fft_line(psurface, pfont, (const uint8_t *)pzutf8, NULL, count, x, x + w, x + w, 0, 0, y, 0, colorf, colorb);
+
 	return GFB_OK;
 }
 
@@ -1772,53 +6189,335 @@ int gfb_fft_textU(gfb_surface_t *psurface, gfb_fft_t *pfont, int x, int y, int w
 		return GFB_EARGUMENT;
 	}
 
-	gfb_color_t bgrow[256];
-	for (size_t i = 0; i < 256; i++) {
-		bgrow[i] = colorb;
+	//Glyphs sit on a baseline 6 pixels above the bottom, the box from (x,y) to (x+w,y+h) is filled.
+	gfb_fft_line(psurface, pfont, NULL, pcodes, count, x, x + w, x + w + 1, y, y + h + 1, y + (h - 6), 1, colorf, colorb);
+
+	return GFB_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+#if GFB_WITH_FREETYPE
+/** Squared distance of a pixel with no feature pixel in its row or column. */
+#define GFB_SDF_FAR	1e20f
+
+/**
+Squared Euclidean distance transform of one row or column, the lower envelope of parabolas of
+Felzenszwalb and Huttenlocher. Run over the columns and then the rows of a field it gives the exact
+squared distance of every pixel to the nearest feature pixel.
+@param pf Samples, 0 on a feature pixel and GFB_SDF_FAR elsewhere on the first pass. Replaced by the result.
+@param n Number of samples.
+@param step Distance between samples in pf[].
+@param pv Scratch of n ints.
+@param pz Scratch of n + 1 floats.
+@param pd Scratch of n floats.
+*/
+static void gfb_sdf_edt(float *pf, int n, int step, int *pv, float *pz, float *pd) {
+	int k = 0;
+
+	pv[0] = 0;
+	pz[0] = -GFB_SDF_FAR;
+	pz[1] = GFB_SDF_FAR;
+	for (int q = 1; q < n; q++) {
+		float fq = pf[q * step] + (float)q * q;
+		float sq;
+		for (;;) {
+			int r = pv[k];
+			sq = (fq - (pf[r * step] + (float)r * r)) / (float)(2 * q - 2 * r);
+			if (sq > pz[k] || k == 0) break;
+			k--;
+		}
+		k++;
+		pv[k] = q;
+		pz[k] = sq;
+		pz[k + 1] = GFB_SDF_FAR;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; q++) {
+		while (pz[k + 1] < q) k++;
+		pd[q] = (float)(q - pv[k]) * (q - pv[k]) + pf[pv[k] * step];
+	}
+	for (int q = 0; q < n; q++) pf[q * step] = pd[q];
+}
+
+/** Squared distance of every pixel of a w x h field to the nearest pixel marked 0 in pf[]. */
+static void gfb_sdf_edt2d(float *pf, int w, int h, int *pv, float *pz, float *pd) {
+	for (int x = 0; x < w; x++) gfb_sdf_edt(&pf[x], h, w, pv, pz, pd);
+	for (int y = 0; y < h; y++) gfb_sdf_edt(&pf[y * w], w, 1, pv, pz, pd);
+}
+
+/** Render a glyph into a cache slot as a distance field, left empty if the font cannot render it. */
+static void gfb_sdf_render(gfb_sdf_t *psdf, int idx, uint32_t code) {
+	gfb_sdf_meta_t *pmeta = &psdf->pmeta[idx];
+	uint8_t *pfield = &psdf->pcache[(size_t)idx * psdf->cellw * psdf->cellh];
+	gfb_fontentry_t *pentry = gfb_font_entry(psdf->parentid);
+	int spread = psdf->spread;
+
+	memset(pmeta, 0x00, sizeof(gfb_sdf_meta_t));
+	pmeta->code = code;
+	pmeta->flags = GFB_ISCACHED;
+	if (pentry == NULL || pentry->face == NULL) return;
+
+	//The face glyph slot is shared with the text renderer. Unhinted, the outline scales evenly.
+	gfb_glyphcache_lock();
+	if (gfb_font_setsize(psdf->parentid, psdf->ptsize) != GFB_OK || FT_Load_Char(pentry->face, code, FT_LOAD_RENDER | FT_LOAD_NO_HINTING) != 0) {
+		gfb_glyphcache_unlock();
+		return;
 	}
 
-	uint8_t *pdstrow;
-	int x1, y1, y2;
+	FT_GlyphSlot slot = pentry->face->glyph;
+	FT_Bitmap *pbitmap = &slot->bitmap;
+	int mono = pbitmap->pixel_mode == FT_PIXEL_MODE_MONO;
+	int w = gfb_mini((int)pbitmap->width + 2 * spread, psdf->cellw);
+	int h = gfb_mini((int)pbitmap->rows + 2 * spread, psdf->cellh);
+	size_t size = (size_t)w * h;
+	int n = gfb_maxi(w, h);
+
+	pmeta->advance = (int32_t)slot->advance.x;
+	pmeta->left = (int16_t)(slot->bitmap_left - spread);
+	pmeta->top = (int16_t)(slot->bitmap_top + spread);
+
+	//Coverage over the padded field and scratch for the distance transform.
+	size_t covsize = (size + sizeof(float) - 1) / sizeof(float) * sizeof(float);
+	uint8_t *pcov = calloc(1, covsize + size * 2 * sizeof(float) + (size_t)n * sizeof(int) + (size_t)(2 * n + 1) * sizeof(float));
+	if (pcov == NULL || (pbitmap->pixel_mode != FT_PIXEL_MODE_GRAY && !mono)) {
+		gfb_glyphcache_unlock();
+		free(pcov);
+		return;
+	}
+	for (int y = spread; y < h && y - spread < (int)pbitmap->rows; y++) {
+		const uint8_t *psrc = &pbitmap->buffer[(y - spread) * pbitmap->pitch];
+		for (int x = spread; x < w && x - spread < (int)pbitmap->width; x++) {
+			int i = x - spread;
+			pcov[y * w + x] = mono ? ((psrc[i >> 3] & (0x80 >> (i & 7))) ? 255 : 0) : psrc[i];
+		}
+	}
+	gfb_glyphcache_unlock();
+
+	float *pout = (float *)&pcov[covsize];
+	float *pin = &pout[size];
+	int *pv = (int *)&pin[size];
+	float *pz = (float *)&pv[n];
+	float *pd = &pz[n + 1];
+
+	//Distance to the nearest pixel inside the glyph, and to the nearest one outside it.
+	for (size_t i = 0; i < size; i++) {
+		pout[i] = pcov[i] >= 128 ? 0.0f : GFB_SDF_FAR;
+		pin[i] = pcov[i] >= 128 ? GFB_SDF_FAR : 0.0f;
+	}
+	gfb_sdf_edt2d(pout, w, h, pv, pz, pd);
+	gfb_sdf_edt2d(pin, w, h, pv, pz, pd);
+
+	//Positive outside, edge pixels take the distance from their coverage.
+	float scale = 127.0f / spread;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			size_t i = (size_t)y * w + x;
+			float d;
+			if (pcov[i] > 0 && pcov[i] < 255) {
+				d = 0.5f - pcov[i] / 255.0f;
+			} else if (pcov[i] == 0) {
+				d = sqrtf(pout[i]) - 0.5f;
+			} else {
+				d = 0.5f - sqrtf(pin[i]);
+			}
+			pfield[y * psdf->cellw + x] = (uint8_t)gfb_clampi((int)floorf(128.0f - d * scale + 0.5f), 0, 255);
+		}
+	}
+	pmeta->w = (uint16_t)w;
+	pmeta->h = (uint16_t)h;
 
-	x1 = x;
-	for (size_t i = 0; i < count; i++) {
-		//Draw glyph at the baseline.
-		if (gfb_fft_draw(psurface, pfont, pcodes[i], x1, y+(h-6), x + w, y + h, colorf, colorb) != GFB_OK) break;
-		uint16_t idx = pcodes[i] % pfont->count;
+	free(pcov);
+}
 
-		//Fill from top of rect to top of text.
-		y1 = y;
-		y2 = (y + h)-6-pfont->pmeta[idx].ybearing;
-		pdstrow = &psurface->pbuffer[psurface->prowoffsets[y1] + psurface->pcoloffsets[x1]];
-		for (; y1 < y2; y1++) {
-			memcpy(pdstrow, bgrow, (pfont->pmeta[idx].xadvance + pfont->pmeta[idx].xbearing) * 4);
-			pdstrow += psurface->pitch;
+/** Slot holding a code point, rendering it into the least recently used slot of its set if needed. */
+static int gfb_sdf_slot(gfb_sdf_t *psdf, uint32_t code) {
+	uint32_t hash = code * 0x9e3779b1u;
+	int first = (int)(((uint64_t)hash * psdf->nsets) >> 32) * psdf->ways;
+	int victim = first;
+
+	for (int idx = first; idx < first + psdf->ways; idx++) {
+		if (psdf->pmeta[idx].code == code && (psdf->pmeta[idx].flags & GFB_ISCACHED)) {
+			psdf->hits++;
+			psdf->plastuse[idx] = ++psdf->tick;
+			return idx;
 		}
+		if (psdf->plastuse[idx] < psdf->plastuse[victim]) victim = idx;
+	}
 
-		//Fill from bottom of text to bottom of rect.
-		y1 = y2 + pfont->pmeta[idx].height;
-		y2 = y + h + 1;
-		pdstrow = &psurface->pbuffer[psurface->prowoffsets[y1] + psurface->pcoloffsets[x1]];
-		for (; y1 <= y2; y1++) {
-			memcpy(pdstrow, bgrow, (pfont->pmeta[idx].xadvance + pfont->pmeta[idx].xbearing) * 4);
-			pdstrow += psurface->pitch;
+	psdf->misses++;
+	if (psdf->pmeta[victim].flags & GFB_ISCACHED) psdf->evictions++;
+	gfb_sdf_render(psdf, victim, code);
+	psdf->plastuse[victim] = ++psdf->tick;
+
+	return victim;
+}
+
+/**
+Blend one layer of a distance field glyph over the surface.
+Each pixel samples the field bilinearly and turns the distance into coverage with a smoothstep.
+@param gx Pixel column of the left edge of the field.
+@param gy Pixel row of the top edge of the field.
+@param scale Pixels drawn per pixel of the field.
+@param offset Pixels the edge is moved out from the outline, the outline width for outlines and shadows.
+@param width Pixels the edge fades over.
+@param color Encoded pixel value of the layer.
+@param alpha Opacity of the layer.
+*/
+static void gfb_sdf_layer(gfb_surface_t *psurface, const gfb_sdf_t *psdf, int idx, float gx, float gy, float scale, float offset, float width, gfb_color_t color, uint8_t alpha) {
+	const gfb_sdf_meta_t *pmeta = &psdf->pmeta[idx];
+	const uint8_t *pfield = &psdf->pcache[(size_t)idx * psdf->cellw * psdf->cellh];
+	const gfb_rect_t *pclip = &psurface->cliprect;
+	const gfb_pixelformat_t *pformat = psurface->pformat;
+	unsigned int bpp = pformat->bytesperpixel;
+	int x1 = gfb_maxi((int)floorf(gx), pclip->x);
+	int y1 = gfb_maxi((int)floorf(gy), pclip->y);
+	int x2 = gfb_mini((int)ceilf(gx + pmeta->w * scale), pclip->x + pclip->w);
+	int y2 = gfb_mini((int)ceilf(gy + pmeta->h * scale), pclip->y + pclip->h);
+
+	//Field value to pixels of distance at this size, positive outside.
+	float tofar = psdf->spread / 127.0f * scale;
+
+	if (pmeta->w < 2 || pmeta->h < 2 || x1 >= x2) return;
+	for (int py = y1; py < y2; py++) {
+		float sy = fminf(fmaxf((py + 0.5f - gy) / scale - 0.5f, 0.0f), pmeta->h - 1.001f);
+		int iy = (int)sy;
+		float fy = sy - iy;
+		const uint8_t *prow0 = &pfield[iy * psdf->cellw];
+		const uint8_t *prow1 = prow0 + psdf->cellw;
+		uint8_t *pdst = &psurface->pbuffer[psurface->prowoffsets[py] + psurface->pcoloffsets[x1]];
+
+		for (int px = x1; px < x2; px++, pdst += bpp) {
+			float sx = fminf(fmaxf((px + 0.5f - gx) / scale - 0.5f, 0.0f), pmeta->w - 1.001f);
+			int ix = (int)sx;
+			float fx = sx - ix;
+			float top = prow0[ix] + (prow0[ix + 1] - prow0[ix]) * fx;
+			float bottom = prow1[ix] + (prow1[ix + 1] - prow1[ix]) * fx;
+			float d = (128.0f - (top + (bottom - top) * fy)) * tofar;
+
+			float t = fminf(fmaxf((d - offset) / width + 0.5f, 0.0f), 1.0f);
+			float coverage = 1.0f - t * t * (3.0f - 2.0f * t);
+			gfb_blendpoke(pdst, color, (uint8_t)(coverage * alpha + 0.5f), pformat, bpp);
 		}
+	}
+}
+
+int gfb_sdf_create(gfb_sdf_t *psdf, gfb_font_id fontid, int ptsize, int n, int spread) {
+	if (psdf == NULL || ptsize < 1 || ptsize > UINT8_MAX || n < 1 || n > UINT16_MAX || spread < 1 || spread > 32) return GFB_EARGUMENT;
 
-		x1 += pfont->pmeta[idx].xadvance;
+	n = gfb_fft_slots(n);
+	memset(psdf, 0x00, sizeof(gfb_sdf_t));
+	psdf->parentid = -1;
+
+	//Hold on to the face and size the slots for the largest glyph at the reference size.
+	gfb_glyphcache_lock();
+	if (gfb_font_ref(fontid) != GFB_OK) {
+		gfb_glyphcache_unlock();
+		return GFB_EARGUMENT;
+	}
+	psdf->parentid = fontid;
+	FT_Face face = gfb_font_entry(fontid)->face;
+	int rc = face != NULL ? gfb_font_setsize(fontid, ptsize) : GFB_ENOTSUPPORTED;	//Bitmap fonts have no outlines.
+	if (rc != GFB_OK) {
+		gfb_glyphcache_unlock();
+		gfb_sdf_destroy(psdf);
+		return rc;
+	}
+	FT_Size_Metrics *pm = &face->size->metrics;
+	FT_Pos w = pm->max_advance, h = pm->ascender - pm->descender;
+	if (FT_IS_SCALABLE(face)) {
+		w = gfb_maxi((int)w, (int)FT_MulFix(face->bbox.xMax - face->bbox.xMin, pm->x_scale));
+		h = gfb_maxi((int)h, (int)FT_MulFix(face->bbox.yMax - face->bbox.yMin, pm->y_scale));
+	}
+	gfb_glyphcache_unlock();
+
+	psdf->cellw = (uint16_t)gfb_mini((int)((w + 63) >> 6) + 2 * spread + 1, UINT8_MAX);
+	psdf->cellh = (uint16_t)gfb_mini((int)((h + 63) >> 6) + 2 * spread + 1, UINT8_MAX);
+	psdf->pcache = malloc((size_t)n * psdf->cellw * psdf->cellh);
+	psdf->pmeta = calloc(n, sizeof(gfb_sdf_meta_t));
+	psdf->plastuse = calloc(n, sizeof(uint32_t));
+	if (psdf->pcache == NULL || psdf->pmeta == NULL || psdf->plastuse == NULL) {
+		gfb_sdf_destroy(psdf);
+		return GFB_ENOMEM;	//Out of memory.
+	}
+
+	psdf->ptsize = ptsize;
+	psdf->spread = spread;
+	psdf->count = n;
+	psdf->ways = gfb_mini(n, GFB_FFT_WAYS);
+	psdf->nsets = n / psdf->ways;
+
+	return GFB_OK;
+}
+
+void gfb_sdf_destroy(gfb_sdf_t *psdf) {
+	if (psdf == NULL) return;
+
+	if (psdf->parentid >= 0) {
+		gfb_glyphcache_lock();
+		gfb_font_release(psdf->parentid);
+		gfb_glyphcache_unlock();
+		psdf->parentid = -1;
+	}
+
+	free(psdf->pcache);
+	free(psdf->pmeta);
+	free(psdf->plastuse);
+	psdf->pcache = NULL;
+	psdf->pmeta = NULL;
+	psdf->plastuse = NULL;
+}
+
+int gfb_sdf_text(gfb_surface_t *psurface, gfb_sdf_t *psdf, float ptsize, int x, int y, const char *pzutf8, size_t count, const gfb_sdf_style_t *pstyle) {
+	if (psurface == NULL || psdf == NULL || psdf->pmeta == NULL || pzutf8 == NULL || pstyle == NULL || !(ptsize > 0.0f)) {
+		return GFB_EARGUMENT;
 	}
 
-	if ((x + w + 1) - x1 > 0) {
-		pdstrow = &psurface->pbuffer[psurface->prowoffsets[y] + psurface->pcoloffsets[x1]];
-		int limit = ((x + w + 1) - x1) * 4;
-		for (y1 = y; y1 <= (y + h + 1); y1++) {
-			memcpy(pdstrow, bgrow, limit);
-			pdstrow += psurface->pitch;
+	float scale = ptsize / psdf->ptsize;
+	float outline = fmaxf(pstyle->outline, 0.0f);
+	uint32_t code;
+
+	//The shadow of every glyph goes first so it never covers a neighbour, then the outlines and the text.
+	for (int layer = pstyle->shadowalpha > 0 ? 0 : 1; layer < 2; layer++) {
+		const uint8_t *putf8 = (const uint8_t *)pzutf8;
+		float penx = (float)x;
+
+		for (size_t n = 0; n < count; n++) {
+			if (!gfb_utf8_next(&putf8, &code)) break;
+			if (code == 0) continue;
+
+			int idx = gfb_sdf_slot(psdf, code);
+			const gfb_sdf_meta_t *pmeta = &psdf->pmeta[idx];
+			float gx = penx + pmeta->left * scale;
+			float gy = y - pmeta->top * scale;
+
+			if (layer == 0) {
+				gfb_sdf_layer(psurface, psdf, idx, gx + pstyle->shadowx, gy + pstyle->shadowy, scale, outline, fmaxf(pstyle->shadowblur, 1.0f), pstyle->colorshadow, pstyle->shadowalpha);
+			} else {
+				if (outline > 0.0f) gfb_sdf_layer(psurface, psdf, idx, gx, gy, scale, outline, 1.0f, pstyle->coloroutline, 255);
+				gfb_sdf_layer(psurface, psdf, idx, gx, gy, scale, 0.0f, 1.0f, pstyle->colorf, 255);
+			}
+
+			penx += pmeta->advance * scale / 64.0f;
 		}
 	}
 
 	return GFB_OK;
 }
+#else
+int gfb_sdf_create(gfb_sdf_t *psdf, gfb_font_id fontid, int ptsize, int n, int spread) {
+	return GFB_ENOTSUPPORTED;
+}
+
+void gfb_sdf_destroy(gfb_sdf_t *psdf) {
+}
 
+int gfb_sdf_text(gfb_surface_t *psurface, gfb_sdf_t *psdf, float ptsize, int x, int y, const char *pzutf8, size_t count, const gfb_sdf_style_t *pstyle) {
+	return GFB_ENOTSUPPORTED;
+}
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
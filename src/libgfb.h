@@ -50,9 +50,19 @@ gfb_surface_destroy(&pscreen);
 extern "C" {
 #endif
 
+/** Non-zero to render true-type fonts with FreeType, 0 builds the library with bitmap fonts only. */
+#ifndef GFB_WITH_FREETYPE
+#define GFB_WITH_FREETYPE	1
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if GFB_WITH_FREETYPE
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
+#endif
 
 /** Round n to next multiple of 4. */
 #define gfb_round4(n) ((n + 3) & ~(3))
@@ -79,13 +89,35 @@ static inline int gfb_mini(int a, int b) {return a<b ? a:b;}
 /** Ensures that x is between the limits set by low and high. If low is greater than high the result is undefined. */
 #define gfb_clampi(x, low, high)  (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
 
-/** Maximum number of font faces that can be loaded on run time. */
-#define MAX_GFB_FONT	10
+/** Maximum number of font faces that can be loaded on run time, the font store grows up to this as fonts are loaded. */
+#ifndef MAX_GFB_FONT
+#define MAX_GFB_FONT	256
+#endif
 
 /** Number of glyph cache elements. */
 #define MAX_GFB_GLYPH	256
 
-/** Identifier for a loaded true-type font. */
+/** Fills of at least this many bytes use non-temporal stores that bypass the cache. */
+#ifndef GFB_STREAM_BYTES
+#define GFB_STREAM_BYTES	(512 * 1024)
+#endif
+
+/** Default memory budget of the glyph cache, see gfb_glyphcache_configure(). */
+#ifndef GFB_GLYPHCACHE_BYTES
+#define GFB_GLYPHCACHE_BYTES	(256 * 1024)
+#endif
+
+/** Default memory budget of the text run cache, see gfb_runcache_configure(). */
+#ifndef GFB_RUNCACHE_BYTES
+#define GFB_RUNCACHE_BYTES		(64 * 1024)
+#endif
+
+/** Number of slots per set in a fixed font cache, see gfb_fft_create(). */
+#ifndef GFB_FFT_WAYS
+#define GFB_FFT_WAYS			4
+#endif
+
+/** Identifier for a loaded true-type or bitmap font. */
 typedef int gfb_font_id;
 
 /** Enough for 32 and 16 bits per pixel. */
@@ -128,6 +160,8 @@ typedef enum gfb_flag_id {
     GFB_SRCCOLORKEY		= (2),	/**< Skip pixels matching the color key. */
     GFB_PREALLOCATE		= (4),	/**< Pre-allocate surface pixel buffer. */
     GFB_DOUBLEBUFFER	= (8),	/**< Use double buffering. */
+    GFB_DRAWBLEND		= (16),	/**< Blend drawing primitives by the surface draw alpha. */
+    GFB_TRANSPARENTTEXT	= (32),	/**< Blend text over the surface instead of filling its background. */
 } gfb_flag_id_t;
 
 /** API constants. */
@@ -163,6 +197,71 @@ typedef struct gfb_poly {
     gfb_point_t *points;	/**< Every point in the polygon. */
 } gfb_poly_t;
 
+/** Rules to tell which areas of a self-intersecting shape are inside. */
+typedef enum gfb_fillrule {
+	GFB_FILL_EVENODD,	/**< Inside where a ray from the point crosses an odd number of edges. */
+	GFB_FILL_NONZERO,	/**< Inside where the edges wind around the point a non-zero number of times. */
+} gfb_fillrule_t;
+
+/** 2D position with sub-pixel precision. */
+typedef struct gfb_pointf {
+    float x;	/**< Horizontal position, pixel centers are at .5. */
+    float y;	/**< Vertical position, pixel centers are at .5. */
+} gfb_pointf_t;
+
+/** Sub-path of a gfb_path_t, a run of flattened points. */
+typedef struct gfb_contour {
+	size_t first;	/**< Index of the first point in the path points array. */
+	size_t count;	/**< Number of points in the contour. */
+	int closed;		/**< Non-zero if the stroke returns from the last point to the first. */
+} gfb_contour_t;
+
+/** Vector path, curves are flattened to lines as they are added. See gfb_path_create(). */
+typedef struct gfb_path {
+	gfb_pointf_t *ppoints;		/**< Flattened points of every contour. */
+	size_t count;				/**< Number of items used in ppoints[]. */
+	size_t size;				/**< Number of items allocated in ppoints[]. */
+	gfb_contour_t *pcontours;	/**< Contours in the order they were started. */
+	size_t ncontours;			/**< Number of items used in pcontours[]. */
+	size_t contoursize;			/**< Number of items allocated in pcontours[]. */
+	float tolerance;			/**< Largest distance in pixels between a curve and its flattened lines. */
+	float *pcells;				/**< Coverage accumulation buffer, kept zeroed between renders. */
+	size_t cellcount;			/**< Number of items allocated in pcells[]. */
+} gfb_path_t;
+
+/** Largest number of color stops in a gfb_gradient_t. */
+#define MAX_GFB_GRADIENT_STOPS 8
+
+/** Shapes of gradient. */
+typedef enum gfb_gradienttype {
+	GFB_GRADIENT_LINEAR,	/**< Colors change along the line from (x0, y0) to (x1, y1). */
+	GFB_GRADIENT_RADIAL,	/**< Colors change with the distance from (x0, y0). */
+} gfb_gradienttype_t;
+
+/** Color of a gradient at one offset. */
+typedef struct gfb_gradientstop {
+	float offset;	/**< Position along the gradient, 0 to 1. */
+	uint8_t red;	/**< Red component, 0-255. */
+	uint8_t green;	/**< Green component, 0-255. */
+	uint8_t blue;	/**< Blue component, 0-255. */
+	uint8_t alpha;	/**< Opacity, 0 is transparent and 255 is opaque. */
+} gfb_gradientstop_t;
+
+/** Linear or radial color gradient, see gfb_gradient_linear() and gfb_gradient_radial(). */
+typedef struct gfb_gradient {
+	gfb_gradienttype_t type;						/**< Shape of the gradient. */
+	float x0;										/**< Left position of the start point or center. */
+	float y0;										/**< Top position of the start point or center. */
+	float x1;										/**< Left position of the end point of a linear gradient. */
+	float y1;										/**< Top position of the end point of a linear gradient. */
+	float radius;									/**< Distance from the center at offset 1 of a radial gradient. */
+	int dither;										/**< Non-zero to dither pixel formats with less than 8 bits per channel. */
+	size_t nstops;									/**< Number of items used in stops[]. */
+	gfb_gradientstop_t stops[MAX_GFB_GRADIENT_STOPS];	/**< Color stops sorted by offset. */
+	uint32_t lut[256];								/**< Color at 256 even offsets as 0xAARRGGBB, built from stops[]. */
+} gfb_gradient_t;
+
+#if GFB_WITH_FREETYPE
 /** Cached glyph. */
 typedef struct gfb_glyph {
 	int     ptsize; /**< Point size. */
@@ -170,6 +269,72 @@ typedef struct gfb_glyph {
 
 	FT_Glyph bitmap;  /**< Fully rendered glyph bitmap. */
 } gfb_glyph_t;
+#endif
+
+/** Glyph of a bitmap font, see gfb_bmf_t. */
+typedef struct gfb_bmf_glyph {
+	uint32_t code;		/**< Unicode code point. */
+	uint32_t offset;	/**< Position of the top row in pbits[]. */
+	uint8_t width;		/**< Width of the bitmap in pixels. */
+	uint8_t height;		/**< Height of the bitmap in pixels. */
+	int8_t xbearing;	/**< Pixels from the pen position to the left edge of the bitmap. */
+	int8_t ybearing;	/**< Pixels from the baseline up to the top edge of the bitmap. */
+	uint8_t xadvance;	/**< Pixels the pen moves after the glyph. */
+} gfb_bmf_glyph_t;
+
+/**
+Bitmap font, see gfb_bmf_load_memory() and gfb_bmf_load_array().
+Glyph rows are one bit per pixel, leftmost pixel in the top bit, padded to whole bytes.
+A font without pglyphs[] is a plain array of count character cells of width by height pixels for the
+code points from first onwards, the layout of most fonts compiled into C arrays.
+*/
+typedef struct gfb_bmf {
+	int width;							/**< Width of a character cell in pixels, the advance of glyphs missing from the font. */
+	int height;							/**< Height of a character cell in pixels, the distance between baselines. */
+	int ascent;							/**< Pixels from the baseline up to the top of a character cell. */
+	uint32_t first;						/**< Code point of the first cell of a font without pglyphs[]. */
+	size_t count;						/**< Number of glyphs or cells. */
+	const gfb_bmf_glyph_t *pglyphs;		/**< Glyphs sorted by code point, NULL for an array of cells. */
+	const uint8_t *pbits;				/**< Rows of every glyph. */
+} gfb_bmf_t;
+
+/** Glyph cache counters, see gfb_glyphcache_stats(). */
+typedef struct gfb_glyphcache_stats {
+	uint64_t hits;		/**< Glyphs drawn from the cache. */
+	uint64_t misses;	/**< Glyphs rendered by FreeType. */
+	uint64_t evictions;	/**< Glyphs dropped to stay within the budget. */
+	size_t glyphs;		/**< Number of glyphs in the cache. */
+	size_t bytes;		/**< Bytes of coverage held by the cached glyphs. */
+	size_t budget;		/**< Memory budget of the cache in bytes. */
+} gfb_glyphcache_stats_t;
+
+/** Text run cache counters, see gfb_runcache_stats(). */
+typedef struct gfb_runcache_stats {
+	uint64_t hits;		/**< Texts drawn from the cache. */
+	uint64_t misses;	/**< Texts drawn glyph by glyph. */
+	uint64_t evictions;	/**< Runs dropped to stay within the budget. */
+	size_t runs;		/**< Number of runs in the cache. */
+	size_t bytes;		/**< Bytes held by the cached runs. */
+	size_t budget;		/**< Memory budget of the cache in bytes. */
+} gfb_runcache_stats_t;
+
+/** Size of a run of text, see gfb_text_measure(). */
+typedef struct gfb_textmetrics {
+	int advance;		/**< Pixels the pen moves over the whole text, kerning included. */
+	int ascent;			/**< Pixels from the baseline up to the top of the font. */
+	int descent;		/**< Pixels from the baseline down to the bottom of the font. */
+	int lineheight;		/**< Pixels from one baseline to the next. */
+	gfb_rect_t bbox;	/**< Pixels the glyphs cover, relative to the pen start on the baseline. */
+	size_t count;		/**< Number of characters measured. */
+} gfb_textmetrics_t;
+
+/** Line of wrapped text, see gfb_text_wrap(). */
+typedef struct gfb_textline {
+	size_t offset;	/**< Byte offset of the line in the string. */
+	size_t length;	/**< Number of bytes in the line, without the spaces or newline it was broken at. */
+	size_t count;	/**< Number of characters in the line, the count to pass to gfb_text(). */
+	int advance;	/**< Width of the line in pixels. */
+} gfb_textline_t;
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -215,7 +380,7 @@ typedef GFB_BLIT(*gfb_blit_t);
 typedef GFB_FLIP(*gfb_flip_t);
 
 /** Macro to define and declare a clear screen routine. */
-#define GFB_CLEAR(_gfb_clear_name) int (_gfb_clear_name)(struct gfb_surface *psurface)
+#define GFB_CLEAR(_gfb_clear_name) int (_gfb_clear_name)(struct gfb_surface *psurface, gfb_color_t color)
 
 /** Function pointer type to a clear screen routine. */
 typedef GFB_CLEAR(*gfb_clear_t);
@@ -250,23 +415,89 @@ typedef GFB_FILLEDRECTANGLE(*gfb_filledrectangle_t);
 /** Function pointer to a filled circle drawing routine. */
 typedef GFB_FILLEDCIRCLE(*gfb_filledcircle_t);
 
+/** Macro to define and declare a routine to draw an ellipse. */
+#define GFB_ELLIPSE(_gfb_ellipse_name) int (_gfb_ellipse_name)(struct gfb_surface *psurface, int x, int y, int rx, int ry, gfb_color_t color)
+
+/** Function pointer to an ellipse drawing routine. */
+typedef GFB_ELLIPSE(*gfb_ellipse_t);
+
+/** Macro to define and declare a routine to draw a filled ellipse. */
+#define GFB_FILLEDELLIPSE(_gfb_filledellipse_name) int (_gfb_filledellipse_name)(struct gfb_surface *psurface, int x, int y, int rx, int ry, gfb_color_t colorf, gfb_color_t colorb)
+
+/** Function pointer to a filled ellipse drawing routine. */
+typedef GFB_FILLEDELLIPSE(*gfb_filledellipse_t);
+
 /** Macro to define and declare a routine to draw polygon. */
 #define GFB_POLYGON(_gfb_polygon_name) int (_gfb_polygon_name)(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color)
 
 /** Function pointer to a draw polygon routine. */
 typedef GFB_POLYGON(*gfb_polygon_t);
 
+/** Macro to define and declare a routine to draw a filled polygon. */
+#define GFB_FILLEDPOLYGON(_gfb_filledpolygon_name) int (_gfb_filledpolygon_name)(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color, gfb_fillrule_t rule)
+
+/** Function pointer to a filled polygon routine. */
+typedef GFB_FILLEDPOLYGON(*gfb_filledpolygon_t);
+
 /** Macro to define and declare a routine to flood fill an area. */
-#define GFB_FLOODFILL(_gfb_floodfill_name) int (_gfb_floodfill_name)(struct gfb_surface *psurface, int x, int y, gfb_color_t color)
+#define GFB_FLOODFILL(_gfb_floodfill_name) int (_gfb_floodfill_name)(struct gfb_surface *psurface, int x, int y, gfb_color_t color, uint8_t tolerance)
 
 /** Function pointer to a flood fill routine. */
 typedef GFB_FLOODFILL(*gfb_floodfill_t);
 
+/** Macro to define and declare a routine to draw an anti-aliased line. */
+#define GFB_LINE_AA(_gfb_line_aa_name) int (_gfb_line_aa_name)(struct gfb_surface *psurface, int x1, int y1, int x2, int y2, gfb_color_t color)
+
+/** Function pointer type to an anti-aliased line drawing routine. */
+typedef GFB_LINE_AA(*gfb_line_aa_t);
+
+/** Macro to define and declare a routine to draw an anti-aliased circle. */
+#define GFB_CIRCLE_AA(_gfb_circle_aa_name) int (_gfb_circle_aa_name)(struct gfb_surface *psurface, int x, int y, int radius, gfb_color_t color)
+
+/** Function pointer to an anti-aliased circle drawing routine. */
+typedef GFB_CIRCLE_AA(*gfb_circle_aa_t);
+
+/** Macro to define and declare a routine to draw an anti-aliased filled circle. */
+#define GFB_FILLEDCIRCLE_AA(_gfb_filledcircle_aa_name) int (_gfb_filledcircle_aa_name)(struct gfb_surface *psurface, int x, int y, int radius, gfb_color_t color)
+
+/** Function pointer to an anti-aliased filled circle drawing routine. */
+typedef GFB_FILLEDCIRCLE_AA(*gfb_filledcircle_aa_t);
+
+/** Macro to define and declare a routine to draw a batch of points, clipped by the routine. */
+#define GFB_POINTS(_gfb_points_name) int (_gfb_points_name)(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color)
+
+/** Function pointer to a batched point drawing routine. */
+typedef GFB_POINTS(*gfb_points_t);
+
+/** Macro to define and declare a routine to draw a batch of lines from point pairs, clipped by the routine. */
+#define GFB_LINES(_gfb_lines_name) int (_gfb_lines_name)(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color)
+
+/** Function pointer to a batched line drawing routine. */
+typedef GFB_LINES(*gfb_lines_t);
+
+/** Macro to define and declare a routine to draw a batch of rectangles, clipped by the routine. */
+#define GFB_RECTS(_gfb_rects_name) int (_gfb_rects_name)(struct gfb_surface *psurface, gfb_rect_t *prects, size_t count, gfb_color_t color)
+
+/** Function pointer to a batched rectangle drawing routine. */
+typedef GFB_RECTS(*gfb_rects_t);
+
+/** Macro to define and declare a routine to draw a batch of filled rectangles, clipped by the routine. */
+#define GFB_FILLEDRECTS(_gfb_filledrects_name) int (_gfb_filledrects_name)(struct gfb_surface *psurface, gfb_rect_t *prects, size_t count, gfb_color_t colorb)
+
+/** Function pointer to a batched filled rectangle drawing routine. */
+typedef GFB_FILLEDRECTS(*gfb_filledrects_t);
+
+/** Macro to define and declare a routine to render out UTF8 encoded NUL terminated string. */
+#define GFB_TEXT(_gfb_text_name) int (_gfb_text_name)(struct gfb_surface *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, const char *pzutf8, size_t count, gfb_color_t colorf, gfb_color_t colorb)
+
+/** Function pointer to a UTF8 string render. */
+typedef GFB_TEXT(*gfb_text_t);
+
 /** Macro to define and declare a routine to render out Unicode array. */
-#define GFB_TEXT(_gfb_text_name) int (_gfb_text_name)(struct gfb_surface *psurface, gfb_font_id fontid, int x, int y, uint16_t *text, size_t count, gfb_color_t colorf, gfb_color_t colorb)
+#define GFB_TEXTU(_gfb_textu_name) int (_gfb_textu_name)(struct gfb_surface *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, const uint32_t *pcodes, size_t count, gfb_color_t colorf, gfb_color_t colorb)
 
 /** Function pointer to a Unicode array render. */
-typedef GFB_TEXT(*gfb_text_t);
+typedef GFB_TEXTU(*gfb_textu_t);
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -282,9 +513,20 @@ GFB_RECTANGLE(gfb_soft_rectangle);
 GFB_CIRCLE(gfb_soft_circle);
 GFB_FILLEDRECTANGLE(gfb_soft_filledrectangle);
 GFB_FILLEDCIRCLE(gfb_soft_filledcircle);
+GFB_ELLIPSE(gfb_soft_ellipse);
+GFB_FILLEDELLIPSE(gfb_soft_filledellipse);
 GFB_POLYGON(gfb_soft_polygon);
+GFB_FILLEDPOLYGON(gfb_soft_filledpolygon);
 GFB_FLOODFILL(gfb_soft_floodfill);
+GFB_LINE_AA(gfb_soft_line_aa);
+GFB_CIRCLE_AA(gfb_soft_circle_aa);
+GFB_FILLEDCIRCLE_AA(gfb_soft_filledcircle_aa);
+GFB_POINTS(gfb_soft_points);
+GFB_LINES(gfb_soft_lines);
+GFB_RECTS(gfb_soft_rects);
+GFB_FILLEDRECTS(gfb_soft_filledrects);
 GFB_TEXT(gfb_soft_text);
+GFB_TEXTU(gfb_soft_textu);
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -305,9 +547,20 @@ typedef struct gfb_devop {
 	gfb_circle_t circle;					/**< Draw a circle. */
 	gfb_filledrectangle_t filledrectangle;	/**< Draw a filled rectangle. */
 	gfb_filledcircle_t filledcircle;		/**< Draw a filled circle. */
+	gfb_ellipse_t ellipse;					/**< Draw an ellipse. */
+	gfb_filledellipse_t filledellipse;		/**< Draw a filled ellipse. */
 	gfb_polygon_t polygon;					/**< Draw all lines in a polygon. */
+	gfb_filledpolygon_t filledpolygon;		/**< Fill the inside of a polygon. */
 	gfb_floodfill_t floodfill;				/**< Fill area of mathing color. */
+	gfb_line_aa_t line_aa;					/**< Draw an anti-aliased line. */
+	gfb_circle_aa_t circle_aa;				/**< Draw an anti-aliased circle. */
+	gfb_filledcircle_aa_t filledcircle_aa;	/**< Draw an anti-aliased filled circle. */
+	gfb_points_t points;					/**< Draw a batch of points. */
+	gfb_lines_t lines;						/**< Draw a batch of lines. */
+	gfb_rects_t rects;						/**< Draw a batch of rectangles. */
+	gfb_filledrects_t filledrects;			/**< Draw a batch of filled rectangles. */
 	gfb_text_t text;						/**< Render UTF8 encoded NUL terminated string. */
+	gfb_textu_t textu;						/**< Render Unicode array. */
 } gfb_devop_t;
 
 /** Graphical surface descriptor. */
@@ -320,6 +573,7 @@ typedef struct gfb_surface {
 	int h;						/**< Height of surface in pixels. */
 	unsigned int pitch;			/**< Number of bytes per scanline. */
 	uint8_t alpha;				/**< Overall surface alpha value. */
+	uint8_t drawalpha;			/**< Alpha drawing primitives are blended with when GFB_DRAWBLEND is set. */
 	unsigned int refcount;		/**< Reference counter. */
 	gfb_devop_t *op;			/**< Device accelerated operations or software equivalent. */
 	uint8_t *ppixelmemory;		/**< Pointer to the pixel buffer, pointer returned by calloc(). */
@@ -478,6 +732,7 @@ gfb_color_t gfb_maprgba(gfb_surface_t *psurface, uint8_t red, uint8_t green, uin
 /**
 Set clipping rectangle of a surface.
 Pixels are only drawn inside this rectangle.
+The rectangle is limited to the surface dimensions.
 If prect is NULL the clipping rectangle is set to the full surface dimensions.
 @param psurface Pointer to the surface to change.
 @param prect Pointer to a rectangle or NULL to use psurface size.
@@ -486,6 +741,32 @@ If prect is NULL the clipping rectangle is set to the full surface dimensions.
 */
 int gfb_setcliprect(gfb_surface_t *psurface, gfb_rect_t *prect);
 
+/**
+Set the alpha drawing primitives are blended with.
+Lines, rectangles, circles, ellipses, polygons, flood fills and batches are blended source over
+into the surface, span by span, instead of overwriting it. The anti-aliased primitives scale their
+coverage by the alpha. Clearing the surface and gfb_putpixel() still write opaque pixels.
+The surface flag GFB_DRAWBLEND is set for alpha below 255 and cleared for 255.
+@param psurface Pointer to the surface to draw on.
+@param alpha Opacity of drawn primitives, 0 is invisible and 255 is opaque.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_setdrawalpha(gfb_surface_t *psurface, uint8_t alpha);
+
+/**
+Set whether text is blended over the surface or drawn on its background color.
+With it enabled gfb_text(), gfb_textu() and the fixed font functions blend the text color over the
+pixels already in the surface through the glyph coverage, the background color is ignored and nothing
+outside the glyphs is written. Text over images then needs no intermediate surface.
+The surface flag GFB_TRANSPARENTTEXT is set or cleared.
+@param psurface Pointer to the surface to draw on.
+@param enable Non-zero to blend text, zero to draw it on the background color.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_settransparenttext(gfb_surface_t *psurface, int enable);
+
 /**
 Set overall alpha value of a surface.
 The surface flag GFB_ALPHABLEND is set automatically.
@@ -556,13 +837,27 @@ int gfb_flip(gfb_surface_t *psurface);
 
 /**
 Clear whole frame buffer area to black.
+Only the clip rectangle is cleared, see gfb_clear_color().
 @param psurface Pointer to the surface to draw on.
 @return On success, returns GFB_OK.
 @return On failure, returns a negative error code is returned (GFB_Exxx).
 */
 int gfb_clear(gfb_surface_t *psurface);
 
+/**
+Clear the clip rectangle of the surface to a color.
+The color is broadcast into vector registers and large areas are written with non-temporal
+stores, so a full screen clear to any color costs about the same as a clear to black.
+@param psurface Pointer to the surface to draw on.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_clear_color(gfb_surface_t *psurface, gfb_color_t color);
+
 /** Draw a line.
+The line is clipped against the surface clip rectangle without changing its slope.
+Nothing is drawn for a line entirely outside the clip rectangle and GFB_OK is returned.
 @param psurface Pointer to the surface to draw on.
 @param x1 Left pixel position of start point of line.
 @param y1 Top pixel position of start point of line.
@@ -586,6 +881,7 @@ int gfb_rectangle(gfb_surface_t *psurface, gfb_rect_t *prect, gfb_color_t color)
 
 /**
 Draw a circle.
+The circle is clipped against the surface clip rectangle.
 @param psurface Pointer to the surface to draw on.
 @param x Left pixel position of circle center.
 @param y Top pixel position of circle center.
@@ -608,6 +904,8 @@ int gfb_filledrectangle(gfb_surface_t *psurface, gfb_rect_t *prect, gfb_color_t
 
 /**
 Draw a filled circle.
+The outline and the interior are drawn in one pass, each pixel row once.
+The circle is clipped against the surface clip rectangle.
 @param psurface Pointer to the surface to draw on.
 @param x Left pixel position.
 @param y Top pixel position.
@@ -619,6 +917,135 @@ Draw a filled circle.
 */
 int gfb_filledcircle(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t colorf, gfb_color_t colorb);
 
+/**
+Draw an axis aligned ellipse.
+The ellipse is clipped against the surface clip rectangle.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of ellipse center.
+@param y Top pixel position of ellipse center.
+@param rx Horizontal radius.
+@param ry Vertical radius.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_ellipse(gfb_surface_t *psurface, int x, int y, int rx, int ry, gfb_color_t color);
+
+/**
+Draw a filled axis aligned ellipse.
+The outline and the interior are drawn in one pass, each pixel row once.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of ellipse center.
+@param y Top pixel position of ellipse center.
+@param rx Horizontal radius.
+@param ry Vertical radius.
+@param colorf Encoded pixel value of the outline color.
+@param colorb Encoded pixel value of the fill color.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_filledellipse(gfb_surface_t *psurface, int x, int y, int rx, int ry, gfb_color_t colorf, gfb_color_t colorb);
+
+/**
+Draw an anti-aliased line.
+Each step covers two pixels whose 8-bit coverage is derived from the fractional distance to the
+ideal line in 16.16 fixed point (Wu's algorithm) and blended into the surface pixel format.
+Horizontal, vertical and diagonal lines need no smoothing and are drawn like gfb_line().
+The line is clipped against the surface clip rectangle like gfb_line().
+@param psurface Pointer to the surface to draw on.
+@param x1 Left pixel position of start point of line.
+@param y1 Top pixel position of start point of line.
+@param x2 Left pixel position of end point of line.
+@param y2 Top pixel position of end point of line.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_line_aa(gfb_surface_t *psurface, int x1, int y1, int x2, int y2, gfb_color_t color);
+
+/**
+Draw an anti-aliased circle.
+The one pixel wide outline is split between the two pixels straddling the ideal circle
+in each column or row, like gfb_line_aa().
+The circle is clipped against the surface clip rectangle.
+Radii above 8388607 are drawn with a hard edge.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of circle center.
+@param y Top pixel position of circle center.
+@param radius Circle radius.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_circle_aa(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t color);
+
+/**
+Draw an anti-aliased filled circle.
+The interior of each row is filled as one span, only the edge pixels are blended.
+The filled area covers the same pixels as gfb_filledcircle().
+The circle is clipped against the surface clip rectangle.
+Radii above 8388607 are drawn with a hard edge.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position of circle center.
+@param y Top pixel position of circle center.
+@param radius Circle radius.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_filledcircle_aa(gfb_surface_t *psurface, int x, int y, int radius, gfb_color_t color);
+
+/**
+Draw a batch of points.
+Arguments are checked once for the whole batch, points outside the clip rectangle are skipped.
+@param psurface Pointer to the surface to draw on.
+@param ppoints Pointer to an array of gfb_point_t.
+@param count Number of items in ppoints array.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_points(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color);
+
+/**
+Draw a batch of lines.
+Each pair of points is one line, ppoints[0] to ppoints[1], ppoints[2] to ppoints[3] and so on.
+If the bounding box of the batch is inside the clip rectangle no line is clipped, otherwise
+each line is clipped like gfb_line().
+@param psurface Pointer to the surface to draw on.
+@param ppoints Pointer to an array of gfb_point_t.
+@param count Number of items in ppoints array, must be even.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_lines(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color);
+
+/**
+Draw a batch of rectangles.
+Each rectangle has the outline of gfb_rectangle(), from (x, y) to (x + w, y + h).
+Edges are written directly as spans, clipped against the surface clip rectangle.
+@param psurface Pointer to the surface to draw on.
+@param prects Pointer to an array of gfb_rect_t.
+@param count Number of items in prects array.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_rects(gfb_surface_t *psurface, gfb_rect_t *prects, size_t count, gfb_color_t color);
+
+/**
+Draw a batch of filled rectangles.
+Each rectangle covers the same pixels as gfb_filledrectangle() and is clipped against the surface clip rectangle.
+@param psurface Pointer to the surface to draw on.
+@param prects Pointer to an array of gfb_rect_t.
+@param count Number of items in prects array.
+@param colorb Encoded pixel value of the fill color.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_filledrects(gfb_surface_t *psurface, gfb_rect_t *prects, size_t count, gfb_color_t colorb);
+
 /**
 Draw lines between the given polygon points.
 @param psurface Pointer to the surface to draw on.
@@ -630,8 +1057,26 @@ Draw lines between the given polygon points.
 */
 int gfb_polygon(struct gfb_surface *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color);
 
+/**
+Fill the inside of a polygon.
+The polygon is closed from the last point back to the first and may be self-intersecting.
+Scanlines are converted with an edge table and an active edge list, spans are clipped
+against the surface clip rectangle. A pixel is inside if its top left corner is inside the
+polygon so shapes sharing an edge do not overlap.
+@param psurface Pointer to the surface to draw on.
+@param ppoints Pointer to an array of gfb_point_t.
+@param count Number of items in ppoints array, at least 3.
+@param color Encoded pixel value of the fill color.
+@param rule Fill rule, GFB_FILL_EVENODD or GFB_FILL_NONZERO.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_filledpolygon(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, gfb_color_t color, gfb_fillrule_t rule);
+
 /**
 Fill area of mathing color.
+The connected area of pixels with the same color as the pixel at (x, y) is filled, stopping at the clip rectangle.
+The fill works scanline by scanline on an explicit span stack so it never recurses.
 @param psurface Pointer to the surface to draw on.
 @param x Left pixel position.
 @param y Top pixel position.
@@ -641,8 +1086,239 @@ Fill area of mathing color.
 */
 int gfb_floodfill(gfb_surface_t *psurface, int x, int y, gfb_color_t color);
 
+/**
+Fill area of similar color.
+Like gfb_floodfill() but pixels match if each color component differs from the seed pixel
+by at most tolerance, measured on a 0-255 scale regardless of the pixel format.
+A visited map of one bit per clip rectangle pixel is allocated for the duration of the fill.
+@param psurface Pointer to the surface to draw on.
+@param x Left pixel position.
+@param y Top pixel position.
+@param color Encoded pixel value.
+@param tolerance Largest component difference still matching, 0 for an exact match.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_floodfill_tolerance(gfb_surface_t *psurface, int x, int y, gfb_color_t color, uint8_t tolerance);
+
+/**
+Initialize an empty path.
+Curves are flattened with a tolerance of 0.25 pixels, change ppath->tolerance before adding them to trade
+accuracy for fewer lines. Release with gfb_path_destroy().
+@param ppath Pointer to the path to initialize.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_create(gfb_path_t *ppath);
+
+/**
+Release the memory held by a path.
+@param ppath Pointer to the path.
+*/
+void gfb_path_destroy(gfb_path_t *ppath);
+
+/**
+Remove every contour from a path but keep its memory for reuse.
+@param ppath Pointer to the path.
+*/
+void gfb_path_reset(gfb_path_t *ppath);
+
+/**
+Start a new contour.
+@param ppath Pointer to the path.
+@param x Left position.
+@param y Top position.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_moveto(gfb_path_t *ppath, float x, float y);
+
+/**
+Add a line from the current point.
+Without a current point this is the same as gfb_path_moveto().
+@param ppath Pointer to the path.
+@param x Left position of the end point.
+@param y Top position of the end point.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_lineto(gfb_path_t *ppath, float x, float y);
+
+/**
+Add a quadratic Bezier curve from the current point.
+@param ppath Pointer to the path.
+@param cx Left position of the control point.
+@param cy Top position of the control point.
+@param x Left position of the end point.
+@param y Top position of the end point.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_quadto(gfb_path_t *ppath, float cx, float cy, float x, float y);
+
+/**
+Add a cubic Bezier curve from the current point.
+@param ppath Pointer to the path.
+@param cx1 Left position of the first control point.
+@param cy1 Top position of the first control point.
+@param cx2 Left position of the second control point.
+@param cy2 Top position of the second control point.
+@param x Left position of the end point.
+@param y Top position of the end point.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_cubicto(gfb_path_t *ppath, float cx1, float cy1, float cx2, float cy2, float x, float y);
+
+/**
+Add a circular arc.
+A line is added from the current point to the start of the arc. Angles are in radians, 0 points
+right and positive angles turn clockwise on screen. For a pie slice move to the center first and close the path.
+@param ppath Pointer to the path.
+@param cx Left position of the center.
+@param cy Top position of the center.
+@param radius Radius in pixels.
+@param start Angle of the first point.
+@param end Angle of the last point, less than start to go counter-clockwise.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_arc(gfb_path_t *ppath, float cx, float cy, float radius, float start, float end);
+
+/**
+Add a closed rectangle with rounded corners as a new contour.
+@param ppath Pointer to the path.
+@param x Left position.
+@param y Top position.
+@param w Width.
+@param h Height.
+@param radius Corner radius, limited to half of the smaller side.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_roundrect(gfb_path_t *ppath, float x, float y, float w, float h, float radius);
+
+/**
+Close the current contour, the next point starts a new contour at its first point.
+@param ppath Pointer to the path.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_close(gfb_path_t *ppath);
+
+/**
+Fill the inside of a path with anti-aliased edges.
+Every contour is implicitly closed. Edges add their signed area to a coverage buffer the size of the path
+bounds, which is then swept once per row; overlapping contours of the same direction do not add up.
+@param psurface Pointer to the surface to draw on.
+@param ppath Pointer to the path.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_fill(gfb_surface_t *psurface, gfb_path_t *ppath, gfb_color_t color);
+
+/**
+Stroke the outline of a path with anti-aliased edges, round joins and round caps.
+@param psurface Pointer to the surface to draw on.
+@param ppath Pointer to the path.
+@param width Width of the line in pixels.
+@param color Encoded pixel value.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_stroke(gfb_surface_t *psurface, gfb_path_t *ppath, float width, gfb_color_t color);
+
+/**
+Fill and stroke a path in a single pass over the surface.
+The stroke is composited over the fill per pixel so the shared edge is written once.
+@param psurface Pointer to the surface to draw on.
+@param ppath Pointer to the path.
+@param width Width of the line in pixels.
+@param colorf Encoded pixel value of the stroke.
+@param colorb Encoded pixel value of the fill.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_path_fillstroke(gfb_surface_t *psurface, gfb_path_t *ppath, float width, gfb_color_t colorf, gfb_color_t colorb);
+
+/**
+Initialize a linear gradient without color stops.
+Pixels are colored by the projection of their center on the line from (x0, y0) to (x1, y1) and keep
+the first or last color beyond the ends.
+@param pgradient Pointer to the gradient to initialize.
+@param x0 Left position at offset 0.
+@param y0 Top position at offset 0.
+@param x1 Left position at offset 1.
+@param y1 Top position at offset 1.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_gradient_linear(gfb_gradient_t *pgradient, float x0, float y0, float x1, float y1);
+
+/**
+Initialize a radial gradient without color stops.
+@param pgradient Pointer to the gradient to initialize.
+@param cx Left position of the center, at offset 0.
+@param cy Top position of the center, at offset 0.
+@param radius Distance from the center at offset 1.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_gradient_radial(gfb_gradient_t *pgradient, float cx, float cy, float radius);
+
+/**
+Add a color stop to a gradient and rebuild its color table.
+Colors are interpolated linearly between stops, a gradient with one stop is a solid color.
+@param pgradient Pointer to the gradient.
+@param offset Position along the gradient, 0 to 1.
+@param red Red component, 0-255.
+@param green Green component, 0-255.
+@param blue Blue component, 0-255.
+@param alpha Opacity, 0-255.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_gradient_addstop(gfb_gradient_t *pgradient, float offset, uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha);
+
+/**
+Fill a rectangle with a gradient.
+Like gfb_filledrectangle() the rectangle covers x to x + w and y to y + h. Translucent stops and the draw
+alpha are blended. Gradient coordinates are surface pixel positions.
+@param psurface Pointer to the surface to draw on.
+@param prect Pointer to the rectangle, NULL for the whole clip rectangle.
+@param pgradient Pointer to the gradient.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_gradient_fillrect(gfb_surface_t *psurface, gfb_rect_t *prect, const gfb_gradient_t *pgradient);
+
+/**
+Fill the inside of a polygon with a gradient, see gfb_filledpolygon().
+@param psurface Pointer to the surface to draw on.
+@param ppoints Pointer to an array of gfb_point_t.
+@param count Number of items in ppoints array, at least 3.
+@param pgradient Pointer to the gradient.
+@param rule Fill rule, GFB_FILL_EVENODD or GFB_FILL_NONZERO.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_gradient_fillpolygon(gfb_surface_t *psurface, gfb_point_t *ppoints, size_t count, const gfb_gradient_t *pgradient, gfb_fillrule_t rule);
+
+/**
+Fill the inside of a path with a gradient and anti-aliased edges, see gfb_path_fill().
+@param psurface Pointer to the surface to draw on.
+@param ppath Pointer to the path.
+@param pgradient Pointer to the gradient.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_gradient_fillpath(gfb_surface_t *psurface, gfb_path_t *ppath, const gfb_gradient_t *pgradient);
+
 /**
 Load true-type file from memory.
+The font data is not copied, pttf[] must stay valid until the font is unloaded.
+Built with GFB_WITH_FREETYPE 0 true-type fonts are not supported and GFB_ENOTSUPPORTED is returned.
 @param pttf Pointer to the true-type file in memory.
 @param ttfsize Number of bytes in pttf[].
 @return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
@@ -650,26 +1326,76 @@ Load true-type file from memory.
 */
 gfb_font_id gfb_ttf_load_memory(uint8_t *pttf, size_t ttfsize);
 
+/**
+Load true-type file from disk.
+The file is mapped read-only instead of read into memory, so processes using the same font share its
+pages in the page cache. The mapping is released when the font is unloaded.
+@param pzpath Path to the font file.
+@return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
+@return On failure, returns a negative error code (GFB_Exxx).
+*/
+gfb_font_id gfb_ttf_load_file(const char *pzpath);
+
+/**
+Load a PSF1, PSF2 or BDF bitmap font from memory.
+The glyphs are copied, pdata[] may be freed once the font is loaded. Bitmap fonts are drawn by
+gfb_text() and the fixed font functions at their own size, whatever point size is asked for.
+@param pdata Pointer to the font file in memory.
+@param size Number of bytes in pdata[].
+@return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
+@return On failure, returns a negative error code (GFB_Exxx).
+*/
+gfb_font_id gfb_bmf_load_memory(const uint8_t *pdata, size_t size);
+
+/**
+Load a PSF1, PSF2 or BDF bitmap font from disk, see gfb_bmf_load_memory().
+@param pzpath Path to the font file.
+@return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
+@return On failure, returns a negative error code (GFB_Exxx).
+*/
+gfb_font_id gfb_bmf_load_file(const char *pzpath);
+
+/**
+Load a bitmap font compiled into the program.
+Nothing is copied, pbmf and the glyphs it points to must stay valid until the font is unloaded.
+@param pbmf Pointer to the font.
+@return On success, returns an Id to the stored font (0 to MAX_GFB_FONT).
+@return On failure, returns a negative error code (GFB_Exxx).
+*/
+gfb_font_id gfb_bmf_load_array(const gfb_bmf_t *pbmf);
+
+/**
+Unload a font loaded by gfb_ttf_load_memory(), gfb_ttf_load_file() or one of the gfb_bmf_load functions.
+Its glyphs are dropped from the glyph and text run caches and the id may be handed out again.
+Fixed fonts created from the font keep its face until they are destroyed, see gfb_fft_destroy().
+@param fontid Id of the font to unload.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_ttf_unload(gfb_font_id fontid);
+
 /**
 Render an array of Unicode glyphs.
-This is a front-end for FreeType2.
+This is a front-end for FreeType2, bitmap fonts are drawn from their own glyphs at their own size.
 @param psurface Pointer to the surface to draw on.
 @param fontid Id of the font to use, see gfb_ttf_load_memory().
 @param ptsize Font point size.
 @param x Left pixel position.
 @param y Top pixel position.
-@param punicode Pointer to the Unicode glyphs.
+@param punicode Pointer to the Unicode code points, the full range up to U+10FFFF.
 @param count How many items to print from punicode[].
 @param colorf Color of the text.
 @param colorb Color of the background.
 @return On success, returns GFB_OK.
 @return On failure, returns a negative error code is returned (GFB_Exxx).
 */
-int gfb_textu(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, uint16_t *punicode, size_t count, gfb_color_t colorf, gfb_color_t colorb);
+int gfb_textu(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, uint32_t *punicode, size_t count, gfb_color_t colorf, gfb_color_t colorb);
 
 /**
 Render UTF8 encoded NUL terminated string.
-This is a front-end for FreeType2.
+This is a front-end for FreeType2, bitmap fonts are drawn from their own glyphs at their own size.
+The string is decoded as it is drawn and is not measured first, invalid sequences are skipped.
+Text may be drawn from several threads at once unless the library is built with GFB_THREADSAFE off.
 
 @param psurface Pointer to the surface to draw on.
 @param fontid Id of the font to use, see gfb_ttf_load_memory().
@@ -677,7 +1403,7 @@ This is a front-end for FreeType2.
 @param x Left pixel position.
 @param y Top pixel position.
 @param pzutf8 Pointer to NUL terminated UTF8 encoded string.
-@param count How many characters (not bytes) to print from pzutf8.
+@param count How many characters (not bytes) to print from pzutf8, rendering also stops at the NUL.
 @param colorf Color of the text.
 @param colorb Color of the background.
 @return On success, returns GFB_OK.
@@ -685,9 +1411,90 @@ This is a front-end for FreeType2.
 */
 int gfb_text(gfb_surface_t *psurface, gfb_font_id fontid, uint8_t ptsize, int x, int y, char *pzutf8, size_t count, gfb_color_t colorf, gfb_color_t colorb);
 
+/**
+Measure UTF8 encoded text without drawing it.
+Glyph metrics come from the glyph cache, glyphs not yet cached have their metrics loaded but are not
+rendered. Kerning is applied the same way gfb_text() applies it.
+@param fontid Id of the font to use, see gfb_ttf_load_memory().
+@param ptsize Font point size.
+@param pzutf8 Pointer to NUL terminated UTF8 encoded string.
+@param count How many characters (not bytes) to measure from pzutf8, measuring also stops at the NUL.
+@param pmetrics Pointer to the metrics to fill in.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_text_measure(gfb_font_id fontid, uint8_t ptsize, const char *pzutf8, size_t count, gfb_textmetrics_t *pmetrics);
+
+/**
+Break UTF8 encoded text into lines no wider than a width.
+Lines break after spaces and at newlines, a word wider than the width on its own is broken between
+characters. The spaces a line is broken at are left out of both lines.
+@param fontid Id of the font to use, see gfb_ttf_load_memory().
+@param ptsize Font point size.
+@param pzutf8 Pointer to NUL terminated UTF8 encoded string.
+@param width Largest line width in pixels.
+@param plines Pointer to an array to store the lines in, may be NULL to only count them.
+@param maxlines Number of items in plines[].
+@param pcount Pointer to store the number of lines, which may be more than maxlines.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_text_wrap(gfb_font_id fontid, uint8_t ptsize, const char *pzutf8, int width, gfb_textline_t *plines, size_t maxlines, size_t *pcount);
+
+/**
+Set the memory budget of the glyph cache.
+Glyphs rendered by gfb_text() and gfb_textu() are kept per font, point size and code point, with their
+coverage packed into one atlas. The least recently used glyphs are evicted when it is full. The budget
+covers the atlas and the bookkeeping. The cache is flushed and allocated again on the next text.
+@param budget Number of bytes, the default is GFB_GLYPHCACHE_BYTES.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_glyphcache_configure(size_t budget);
+
+/**
+Drop every glyph from the glyph cache and release its memory.
+*/
+void gfb_glyphcache_flush(void);
+
+/**
+Read the glyph cache counters.
+@param pstats Pointer to the counters to fill in.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_glyphcache_stats(gfb_glyphcache_stats_t *pstats);
+
+/**
+Set the memory budget of the text run cache.
+A string drawn twice with the same font and size by gfb_text() or gfb_textu() is kept as one coverage
+strip with the box of each glyph, later draws blit the strip without decoding the string or looking up
+glyphs. Strings are only cached on their second draw so text that changes every frame does not churn
+the cache. The least recently used runs are evicted when it is full. The cache is flushed.
+Surfaces with GFB_TRANSPARENTTEXT set always draw glyph by glyph.
+@param budget Number of bytes, 0 disables the cache. The default is GFB_RUNCACHE_BYTES.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_runcache_configure(size_t budget);
+
+/**
+Drop every run from the text run cache and release its memory.
+*/
+void gfb_runcache_flush(void);
+
+/**
+Read the text run cache counters.
+@param pstats Pointer to the counters to fill in.
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_runcache_stats(gfb_runcache_stats_t *pstats);
+
 /** Enumeration of any control flags for a fixed font glyph. */
 typedef enum {
-	GFB_ISFULLWIDTH	= (1<<0)	/**< Glyph takes the full width of the cell. */
+	GFB_ISFULLWIDTH	= (1<<0),	/**< Glyph takes the full width of the cell. */
+	GFB_ISCACHED	= (1<<1)	/**< Cache slot holds a rendered glyph. */
 } gfb_fftflags_t;
 
 /** Meta-data for cached fixed font glyph. */
@@ -700,34 +1507,56 @@ typedef struct {
 	uint8_t xbearing;	/**< Horizontal bearing. */
 	uint8_t yadvance;	/**< Vertical advance. */
 	uint8_t ybearing;	/**< Distance from baseline to first pixel on Y axis. */
+	uint32_t offset;	/**< Position of the coverage in the cache. */
 } gfb_fft_meta_t;
 
 /**
 The fixed font is a cache of pre-rendered glyphs.
-An already loaded TTF font is used as the typeface.
-The TTF font must not be freed before freeing any fixed font descriptor using it.
+An already loaded TTF or bitmap font is used as the typeface.
+The fixed font holds a reference to the font, unloading the font keeps its face until the fixed font is destroyed.
 */
 typedef struct {
-	gfb_font_id parentid;	/**< Id of the font used to create this one. */
+	gfb_font_id parentid;	/**< Id of the font used to create this one, -1 if none. A reference is held until destroyed. */
 	uint16_t count;				/**< The size of the cache. */
-	uint16_t gsize;				/**< How many bytes per glyph. */
+	uint16_t gsize;				/**< How many bytes per glyph in a fixed cache. */
 	uint8_t ptsize;				/**< Point size of rendered glyphs. */
-	uint8_t stride;				/**< How many bytes per row. */
+	uint8_t stride;				/**< How many pixels per row. */
 	uint8_t w;					/**< Nominal width of each glyph. */
 	uint8_t h;					/**< Height of each glyph. */
 	uint8_t *pcache;		/**< Allocated glyph cache. Alpha channel. */
 	gfb_fft_meta_t *pmeta;	/**< Pointer to any metadata associated with each cache entry. */
+	uint16_t ways;				/**< Number of slots in each set, a code point can only be cached in its own set. */
+	uint16_t nsets;				/**< Number of sets. */
+	uint32_t tick;				/**< Counts lookups, stamps the slots as they are used. */
+	uint32_t *plastuse;		/**< Tick of the last use of each slot, the least recently used slot of a set is replaced. */
+	uint64_t hits;				/**< Lookups served from the cache. */
+	uint64_t misses;			/**< Lookups that had to render the glyph. */
+	uint64_t evictions;			/**< Glyphs replaced by another code point. */
+	const gfb_pixelformat_t *plutformat;	/**< Pixel format lut[] was built for, NULL before the first draw. */
+	gfb_color_t lutcolorf;		/**< Text color lut[] was built for. */
+	gfb_color_t lutcolorb;		/**< Background color lut[] was built for. */
+	gfb_color_t lut[256];		/**< Encoded pixel for every coverage value, blended from lutcolorb to lutcolorf. */
+	uint8_t packed;				/**< Non-zero if glyphs are stored at their own size, see gfb_fft_create_packed(). */
+	uint8_t depth;				/**< Bits of coverage per pixel, see gfb_fft_depth(). */
+	size_t cachesize;			/**< Number of bytes in pcache[]. */
+	size_t used;				/**< Bytes of a packed cache handed out, including holes left by replaced glyphs. */
+	size_t live;				/**< Bytes of a packed cache held by cached glyphs. */
+	void *pmapping;				/**< File the cache was opened from, NULL if it was allocated. */
+	size_t mapsize;				/**< Number of bytes mapped at pmapping. */
 } gfb_fft_t;
 
 /**
-Create a fixed font cache with N elements from a given TTF font.
+Create a fixed font cache with N elements from a given TTF or bitmap font.
+Bitmap font glyphs are copied at their own size, ptsize only applies to TTF fonts.
 Each pixel in the glyph cache takes one byte so (W*H*N) is the size used by the cache.
 Only the alpha channel is saved and actual pixel values are calculated on runtime.
+The cache is split into sets of GFB_FFT_WAYS slots. A code point hashes to one set and replaces the
+least recently used glyph there, so a few colliding code points no longer evict each other.
 
 @param pfft Pointer to the fixed font descriptor to initialize.
-@param fontid Id of the loaded TTF font to use as typeface.
+@param fontid Id of the loaded TTF or bitmap font to use as typeface.
 @param ptsize Point size of the rendered glyphs.
-@param n How many entries in the cache.
+@param n How many entries in the cache, rounded down to a multiple of GFB_FFT_WAYS when larger.
 @param w The width of each glyph in pixels.
 @param h The height of each glyph in pixels.
 
@@ -736,6 +1565,39 @@ Only the alpha channel is saved and actual pixel values are calculated on runtim
 */
 int gfb_fft_create(gfb_fft_t *pfft, gfb_font_id fontid, int ptsize, int n, int w, int h);
 
+/**
+Create a fixed font cache that stores each glyph at its own bitmap size.
+A W*H cell still bounds every glyph, but a glyph only takes the bytes of its bitmap, so Latin text needs
+a fraction of the memory gfb_fft_create() reserves. Glyphs are packed back to back in size bytes. When
+the end is reached the cache is compacted, dropping the least recently used glyphs first if needed.
+
+@param pfft Pointer to the fixed font descriptor to initialize.
+@param fontid Id of the loaded TTF or bitmap font to use as typeface.
+@param ptsize Point size of the rendered glyphs.
+@param n How many entries in the cache, rounded down to a multiple of GFB_FFT_WAYS when larger.
+@param w The width of each glyph in pixels.
+@param h The height of each glyph in pixels.
+@param size Number of bytes for the glyph coverage.
+
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_fft_create_packed(gfb_fft_t *pfft, gfb_font_id fontid, int ptsize, int n, int w, int h, size_t size);
+
+/**
+Set how many bits of coverage a fixed font keeps per pixel, the cache is flushed.
+8 keeps the 256 levels FreeType renders. 4 keeps 16 levels in half the memory. 1 renders the glyphs
+monochrome (FT_LOAD_TARGET_MONO) in an eighth of the memory, runs of blank or solid pixels are then
+drawn a byte of coverage at a time. A fixed cache is resized, a packed one keeps its size and fits more glyphs.
+
+@param pfont Pointer to the fixed font descriptor.
+@param depth Bits per pixel, 8, 4 or 1.
+
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_fft_depth(gfb_fft_t *pfont, int depth);
+
 /**
 Frees the memory used by the given fixed font descriptor.
 
@@ -754,6 +1616,45 @@ Renders a glyph into cache if it is not already in there.
 */
 int gfb_fft_cache(gfb_fft_t *pfont, uint16_t code);
 
+/**
+Render every character of a string into the cache ahead of time, so the first frame to draw them does
+not wait on FreeType. Characters beyond what a set can hold replace each other as usual.
+
+@param pfont Pointer to the fixed font descriptor.
+@param pzutf8 Pointer to NUL terminated UTF8 encoded characters to cache.
+
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+int gfb_fft_warmup(gfb_fft_t *pfont, const char *pzutf8);
+
+/**
+Write the cached glyphs of a fixed font to a file that gfb_fft_open() can map.
+The file holds the cache geometry, the metadata and the coverage of every slot. It is only readable on
+a machine with the same byte order.
+
+@param pfont Pointer to the fixed font descriptor.
+@param pzpath Path of the file to write.
+
+@return On success returns GFB_OK.
+@return On failure a negative error code is returned (GFB_Exxx).
+*/
+int gfb_fft_save(const gfb_fft_t *pfont, const char *pzpath);
+
+/**
+Map a fixed font saved by gfb_fft_save(), the glyphs in it are drawn without any FreeType calls.
+The file is mapped copy-on-write, only the pages of glyphs rendered after opening take private memory.
+Free it with gfb_fft_destroy().
+
+@param pfft Pointer to the fixed font descriptor to initialize.
+@param pzpath Path of the file to map.
+@param fontid Id of the loaded TTF font to render glyphs missing from the file with, -1 to draw them blank.
+
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_fft_open(gfb_fft_t *pfft, const char *pzpath, gfb_font_id fontid);
+
 /**
 Draw a cached glyph onto surface using the given foreground and background colors.
 
@@ -790,7 +1691,8 @@ The rendering takes place inside the given bounding box.
 @param w Width in pixels.
 @param h Height in pixels.
 @param pzutf8 Pointer to NUL terminated UTF8 encoded string.
-@param count How many characters (not bytes) to print from pzutf8.
+@param count How many characters (not bytes) to print from pzutf8, rendering also stops at the NUL.
+Code points above U+FFFF are skipped, fixed fonts only hold the Basic Multilingual Plane.
 @param colorf Color of the text.
 @param colorb Color of the background.
 
@@ -817,6 +1719,97 @@ Render a number of Unicode glyphs.
 */
 int gfb_fft_textU(gfb_surface_t *psurface, gfb_fft_t *pfont, int x, int y, int w, int h, uint16_t *pcodes, size_t count, gfb_color_t colorf, gfb_color_t colorb);
 
+/** Meta-data for a glyph in a distance field cache. */
+typedef struct {
+	uint32_t code;		/**< The code point currently in this cache slot. */
+	uint16_t flags;		/**< GFB_ISCACHED once the slot holds a glyph. */
+	uint16_t w;			/**< Width of the distance field in pixels. */
+	uint16_t h;			/**< Height of the distance field in pixels. */
+	int16_t left;		/**< Pixels from the pen position to the left edge of the field. */
+	int16_t top;		/**< Pixels from the baseline up to the top edge of the field. */
+	int32_t advance;	/**< Pen advance in 1/64th of pixels. */
+} gfb_sdf_meta_t;
+
+/**
+Signed distance field glyph cache.
+Each glyph is rendered once at a reference size and kept as the distance of every pixel to its outline,
+so it can be drawn at any size by thresholding the interpolated distance. Its memory does not depend on
+how many sizes are drawn. Distances are stored in a byte, 128 on the outline and spread pixels of the
+reference size either side mapped to the ends of the range.
+*/
+typedef struct {
+	gfb_font_id parentid;	/**< Id of the font glyphs are rendered from. A reference is held until destroyed. */
+	uint8_t ptsize;			/**< Point size glyphs are rendered at. */
+	uint8_t spread;			/**< Pixels of distance kept either side of the outline. */
+	uint16_t count;			/**< Number of slots in the cache. */
+	uint16_t ways;			/**< Number of slots in each set, a code point can only be cached in its own set. */
+	uint16_t nsets;			/**< Number of sets. */
+	uint16_t cellw;			/**< Widest distance field a slot holds, larger glyphs are cut. */
+	uint16_t cellh;			/**< Tallest distance field a slot holds, larger glyphs are cut. */
+	uint8_t *pcache;		/**< Distance fields, cellw * cellh bytes per slot. */
+	gfb_sdf_meta_t *pmeta;	/**< Meta-data of each slot. */
+	uint32_t tick;			/**< Counts lookups, stamps the slots as they are used. */
+	uint32_t *plastuse;		/**< Tick of the last use of each slot, the least recently used slot of a set is replaced. */
+	uint64_t hits;			/**< Lookups served from the cache. */
+	uint64_t misses;		/**< Lookups that had to render the glyph. */
+	uint64_t evictions;		/**< Glyphs replaced by another code point. */
+} gfb_sdf_t;
+
+/** Appearance of distance field text, see gfb_sdf_text(). */
+typedef struct gfb_sdf_style {
+	gfb_color_t colorf;			/**< Color of the text. */
+	float outline;				/**< Width of the outline around the text in pixels, 0 for none. */
+	gfb_color_t coloroutline;	/**< Color of the outline. */
+	uint8_t shadowalpha;		/**< Opacity of the shadow, 0 for none. */
+	int shadowx;				/**< Pixels the shadow is moved right. */
+	int shadowy;				/**< Pixels the shadow is moved down. */
+	float shadowblur;			/**< Pixels the edge of the shadow fades over, 1 is as sharp as the text. */
+	gfb_color_t colorshadow;	/**< Color of the shadow. */
+} gfb_sdf_style_t;
+
+/**
+Create a signed distance field cache with N elements from a given TTF font.
+The slots are sized for the largest glyph of the font at ptsize plus spread pixels on every side.
+A reference size around 24 points with a spread of 4 pixels draws well from a third to several times its size.
+Bitmap fonts and builds without FreeType are not supported, GFB_ENOTSUPPORTED is returned.
+
+@param psdf Pointer to the distance field cache to initialize.
+@param fontid Id of the loaded TTF font to use as typeface.
+@param ptsize Point size of the reference glyphs.
+@param n How many entries in the cache, rounded down to a multiple of GFB_FFT_WAYS when larger.
+@param spread Pixels of distance kept either side of the outline, 1 to 32. Outlines and soft shadows
+can be up to spread pixels of the reference size wide.
+
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_sdf_create(gfb_sdf_t *psdf, gfb_font_id fontid, int ptsize, int n, int spread);
+
+/**
+Frees the memory used by the given distance field cache.
+@param psdf Pointer to the distance field cache.
+*/
+void gfb_sdf_destroy(gfb_sdf_t *psdf);
+
+/**
+Render UTF8 encoded text at any size from a distance field cache.
+The text is blended over the surface. A shadow is drawn under every glyph first, then the outline and
+the text on top, all from the same distance fields.
+
+@param psurface Pointer to the surface to draw on.
+@param psdf Pointer to the distance field cache.
+@param ptsize Point size to draw at, fractions allowed.
+@param x Left pixel position of the pen.
+@param y Pixel row of the baseline.
+@param pzutf8 Pointer to NUL terminated UTF8 encoded string.
+@param count How many characters (not bytes) to print from pzutf8, rendering also stops at the NUL.
+@param pstyle Pointer to the colors, outline and shadow of the text.
+
+@return On success, returns GFB_OK.
+@return On failure, returns a negative error code is returned (GFB_Exxx).
+*/
+int gfb_sdf_text(gfb_surface_t *psurface, gfb_sdf_t *psdf, float ptsize, int x, int y, const char *pzutf8, size_t count, const gfb_sdf_style_t *pstyle);
+
 /**
 Returns a short copyright and license clause.
 @return Const pointer to the NUL terminated text.
@@ -50,8 +50,19 @@ gfb_devop_t gfb_k70_devops = {
 	.circle         = gfb_soft_circle,
 	.filledrectangle= gfb_soft_filledrectangle,
 	.filledcircle   = gfb_soft_filledcircle,
+	.ellipse        = gfb_soft_ellipse,
+	.filledellipse  = gfb_soft_filledellipse,
+	.filledpolygon	= gfb_soft_filledpolygon,
 	.floodfill		= gfb_soft_floodfill,
+	.line_aa		= gfb_soft_line_aa,
+	.circle_aa		= gfb_soft_circle_aa,
+	.filledcircle_aa= gfb_soft_filledcircle_aa,
+	.points			= gfb_soft_points,
+	.lines			= gfb_soft_lines,
+	.rects			= gfb_soft_rects,
+	.filledrects	= gfb_soft_filledrects,
 	.text           = gfb_soft_text,
+	.textu          = gfb_soft_textu,
 };
 
 /** @} */